@@ -11,14 +11,25 @@
 #include <dirent.h>
 #include <sys/syscall.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <regex>
+#include <limits>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include "bench.h"
+#include "expansion.h"
+#include "filters.h"
+#include "signals.h"
+#include "snapshot.h"
+#include "trace.h"
+#include "utilities.h"
 
 using namespace std;
 
 const string WHITESPACE = " \n\r\t\f\v";
 
 const set<std::string> SmallShell::RESERVED_KEYWORDS =
-        {"chprompt", "showpid", "pwd", "cd", "jobs", "fg", "quit", "kill", "alias", "unalias", "listdir", ">", ">>", "getuser", "|", "watch"};
+        {"chprompt", "showpid", "pwd", "cd", "jobs", "fg", "quit", "kill", "alias", "unalias", "listdir", ">", ">>", "getuser", "|", "watch", "history", "timeout", "pipeconf", "cache", "trace", "audit", "after", "after-ok", "dircache", "export", "unset", "snapshot", "bench", "limit", "ulimit", "prlimit"};
 
 #if 0
 #define FUNC_ENTRY()  \
@@ -45,6 +56,56 @@ string _trim(const string &s) {
     return _rtrim(_ltrim(s));
 }
 
+// Returns what is left of the line after its first num_words words, trimmed
+string _skipWords(const string &s, int num_words) {
+    string rest = _ltrim(s);
+    for (int i = 0; i < num_words && !rest.empty(); i++) {
+        size_t end = rest.find_first_of(WHITESPACE);
+        rest = (end == string::npos) ? "" : _ltrim(rest.substr(end));
+    }
+    return _rtrim(rest);
+}
+
+// Ends a forked child. exit() would also flush stdin, and when the input of smash is a file that moves
+// the offset it shares with the shell back to the last line the shell has read, so it is bypassed
+void _exitChild(int status) {
+    cout.flush();
+    cerr.flush();
+    _exit(status);
+}
+
+// Whether s is a non-negative number small enough for an int
+bool _isNumber(const string &s) {
+    return !s.empty() && s.length() <= 9 && all_of(s.begin(), s.end(), ::isdigit);
+}
+
+// Parses durations such as 10, 1.5, 500ms, 2m or 1h, in seconds unless a suffix says otherwise
+static bool parseDuration(const string& str, long* ms) {
+    char* end;
+    errno = 0;
+    double value = strtod(str.c_str(), &end);
+    if (end == str.c_str() || errno != 0 || !(value >= 0)) {
+        return false;
+    }
+    string suffix(end);
+    double scale;
+    if (suffix == "ms") {
+        scale = 1;
+    } else if (suffix.empty() || suffix == "s") {
+        scale = 1000;
+    } else if (suffix == "m") {
+        scale = 60 * 1000;
+    } else if (suffix == "h") {
+        scale = 60 * 60 * 1000;
+    } else if (suffix == "d") {
+        scale = 24 * 60 * 60 * 1000;
+    } else {
+        return false;
+    }
+    *ms = (long)(value * scale);
+    return true;
+}
+
 int _parseCommandLine(const char *cmd_line, char **args) {
     FUNC_ENTRY()
     int i = 0;
@@ -83,11 +144,6 @@ void _removeBackgroundSign(char *cmd_line) {
     cmd_line[str.find_last_not_of(WHITESPACE, idx) + 1] = 0;
 }
 
-bool isBackgroundCommand(const std::string& cmd_line) {
-    std::string str = _trim(cmd_line);
-    return !str.empty() && str.back() == '&';
-}
-
 void freeArgs(char** args, int num_args) {
     for (int i = 0; i < num_args; i++) {
         if (args[i]) {
@@ -99,7 +155,7 @@ void freeArgs(char** args, int num_args) {
 
 //-------------------------------------- Command --------------------------------------
 
-Command::Command(const string& cmd_line) : cmd_line(cmd_line) {
+Command::Command(const string& cmd_line, Kind kind) : cmd_line(cmd_line), kind(kind), exitStatus(0) {
     // Constructor implementation here
 }
 
@@ -112,10 +168,68 @@ const string& Command::getCmdLine() const
     return cmd_line;
 }
 
+Command::Kind Command::getKind() const
+{
+    return kind;
+}
+
+void Command::setSource(const shared_ptr<CommandNode>& node)
+{
+    source = node;
+}
+
+void Command::setOriginalCmdLine(const shared_ptr<CommandNode>& node)
+{
+    shown = node;
+}
+
+const string& Command::getOriginalCmdLine() const
+{
+    return (shown != nullptr) ? shown->display : cmd_line;
+}
+
+int Command::getExitStatus() const
+{
+    return exitStatus;
+}
+
+void Command::setAssignments(const vector<string>& assignments)
+{
+    this->assignments = assignments;
+}
+
+const vector<string>& Command::getAssignments() const
+{
+    return assignments;
+}
+
+void Command::setLimits(const ResourceLimits& limits)
+{
+    this->limits = limits;
+}
+
+const ResourceLimits& Command::getLimits() const
+{
+    return limits;
+}
+
+int Command::parseArgs(char** args) const
+{
+    if (source == nullptr || source->kind != CommandNode::SIMPLE) {
+        return _parseCommandLine(cmd_line.c_str(), args);
+    }
+    int i = 0;
+    for (const string& word : source->words) {
+        args[i] = strdup(word.c_str());
+        args[++i] = NULL;
+    }
+    return i;
+}
+
 
 //---------------------------------- Built in commands ----------------------------------
 
-BuiltInCommand::BuiltInCommand(const string& cmd_line) : Command(cmd_line)
+BuiltInCommand::BuiltInCommand(const string& cmd_line, Kind kind) : Command(cmd_line, kind)
 {}
 
 ChpromptCommand::ChpromptCommand(const string& cmd_line) : BuiltInCommand(cmd_line)
@@ -123,7 +237,7 @@ ChpromptCommand::ChpromptCommand(const string& cmd_line) : BuiltInCommand(cmd_li
 void ChpromptCommand::execute() {
     SmallShell& shell = SmallShell::getInstance(); // Get the existing instance (singleton)
     char* args[COMMAND_MAX_LENGTH];
-    int num_args = _parseCommandLine(cmd_line.c_str(), args);
+    int num_args = parseArgs(args);
     string newPrompt = args[1] ? args[1] : "smash";
     shell.setPrompt(newPrompt); // Change the prompt of the existing instance
 
@@ -152,6 +266,7 @@ void GetCurrDirCommand::execute() {
     char buf[PATH_MAX];
     if (getcwd(buf, PATH_MAX) == nullptr) {
         perror("smash error: getcwd failed");
+        exitStatus = 1;
     } else {
         cout << buf << endl;
     }
@@ -162,11 +277,12 @@ ChangeDirCommand::ChangeDirCommand(const string& cmd_line, char **plastPwd) : Bu
 {}
 void ChangeDirCommand::execute() {
     char* args[COMMAND_MAX_ARGS];
-    int num_args = _parseCommandLine(cmd_line.c_str(), args);
+    int num_args = parseArgs(args);
 
     // Check if the number of arguments is valid
     if (num_args > 2) {
         cerr << "smash error: cd: too many arguments" << endl;
+        exitStatus = 1;
         freeArgs(args, num_args);
         return;
     }
@@ -188,6 +304,7 @@ void ChangeDirCommand::execute() {
         if (*lastPwd == nullptr) {
             // If OLDPWD is not set, print an error message
             cerr << "smash error: cd: OLDPWD not set" << endl;
+            exitStatus = 1;
             freeArgs(args, num_args);
             free(currPwd);
             return;
@@ -197,6 +314,7 @@ void ChangeDirCommand::execute() {
 
     if (currPwd == nullptr) {
         perror("smash error: getcwd failed");
+        exitStatus = 1;
         freeArgs(args, num_args);
         free(currPwd);
         return;
@@ -205,6 +323,7 @@ void ChangeDirCommand::execute() {
     // Change the working directory
     if (chdir(path) == -1) {
         perror("smash error: chdir failed");
+        exitStatus = 1;
         freeArgs(args, num_args);
         free(currPwd);
         return;
@@ -212,6 +331,7 @@ void ChangeDirCommand::execute() {
 
     free(*lastPwd);
     *lastPwd = currPwd;
+    SmallShell::getInstance().getDirCache().changedDir();
 
     freeArgs(args, num_args);
 }
@@ -220,8 +340,82 @@ void ChangeDirCommand::execute() {
 JobsCommand::JobsCommand(const string& cmd_line, JobsList* jobs) : BuiltInCommand(cmd_line), jobs(jobs)
 {}
 void JobsCommand::execute() {
-    jobs->removeFinishedJobs();
-    jobs->printJobsList();
+    char* args[COMMAND_MAX_ARGS];
+    int numArgs = parseArgs(args);
+    vector<string> words(args, args + numArgs);
+    freeArgs(args, numArgs);
+
+    if (numArgs == 1) {
+        // A job killed by one of its limits is reported once, the others simply leave the list
+        jobs->removeFinishedJobs();
+        for (const string& notice : jobs->takeLimitNotices()) {
+            cout << notice << endl;
+        }
+        jobs->printJobsList();
+        return;
+    }
+    if (numArgs == 2 && words[1] == "--graph") {
+        jobs->removeFinishedJobs();
+        jobs->printGraph();
+        return;
+    }
+
+    OutputCapture& captures = SmallShell::getInstance().getCaptures();
+    // jobs --capture on|off
+    if (words[1] == "--capture") {
+        if (numArgs != 3 || (words[2] != "on" && words[2] != "off")) {
+            cerr << "smash error: jobs: invalid arguments" << endl;
+            exitStatus = 1;
+            return;
+        }
+        if (!captures.setEnabled(words[2] == "on")) {
+            exitStatus = 1;
+        }
+        return;
+    }
+
+    // jobs -o ID [-n LINES] or jobs -f ID
+    bool follow = (words[1] == "-f");
+    size_t numLines = 0;
+    bool valid = (words[1] == "-o" || follow) && numArgs >= 3 && _isNumber(words[2]);
+    if (valid && numArgs > 3) {
+        valid = !follow && numArgs == 5 && words[3] == "-n" && _isNumber(words[4]);
+        numLines = valid ? stoul(words[4]) : 0;
+    }
+    if (!valid) {
+        cerr << "smash error: jobs: invalid arguments" << endl;
+        exitStatus = 1;
+        return;
+    }
+
+    int jobId = stoi(words[2]);
+    string output;
+    if (!follow) {
+        if (!captures.read(jobId, numLines, output)) {
+            cerr << "smash error: jobs: job-id " << jobId << " has no captured output" << endl;
+            exitStatus = 1;
+            return;
+        }
+        cout << output << flush;
+        return;
+    }
+
+    // Print the output as it arrives, until the job closes it or ctrl-C
+    SmallShell& smash = SmallShell::getInstance();
+    uint64_t position = 0;
+    bool finished = false;
+    smash.takeInterrupt();
+    while (!finished && !smash.takeInterrupt()) {
+        if (!captures.readFrom(jobId, position, output, finished)) {
+            cerr << "smash error: jobs: job-id " << jobId << " has no captured output" << endl;
+            exitStatus = 1;
+            return;
+        }
+        cout << output << flush;
+        if (!finished) {
+            smash.waitForEvents(-1, -1);
+        }
+    }
 }
 
 
@@ -229,11 +423,12 @@ ForegroundCommand::ForegroundCommand(const std::string& cmd_line, JobsList *jobs
 {}
 void ForegroundCommand::execute() {
     char* args[COMMAND_MAX_ARGS];
-    int numArgs = _parseCommandLine(cmd_line.c_str(), args);
+    int numArgs = parseArgs(args);
 
     // Check if the number of arguments is valid
     if (numArgs > 2) {
         cerr << "smash error: fg: invalid arguments" << endl;
+        exitStatus = 1;
         freeArgs(args, numArgs);
         return;
     }
@@ -246,11 +441,13 @@ void ForegroundCommand::execute() {
             jobId = stoi(arg);
             if (jobId <= 0) {
                 cerr << "smash error: fg: invalid arguments" << endl;
+                exitStatus = 1;
                 freeArgs(args, numArgs);
                 return;
             }
         } else {
             cerr << "smash error: fg: invalid arguments" << endl;
+            exitStatus = 1;
             freeArgs(args, numArgs);
             return;
         }
@@ -263,6 +460,7 @@ void ForegroundCommand::execute() {
         job = jobs->getLastJob(&lastJobId);
         if (job == nullptr) {
             cerr << "smash error: fg: jobs list is empty" << endl;
+            exitStatus = 1;
             freeArgs(args, numArgs);
             return;
         }
@@ -272,29 +470,47 @@ void ForegroundCommand::execute() {
         job = jobs->getJobById(jobId);
         if (job == nullptr) {
             cerr << "smash error: fg: job-id " << jobId << " does not exist" << endl;
+            exitStatus = 1;
             freeArgs(args, numArgs);
             return;
         }
     }
+    if (job->isPending()) {
+        cerr << "smash error: fg: job-id " << jobId << " is waiting for other jobs" << endl;
+        exitStatus = 1;
+        freeArgs(args, numArgs);
+        return;
+    }
+    // A job being spawned is waited for until it has its pid, one that could not start is gone
+    SmallShell& smash = SmallShell::getInstance();
+    if (job->isSpawning()) {
+        smash.finishSpawns(true);
+    }
+    if (job->getPid() == -1) {
+        jobs->removeJobById(jobId);
+        exitStatus = 1;
+        freeArgs(args, numArgs);
+        return;
+    }
 
 //    // Print the command line of the job along with its PID
 //    cout << job->getCmdLine() << "& " << job->getPid() << endl;
 
-    ExternalCommand* extCmd = dynamic_cast<ExternalCommand*>(job->getCmd().get());
-    if (extCmd) {
-        cout << extCmd->getOriginalCmdLine() << " " << job->getPid() << endl;
-    }
-
-    // Update the PID of the foreground process
-    SmallShell::getInstance().setFgPid(job->getPid());
+    cout << job->getCmdLine() << " " << job->getPid() << endl;
 
     // Bring the process to the foreground by waiting for it
-    if (waitpid(job->getPid(), nullptr, WCONTINUED | WUNTRACED) == -1) {
+    int status;
+    if (smash.waitForeground(job->getPid(), &status, WCONTINUED | WUNTRACED) == -1) {
         perror("smash error: waitpid failed");
+        exitStatus = 1;
+    } else if (WIFEXITED(status) || WIFSIGNALED(status)) {
+        // The jobs waiting for this one go by how it ended
+        job->setStatus(status);
     }
 
     // Remove the job from the jobs list
     jobs->removeJobById(jobId);
+    smash.launchReadyJobs();
 
     freeArgs(args, numArgs);
 }
@@ -304,9 +520,17 @@ QuitCommand::QuitCommand(const string& cmd_line, JobsList* jobs) : BuiltInComman
 {}
 void QuitCommand::execute() {
     char* args[COMMAND_MAX_ARGS];
-    int numArgs = _parseCommandLine(cmd_line.c_str(), args);
+    int numArgs = parseArgs(args);
     if (numArgs > 1 && strcmp(args[1], "kill") == 0) {
-        SmallShell::getInstance().getJobs().killAllJobs();
+        // quit kill -t GRACE gives the jobs GRACE to exit after SIGTERM before they get SIGKILL
+        long graceMs = 0;
+        if (numArgs > 2 && (strcmp(args[2], "-t") != 0 || numArgs != 4 || !parseDuration(args[3], &graceMs))) {
+            cerr << "smash error: quit: invalid arguments" << endl;
+            exitStatus = 1;
+            freeArgs(args, numArgs);
+            return;
+        }
+        SmallShell::getInstance().getJobs().killAllJobs(graceMs);
     }
     freeArgs(args, numArgs);
     throw QuitException();
@@ -318,10 +542,11 @@ KillCommand::KillCommand(const string& cmd_line, JobsList* jobs) : BuiltInComman
 void KillCommand::execute()
 {
     char *args[COMMAND_MAX_ARGS];
-    int num_args = _parseCommandLine(cmd_line.c_str(), args);
+    int num_args = parseArgs(args);
 
     if (num_args != 3 || args[1][0] != '-') {
         cerr << "smash error: kill: invalid arguments" << endl;
+        exitStatus = 1;
         freeArgs(args, num_args);
         return;
     }
@@ -333,6 +558,7 @@ void KillCommand::execute()
         jobId = std::stoi(args[2]);
     } catch (std::invalid_argument& e) {
         cerr << "smash error: kill: invalid arguments" << endl;
+        exitStatus = 1;
         freeArgs(args, num_args);
         return;
     }
@@ -340,6 +566,7 @@ void KillCommand::execute()
     // Check if signum and jobId are positive
     if (jobId <= 0) {
         cerr << "smash error: kill: invalid arguments" << endl;
+        exitStatus = 1;
         freeArgs(args, num_args);
         return;
     }
@@ -347,13 +574,28 @@ void KillCommand::execute()
     JobsList::JobEntry *job = jobs->getJobById(jobId);
     if (!job) {
         cerr << "smash error: kill: job-id " << jobId << " does not exist" << endl;
+        exitStatus = 1;
         freeArgs(args, num_args);
         return;
     }
 
-    if (kill(job->getPid(), signum) == -1) {
+    // A job that did not start has no process, any signal cancels it and the jobs waiting for it
+    if (job->isPending()) {
+        jobs->cancelJob(*job);
+        cout << "job-id " << jobId << " was cancelled" << endl;
+        SmallShell::getInstance().launchReadyJobs();
+        freeArgs(args, num_args);
+        return;
+    }
+    // The signal goes to the pid, so a job being spawned is waited for until it has one
+    if (job->isSpawning()) {
+        SmallShell::getInstance().finishSpawns(true);
+    }
+
+    if (job->signal(signum) == -1) {
         cout << "signal number " << signum << " was sent to pid " << job->getPid() << endl;
         perror("smash error: kill failed");
+        exitStatus = 1;
         freeArgs(args, num_args);
         return;
     }
@@ -368,14 +610,12 @@ aliasCommand::aliasCommand(const string& cmd_line) : BuiltInCommand(cmd_line)
 {}
 void aliasCommand::execute()
 {
-    string cmd_line_orig = cmd_line;
+    const string& cmd_line_orig = cmd_line;
     SmallShell& smash = SmallShell::getInstance();
 
     // Remove the 'alias' part from the command line
-    size_t pos = cmd_line.find("alias");
-    if (pos != string::npos) {
-        cmd_line.erase(0, pos + 5); // 5 is the length of 'alias'
-    }
+    size_t pos = cmd_line_orig.find("alias");
+    string cmd_line = (pos != string::npos) ? cmd_line_orig.substr(pos + 5) : cmd_line_orig; // 5 is the length of 'alias'
 
     // Trim the command line
     cmd_line = _trim(cmd_line);
@@ -392,6 +632,7 @@ void aliasCommand::execute()
     std::regex alias_regex("^alias [a-zA-Z0-9_]+='[^']*'$");
     if (!std::regex_match(cmd_line_orig, alias_regex)) {
         cerr << "smash error: alias: invalid alias format" << endl;
+        exitStatus = 1;
         return;
     }
 
@@ -402,8 +643,10 @@ void aliasCommand::execute()
     // Check if the name is a reserved keyword or already exists as an alias
     if (smash.isAlias(name) || SmallShell::RESERVED_KEYWORDS.find(name) != SmallShell::RESERVED_KEYWORDS.end()) {
         cerr << "smash error: alias: " << name << " already exists or is a reserved command" << endl;
+        exitStatus = 1;
     } else if (!isValidAlias(name, command)) {
         cerr << "smash error: alias: invalid alias format" << endl;
+        exitStatus = 1;
     } else {
         smash.addAlias(name, command);
     }
@@ -438,13 +681,12 @@ unaliasCommand::unaliasCommand(const string& cmd_line) : BuiltInCommand(cmd_line
 void unaliasCommand::execute()
 {
     SmallShell& smash = SmallShell::getInstance();
-    string cmd_str = _trim(cmd_line); // Remove leading and trailing whitespaces
-
     char* args[COMMAND_MAX_ARGS];
-    int num_args = _parseCommandLine(cmd_str.c_str(), args);
+    int num_args = parseArgs(args);
 
     if (num_args <= 1) { // No arguments provided
         cerr << "smash error: unalias: Not enough arguments" << endl;
+        exitStatus = 1;
         freeArgs(args, num_args);
         return;
     }
@@ -453,6 +695,7 @@ void unaliasCommand::execute()
         string name(args[i]);
         if (!smash.isAlias(name)) { // Alias does not exist
             cerr << "smash error: unalias: " << name << " alias does not exist" << endl;
+            exitStatus = 1;
             break;
         } else {
             smash.removeAlias(name); // Remove the alias
@@ -462,118 +705,193 @@ void unaliasCommand::execute()
     freeArgs(args, num_args);
 }
 
-//---------------------------------- Special Commands ----------------------------------
-
-RedirectionCommand::RedirectionCommand(const std::string& cmd_line): Command(cmd_line) {}
-void RedirectionCommand::execute()
+HistoryCommand::HistoryCommand(const string& cmd_line) : BuiltInCommand(cmd_line)
+{}
+void HistoryCommand::execute()
 {
-    // Split the command line into command and file
-    std::string cmd_s = getCmdLine();
-    size_t pos = cmd_s.find('>');
-    std::string command = cmd_s.substr(0, pos);
-    std::string file = cmd_s.substr(pos + 1);
+    HistoryLog& history = SmallShell::getInstance().getHistory();
+    char* args[COMMAND_MAX_ARGS];
+    int num_args = parseArgs(args);
 
-    // Trim the file string
-    file = _trim(file);
+    if (!history.isOpen()) {
+        cerr << "smash error: history: history is disabled" << endl;
+        exitStatus = 1;
+        freeArgs(args, num_args);
+        return;
+    }
 
-    // Determine the redirection mode
-    int mode = (cmd_s[pos + 1] == '>') ? O_APPEND : O_TRUNC;
+    vector<size_t> entries;
+    if (num_args >= 3 && (strcmp(args[1], "-s") == 0 || strcmp(args[1], "-p") == 0)) {
+        // The pattern is the rest of the line, so it may contain spaces
+        bool prefix = strcmp(args[1], "-p") == 0;
+        entries = history.search(_skipWords(cmd_line, 2), prefix);
+    } else if (num_args <= 2) {
+        size_t total = history.size();
+        size_t count = total;
+        if (num_args == 2) {
+            string arg = args[1];
+            if (arg.empty() || !all_of(arg.begin(), arg.end(), ::isdigit)) {
+                cerr << "smash error: history: invalid arguments" << endl;
+                exitStatus = 1;
+                freeArgs(args, num_args);
+                return;
+            }
+            count = min(total, (size_t)stoul(arg));
+        }
+        for (size_t idx = total - count; idx < total; idx++) {
+            entries.push_back(idx);
+        }
+    } else {
+        cerr << "smash error: history: invalid arguments" << endl;
+        exitStatus = 1;
+        freeArgs(args, num_args);
+        return;
+    }
 
-    // If append mode, remove the extra '>' from the file string
-    if (mode == O_APPEND) {
-        file = _trim(file.substr(1));
+    for (size_t idx : entries) {
+        cout.width(5);
+        cout << idx + 1 << "  " << history.getEntry(idx) << "\n";
     }
+    cout.flush();
 
-    // Open the file
-    int fd = open(file.c_str(), O_WRONLY | O_CREAT | mode, 0666);
+    freeArgs(args, num_args);
+}
+
+//---------------------------------- Special Commands ----------------------------------
+
+// Opens the target of a '>' or '>>' redirection
+static int openRedirection(const CommandNode& node) {
+    int fd = open(node.file.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (node.append ? O_APPEND : O_TRUNC), 0666);
     if (fd == -1) {
         perror("smash error: open failed");
+    }
+    return fd;
+}
+
+// Translates a wait status into a shell exit status
+static int exitStatusOf(int status) {
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return 0;
+}
+
+RedirectionCommand::RedirectionCommand(const shared_ptr<CommandNode>& node) : Command(node->text), node(node)
+{}
+void RedirectionCommand::execute()
+{
+    // Open the file
+    int fd = openRedirection(*node);
+    if (fd == -1) {
+        exitStatus = 1;
         return;
     }
 
     // Save the original stdout
-    int stdout_copy = dup(STDOUT_FILENO);
+    cout.flush();
+    int stdout_copy = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
 
     // Redirect stdout to the file
     dup2(fd, STDOUT_FILENO);
     close(fd);
 
     // Execute the command
-    SmallShell::getInstance().executeCommand(command);
+    SmallShell& smash = SmallShell::getInstance();
+    smash.executeNode(node->children[0], false);
+    exitStatus = smash.getLastStatus();
 
     // Reset stdout
+    cout.flush();
     dup2(stdout_copy, STDOUT_FILENO);
     close(stdout_copy);
 }
 
-ListDirCommand::ListDirCommand(const string& cmd_line) : BuiltInCommand(cmd_line)
+PipeConfCommand::PipeConfCommand(const shared_ptr<CommandNode>& node) : BuiltInCommand(node->text), words(node->words)
 {}
+void PipeConfCommand::execute()
+{
+    // pipeconf [-s SIZE] [-m on|off] sets up the pipes of later pipelines
+    PipeConfig& config = SmallShell::getInstance().getPipeConfig();
+    if (words.size() == 1) {
+        cout << "size: ";
+        if (config.size > 0) {
+            cout << min(config.size, maxPipeSize());
+        } else {
+            cout << "default";
+        }
+        cout << " (max " << maxPipeSize() << ")" << endl;
+        cout << "metering: " << (config.metering ? "on" : "off") << endl;
+        return;
+    }
 
-struct linux_dirent {
-    long d_ino;
-    off_t d_off;
-    unsigned short d_reclen;
-    char d_name[];
-};
+    PipeConfig updated = config;
+    size_t next;
+    if (!parsePipeOptions(words, updated, next) || next != words.size()) {
+        cerr << "smash error: pipeconf: invalid arguments" << endl;
+        exitStatus = 1;
+        return;
+    }
+    config = updated;
+}
+
+
+ListDirCommand::ListDirCommand(const string& cmd_line) : BuiltInCommand(cmd_line)
+{}
 
 void ListDirCommand::execute() {
     char* args[COMMAND_MAX_ARGS];
-    int num_args = _parseCommandLine(cmd_line.c_str(), args);
+    int num_args = parseArgs(args);
 
     if (num_args > 2) {
         std::cerr << "smash error: listdir: Too many arguments" << std::endl;
+        exitStatus = 1;
         freeArgs(args, num_args);
         return;
     }
 
     std::string dir_path = (num_args == 1) ? "." : args[1];
-    int fd = open(dir_path.c_str(), O_RDONLY | O_DIRECTORY);
-    if (fd == -1) {
+    shared_ptr<const DirCache::Listing> listing = SmallShell::getInstance().getDirCache().list(dir_path);
+    if (listing == nullptr) {
         perror("smash error: open failed");
+        exitStatus = 1;
         freeArgs(args, num_args);
         return;
     }
 
-    char buffer[8192];
-    struct linux_dirent* dirent;
-    off_t basep = 0;
-    ssize_t bytes_read;
-
+    // The listing is sorted by name, and so are the files and the directories taken from it
     std::vector<std::string> files;
     std::vector<std::string> directories;
+    for (const DirCache::Entry& entry : *listing) {
+        if (entry.name[0] == '.') {
+            continue;
+        }
 
-    while ((bytes_read = syscall(SYS_getdents, fd, buffer, sizeof(buffer), &basep)) > 0) {
-        for (int i = 0; i < bytes_read; i += dirent->d_reclen) {
-            dirent = (struct linux_dirent*)(&buffer[i]);
-
-            if (dirent->d_name[0] == '.') {
-                continue;
-            }
-
-            std::string full_path = dir_path + "/" + dirent->d_name;
-
+        unsigned char type = entry.type;
+        // Only a stat tells what a symbolic link leads to, and it is not cached since the link may change
+        if (type == DT_LNK || type == DT_UNKNOWN) {
+            std::string full_path = dir_path + "/" + entry.name;
             struct stat entry_stat;
             if (stat(full_path.c_str(), &entry_stat) == -1) {
                 perror("smash error: stat failed");
                 continue;
             }
+            type = S_ISREG(entry_stat.st_mode) ? DT_REG : (S_ISDIR(entry_stat.st_mode) ? DT_DIR : DT_UNKNOWN);
+        }
 
-            if (S_ISREG(entry_stat.st_mode)) {
-                files.push_back(dirent->d_name);
-            } else if (S_ISDIR(entry_stat.st_mode)) {
-                directories.push_back(dirent->d_name);
-            }
+        if (type == DT_REG) {
+            files.push_back(entry.name);
+        } else if (type == DT_DIR) {
+            directories.push_back(entry.name);
         }
     }
 
-    close(fd);
-
-    std::sort(files.begin(), files.end());
     for (const auto& file : files) {
         std::cout << "File: " << file << std::endl;
     }
 
-    std::sort(directories.begin(), directories.end());
     for (const auto& directory : directories) {
         std::cout << "Directory: " << directory << std::endl;
     }
@@ -586,10 +904,11 @@ GetUserCommand::GetUserCommand(const std::string &cmd_line) : BuiltInCommand(cmd
 void GetUserCommand::execute()
 {
     char* args[COMMAND_MAX_ARGS];
-    int num_args = _parseCommandLine(cmd_line.c_str(), args);
+    int num_args = parseArgs(args);
 
     if (num_args != 2) {
         cerr << "smash error: getuser: invalid number of arguments" << endl;
+        exitStatus = 1;
         freeArgs(args, num_args);
         return;
     }
@@ -603,6 +922,7 @@ void GetUserCommand::execute()
     FILE* status = fopen(status_file.c_str(), "r");
     if (status == nullptr) {
         perror("smash error: fopen failed");
+        exitStatus = 1;
         freeArgs(args, num_args);
         return;
     }
@@ -619,6 +939,7 @@ void GetUserCommand::execute()
 
     if (uid == numeric_limits<uid_t>::max()) {
         cerr << "smash error: getuser: failed to get UID of process " << pid << endl;
+        exitStatus = 1;
         freeArgs(args, num_args);
         return;
     }
@@ -627,8 +948,10 @@ void GetUserCommand::execute()
     if ((pw = getpwuid(uid)) == nullptr) {
         if (errno == 0) {
             cerr << "smash error: getuser: process " << pid << " does not exist" << endl;
+            exitStatus = 1;
         } else {
             perror("smash error: getpwuid failed");
+            exitStatus = 1;
         }
         freeArgs(args, num_args);
         return;
@@ -636,6 +959,7 @@ void GetUserCommand::execute()
 
     if ((gr = getgrgid(pw->pw_gid)) == nullptr) {
         perror("smash error: getgrgid failed");
+        exitStatus = 1;
         freeArgs(args, num_args);
         return;
     }
@@ -647,171 +971,1482 @@ void GetUserCommand::execute()
 }
 
 
-PipeCommand::PipeCommand(const string& cmd_line) : Command(cmd_line)
+UtilityCommand::UtilityCommand(const string& cmd_line, vector<string> args)
+        : BuiltInCommand(cmd_line, UTILITY), args(move(args))
+{}
+void UtilityCommand::execute()
+{
+    exitStatus = runUtility(args);
+    // Output left in cout would be written again by the next forked child
+    cout.flush();
+}
+
+// Feeds a builtin filter from fd until the end of the input or until the filter has seen enough,
+// and returns its exit status. In the shell itself the reads go through the event loop so ctrl-C
+// still gets through.
+static int runFilter(TextFilter& filter, int fd) {
+    SmallShell& smash = SmallShell::getInstance();
+    bool inShell = !smash.isInChild();
+    if (inShell) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    cout.flush();
+    vector<char> buffer(FILTER_READ_SIZE);
+    while (true) {
+        ssize_t length = read(fd, buffer.data(), buffer.size());
+        if (length > 0) {
+            if (!filter.consume(buffer.data(), length)) {
+                break;
+            }
+        } else if (length == 0) {
+            break;
+        } else if (errno == EAGAIN && inShell) {
+            smash.waitForEvents(fd, -1);
+            if (smash.takeInterrupt()) {
+                return 128 + SIGINT;
+            }
+        } else if (errno != EINTR) {
+            perror("smash error: read failed");
+            return 1;
+        }
+    }
+    return filter.finish();
+}
+
+PipeCommand::PipeCommand(const shared_ptr<CommandNode>& node) : Command(node->text), node(node)
 {}
 void PipeCommand::execute() {
-    int pipefd[2];
-    if (pipe(pipefd) == -1) {
-        perror("smash error: pipe failed");
-        return;
+    SmallShell& smash = SmallShell::getInstance();
+    vector<shared_ptr<CommandNode>> stages = node->children;
+    size_t numStages = stages.size();
+
+    // A pipeline that starts with pipeconf and options gets its own pipe settings
+    PipeConfig config = smash.getPipeConfig();
+    if (stages[0]->kind == CommandNode::SIMPLE && stages[0]->words[0] == "pipeconf") {
+        size_t next;
+        if (!parsePipeOptions(stages[0]->words, config, next) || next == stages[0]->words.size()) {
+            cerr << "smash error: pipeconf: invalid arguments" << endl;
+            exitStatus = 1;
+            return;
+        }
+        stages[0] = subCommand(*stages[0], next);
     }
 
-    std::string cmd_s = getCmdLine();
-    size_t pos = cmd_s.find('|');
-    if (pos == std::string::npos) {
-        // No pipe character found
-        fprintf(stderr, "smash error: invalid pipe command\n");
-        return;
+    // wc, grep -F, head and tail reading from a pipe run as builtin filters instead of their programs
+    vector<unique_ptr<TextFilter>> filters(numStages);
+    for (size_t i = 1; i < numStages; i++) {
+        const CommandNode& stage = *stages[i];
+        if (stage.kind == CommandNode::SIMPLE && none_of(stage.patterns.begin(), stage.patterns.end(), hasWildcard)) {
+            filters[i] = createTextFilter(stage.words);
+        }
     }
+    // The last stage does not even need a process of its own, unless smash is busy relaying the pipes
+    bool filterInShell = filters[numStages - 1] && !config.metering;
 
-    bool isPipeAnd = (pos + 1 < cmd_s.length() && cmd_s[pos + 1] == '&');
-    std::string cmd1 = cmd_s.substr(0, pos);
-    std::string cmd2 = isPipeAnd ? cmd_s.substr(pos + 2) : cmd_s.substr(pos + 1);
+    PipeMeter meter;
+    vector<pid_t> pids;
+    int inputFd = -1;
 
-    pid_t pid1 = fork();
-    if (pid1 < 0) {
-        perror("smash error: fork failed");
-        return;
-    }
+    for (size_t i = 0; i < numStages; i++) {
+        bool last = (i + 1 == numStages);
+        if (last && filterInShell) {
+            break;
+        }
+        int pipefd[2] = {-1, -1};
+        int relayfd[2] = {-1, -1};
+        if (!last && !createPipe(pipefd, config)) {
+            break;
+        }
+        // When metering, the stage writes into pipefd and the next one reads from relayfd,
+        // and smash copies the data from one to the other
+        if (!last && config.metering && !createPipe(relayfd, config)) {
+            close(pipefd[0]);
+            close(pipefd[1]);
+            break;
+        }
 
-    if (pid1 == 0) {
-        // Child process 1
-        close(pipefd[0]); // Close unused read end
-        if (dup2(pipefd[1], STDOUT_FILENO) == -1) {
-            perror("smash error: dup2 failed");
-            exit(1);
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("smash error: fork failed");
+            for (int fd : {pipefd[0], pipefd[1], relayfd[0], relayfd[1]}) {
+                if (fd != -1) {
+                    close(fd);
+                }
+            }
+            break;
         }
-        if (isPipeAnd && dup2(pipefd[1], STDERR_FILENO) == -1) {
-            perror("smash error: dup2 failed");
-            exit(1);
+
+        if (pid == 0) {
+            // All the stages of a pipeline started by smash itself share one process group
+            if (!smash.isInChild() && setpgid(0, pids.empty() ? 0 : pids[0]) == -1) {
+                perror("smash error: setpgid failed");
+                _exitChild(1);
+            }
+            // A stage holding the shell's end of a pipe would keep its reader from seeing the end of the data
+            for (int fd : meter.getFds()) {
+                close(fd);
+            }
+            if (inputFd != -1) {
+                if (dup2(inputFd, STDIN_FILENO) == -1) {
+                    perror("smash error: dup2 failed");
+                    _exitChild(1);
+                }
+                close(inputFd);
+            }
+            if (!last) {
+                close(pipefd[0]); // Close unused read end
+                if (relayfd[0] != -1) {
+                    close(relayfd[0]);
+                    close(relayfd[1]);
+                }
+                if (dup2(pipefd[1], STDOUT_FILENO) == -1) {
+                    perror("smash error: dup2 failed");
+                    _exitChild(1);
+                }
+                if (node->connectors[i] == CommandNode::PIPE_STDERR && dup2(pipefd[1], STDERR_FILENO) == -1) {
+                    perror("smash error: dup2 failed");
+                    _exitChild(1);
+                }
+                close(pipefd[1]); // Close write end after duplication
+            }
+            if (filters[i]) {
+                smash.enterChild();
+                _exitChild(runFilter(*filters[i], STDIN_FILENO));
+            }
+            smash.executeInChild(stages[i]);
+        }
+
+        // Parent process
+        traceEvent('B', stages[i]->text, pid);
+        smash.noteFork(pid);
+        if (!smash.isInChild()) {
+            setpgid(pid, pids.empty() ? pid : pids[0]);
         }
-        close(pipefd[1]); // Close write end after duplication
-        SmallShell::getInstance().executeCommand(cmd1);
-        exit(0); // Exit child process
+        pids.push_back(pid);
+        if (inputFd != -1) {
+            close(inputFd);
+        }
+        if (!last) {
+            close(pipefd[1]);
+            if (relayfd[0] != -1) {
+                meter.addPipe(pipefd[0], relayfd[1]);
+                inputFd = relayfd[0];
+            } else {
+                inputFd = pipefd[0];
+            }
+        }
+    }
+    int filterStatus = 1;
+    if (filterInShell && pids.size() == numStages - 1) {
+        // ctrl-C stops the stage feeding the filter
+        smash.setFgPid(pids.back());
+        uint64_t filterStart = traceEnabled() ? traceNow() : 0;
+        filterStatus = runFilter(*filters[numStages - 1], inputFd);
+        traceEvent('X', stages[numStages - 1]->text, getpid(), filterStart);
+        smash.setFgPid(-1);
+    }
+    if (inputFd != -1) {
+        close(inputFd);
     }
 
-    pid_t pid2 = fork();
-    if (pid2 < 0) {
-        perror("smash error: fork failed");
-        return;
+    if (config.metering) {
+        // ctrl-C stops the last stage, and the others follow as their pipes close
+        if (!pids.empty()) {
+            smash.setFgPid(pids.back());
+        }
+        meter.run();
     }
 
-    if (pid2 == 0) {
-        // Child process 2
-        close(pipefd[1]); // Close unused write end
-        if (dup2(pipefd[0], STDIN_FILENO) == -1) {
-            perror("smash error: dup2 failed");
-            exit(1);
+    // The status of a pipeline is the status of its last stage
+    int status = 0;
+    for (pid_t pid : pids) {
+        if (smash.waitForeground(pid, &status, 0) == -1) {
+            perror("smash error: waitpid failed");
         }
-        close(pipefd[0]); // Close read end after duplication
-        SmallShell::getInstance().executeCommand(cmd2);
-        exit(0); // Exit child process
+    }
+    if (filterInShell) {
+        exitStatus = (pids.size() == numStages - 1) ? filterStatus : 1;
+    } else {
+        exitStatus = (pids.size() == numStages) ? exitStatusOf(status) : 1;
     }
 
-    // Parent process
-    close(pipefd[0]); // Close both ends in parent
-    close(pipefd[1]);
-    int status;
-    waitpid(pid1, &status, 0); // Wait for first child
-    waitpid(pid2, &status, 0); // Wait for second child
+    if (config.metering && pids.size() == numStages) {
+        vector<string> stageNames;
+        for (const auto& stage : stages) {
+            stageNames.push_back(stage->text);
+        }
+        meter.report(stageNames);
+    }
 }
 
 
-WatchCommand::WatchCommand(const string& cmd_line) : Command(cmd_line)
+ListCommand::ListCommand(const shared_ptr<CommandNode>& node) : Command(node->text), node(node)
 {}
-void WatchCommand::execute()
-{
-    // Add a signal handler for SIGINT
-    signal(SIGINT, [](int signum) {
-        exit(0);
-    });
+void ListCommand::execute() {
+    SmallShell& smash = SmallShell::getInstance();
+    for (size_t i = 0; i < node->children.size(); i++) {
+        // '&&' and '||' run the next command depending on the status of the previous one
+        if (i > 0 && ((node->connectors[i - 1] == CommandNode::AND && smash.getLastStatus() != 0) ||
+                      (node->connectors[i - 1] == CommandNode::OR && smash.getLastStatus() == 0))) {
+            continue;
+        }
+        smash.executeNode(node->children[i], node->connectors[i] == CommandNode::BACKGROUND);
+    }
+    exitStatus = smash.getLastStatus();
+}
 
-    char* args[COMMAND_MAX_ARGS];
-    int num_args = _parseCommandLine(cmd_line.c_str(), args);
 
-    int interval = 2; // Default interval is 2 seconds
-    if (num_args > 1 && args[1][0] == '-') {
-        try {
-            interval = std::stoi(args[1] + 1); // skip the '-' and convert to integer
-        } catch (std::invalid_argument& e) {
-            cerr << "smash error: watch: invalid interval" << endl;
-            freeArgs(args, num_args);
-            return;
+TraceCommand::TraceCommand(const string& cmd_line) : BuiltInCommand(cmd_line)
+{}
+void TraceCommand::execute()
+{
+    char* args[COMMAND_MAX_ARGS];
+    int numArgs = parseArgs(args);
+    if (numArgs == 3 && strcmp(args[1], "start") == 0) {
+        if (traceEnabled()) {
+            cerr << "smash error: trace: already started" << endl;
+            exitStatus = 1;
+        } else if (!traceStart(args[2])) {
+            perror("smash error: trace failed");
+            exitStatus = 1;
         }
+    } else if (numArgs == 2 && strcmp(args[1], "stop") == 0) {
+        uint64_t dropped;
+        if (!traceEnabled()) {
+            cerr << "smash error: trace: not started" << endl;
+            exitStatus = 1;
+        } else if (!traceStop(&dropped)) {
+            perror("smash error: trace failed");
+            exitStatus = 1;
+        } else if (dropped > 0) {
+            cerr << "smash: trace: " << dropped << " events did not fit in the buffer" << endl;
+        }
+    } else {
+        cerr << "smash error: trace: invalid arguments" << endl;
+        exitStatus = 1;
     }
+    freeArgs(args, numArgs);
+}
 
-    if (num_args < 2) {
-        cerr << "smash error: watch: command not specified" << endl;
-        freeArgs(args, num_args);
+
+AuditCommand::AuditCommand(const string& cmd_line) : BuiltInCommand(cmd_line)
+{}
+void AuditCommand::execute()
+{
+    char* args[COMMAND_MAX_ARGS];
+    int numArgs = parseArgs(args);
+    freeArgs(args, numArgs);
+    AuditLog& audit = SmallShell::getInstance().getAudit();
+    if (numArgs != 1) {
+        cerr << "smash error: audit: invalid arguments" << endl;
+        exitStatus = 1;
         return;
     }
+    if (!audit.isEnabled()) {
+        cout << "audit: off" << endl;
+        return;
+    }
+    AuditLog::Stats stats = audit.getStats();
+    cout << "audit: " << audit.getPath() << endl;
+    cout << "logged: " << stats.logged << endl;
+    cout << "pending: " << stats.pending << endl;
+    cout << "dropped: " << stats.dropped << endl;
+    cout << "failed: " << stats.failed << endl;
+}
+
+
+// Runs line once the way executeCommand would and measures it
+static BenchSample runBenchOnce(const string& line) {
+    SmallShell& smash = SmallShell::getInstance();
+    struct rusage selfBefore, childrenBefore, selfAfter, childrenAfter;
+    getrusage(RUSAGE_SELF, &selfBefore);
+    getrusage(RUSAGE_CHILDREN, &childrenBefore);
+    uint64_t start = traceNow();
+    string error;
+    shared_ptr<CommandNode> tree = parseCommandLine(line, smash.getAliases(), error);
+    smash.executeNode(tree, false);
+    uint64_t end = traceNow();
+    getrusage(RUSAGE_SELF, &selfAfter);
+    getrusage(RUSAGE_CHILDREN, &childrenAfter);
+
+    auto seconds = [](const struct timeval& after, const struct timeval& before) {
+        return (after.tv_sec - before.tv_sec) + (after.tv_usec - before.tv_usec) / 1e6;
+    };
+    BenchSample sample;
+    sample.wall = (end - start) / 1e9;
+    sample.user = seconds(selfAfter.ru_utime, selfBefore.ru_utime) +
+                  seconds(childrenAfter.ru_utime, childrenBefore.ru_utime);
+    sample.system = seconds(selfAfter.ru_stime, selfBefore.ru_stime) +
+                    seconds(childrenAfter.ru_stime, childrenBefore.ru_stime);
+    sample.status = smash.getLastStatus();
+    return sample;
+}
+
+BenchCommand::BenchCommand(const shared_ptr<CommandNode>& node) : BuiltInCommand(node->text, BENCH), node(node)
+{}
+void BenchCommand::execute()
+{
+    SmallShell& smash = SmallShell::getInstance();
+    const vector<string>& words = node->words;
+    long runs = BENCH_DEFAULT_RUNS;
+    long warmups = 0;
+    long minTimeMs = 0;
+    bool json = false;
+    size_t next = 1;
+    bool valid = true;
+    while (valid && next < words.size() && words[next].length() > 1 && words[next][0] == '-') {
+        if (words[next] == "--json") {
+            json = true;
+            next++;
+            continue;
+        }
+        valid = next + 1 < words.size();
+        if (valid && words[next] == "-n") {
+            valid = _isNumber(words[next + 1]) && (runs = stol(words[next + 1])) > 0 && runs <= BENCH_MAX_RUNS;
+        } else if (valid && words[next] == "-w") {
+            valid = _isNumber(words[next + 1]) && (warmups = stol(words[next + 1])) <= BENCH_MAX_RUNS;
+        } else if (valid && words[next] == "--min-time") {
+            valid = parseDuration(words[next + 1], &minTimeMs);
+        } else {
+            valid = false;
+        }
+        next += 2;
+    }
+    vector<string> commands(words.begin() + min(next, words.size()), words.end());
+    if (!valid || commands.empty() || commands.size() > 2) {
+        cerr << "smash error: bench: invalid arguments" << endl;
+        exitStatus = 1;
+        return;
+    }
+    for (const string& command : commands) {
+        string error;
+        if (all_of(command.begin(), command.end(), ::isspace)) {
+            error = "empty command";
+        } else if (!parseCommandLine(command, smash.getAliases(), error)) {
+            error = command + ": " + error;
+        }
+        if (!error.empty()) {
+            cerr << "smash error: bench: " << error << endl;
+            exitStatus = 1;
+            return;
+        }
+    }
+
+    // The output of the commands is dropped, the report goes where bench's stdout goes
+    int devNull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    int savedStdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (devNull == -1 || savedStdout == -1) {
+        perror("smash error: bench: open failed");
+        exitStatus = 1;
+        if (devNull != -1) {
+            close(devNull);
+        }
+        return;
+    }
+    cout.flush();
+    dup2(devNull, STDOUT_FILENO);
+    close(devNull);
+    auto restoreStdout = [savedStdout]() {
+        cout.flush();
+        dup2(savedStdout, STDOUT_FILENO);
+        close(savedStdout);
+    };
+
+    vector<vector<BenchSample>> samples(commands.size());
+    bool interrupted = false;
+    smash.takeInterrupt();
+    try {
+        for (long run = 0; run < warmups && !interrupted; run++) {
+            for (size_t i = 0; i < commands.size() && !interrupted; i++) {
+                BenchSample sample = runBenchOnce(commands[i]);
+                interrupted = smash.takeInterrupt() || sample.status == 128 + SIGINT;
+            }
+        }
+        // Alternating the commands spreads whatever else the system does over both
+        uint64_t start = traceNow();
+        for (long run = 0; !interrupted && run < BENCH_MAX_RUNS &&
+                           (run < runs || (traceNow() - start) / 1000000 < (uint64_t)minTimeMs); run++) {
+            for (size_t i = 0; i < commands.size() && !interrupted; i++) {
+                samples[i].push_back(runBenchOnce(commands[i]));
+                // A builtin that waits takes the interrupt itself and ends with the status of SIGINT
+                interrupted = smash.takeInterrupt() || samples[i].back().status == 128 + SIGINT;
+            }
+        }
+    } catch (const QuitException &e) {
+        restoreStdout();
+        throw;
+    }
+    restoreStdout();
+    if (interrupted) {
+        // The notice of the ctrl-C handler went to /dev/null with the output of the command
+        cout << "smash: got ctrl-C" << endl;
+        exitStatus = 130;
+        return;
+    }
+    string report = json ? formatBenchJson(commands, samples, warmups) : formatBenchReport(commands, samples, warmups);
+    cout << report << flush;
+}
+
+
+LimitCommand::LimitCommand(const string& cmd_line) : BuiltInCommand(cmd_line)
+{}
+void LimitCommand::execute()
+{
+    cerr << "smash error: limit: invalid arguments" << endl;
+    exitStatus = 1;
+}
+
+
+UlimitCommand::UlimitCommand(const string& cmd_line) : BuiltInCommand(cmd_line)
+{}
+void UlimitCommand::execute()
+{
+    char* args[COMMAND_MAX_ARGS];
+    int numArgs = parseArgs(args);
+    vector<string> words(args, args + numArgs);
+    freeArgs(args, numArgs);
+    ResourceLimits& defaults = SmallShell::getInstance().getDefaultLimits();
+
+    // The limits smash has itself are the ones its children inherit where no default is set
+    if (numArgs == 1 || (numArgs == 2 && words[1] == "-a")) {
+        cout << formatLimits(defaults);
+        return;
+    }
+    int index = limitIndex(words[1]);
+    if (numArgs == 2 && index != -1) {
+        rlim_t value = defaults.values[index];
+        cout << formatLimit((value != LIMIT_UNSET) ? value : currentLimit(index)) << endl;
+        return;
+    }
+    ResourceLimits limits;
+    size_t next;
+    if (!parseLimits(words, 1, &limits, &next) || next != words.size()) {
+        cerr << "smash error: ulimit: invalid arguments" << endl;
+        exitStatus = 1;
+        return;
+    }
+    // A child could not set a limit above the hard limit of smash, so it is refused right away
+    for (int i = 0; i < LIMIT_COUNT; i++) {
+        rlim_t value = limits.values[i];
+        rlim_t hard = hardLimit(i);
+        if (value != LIMIT_UNSET && hard != RLIM_INFINITY && (value == RLIM_INFINITY || value > hard)) {
+            cerr << "smash error: ulimit: the hard limit is " << formatLimit(hard) << endl;
+            exitStatus = 1;
+            return;
+        }
+    }
+    defaults.merge(limits);
+}
+
+
+PrlimitCommand::PrlimitCommand(const string& cmd_line, JobsList* jobs) : BuiltInCommand(cmd_line), jobs(jobs)
+{}
+void PrlimitCommand::execute()
+{
+    char* args[COMMAND_MAX_ARGS];
+    int numArgs = parseArgs(args);
+    vector<string> words(args, args + numArgs);
+    freeArgs(args, numArgs);
+
+    ResourceLimits limits;
+    size_t next;
+    if (numArgs < 2 || !_isNumber(words[1]) || !parseLimits(words, 2, &limits, &next) || next != words.size()) {
+        cerr << "smash error: prlimit: invalid arguments" << endl;
+        exitStatus = 1;
+        return;
+    }
+    int jobId = atoi(words[1].c_str());
+    JobsList::JobEntry* job = jobs->getJobById(jobId);
+    if (job == nullptr) {
+        cerr << "smash error: prlimit: job-id " << jobId << " does not exist" << endl;
+        exitStatus = 1;
+        return;
+    }
+    if (job->isPending()) {
+        cerr << "smash error: prlimit: job-id " << jobId << " has not started yet" << endl;
+        exitStatus = 1;
+        return;
+    }
+    if (job->isSpawning()) {
+        SmallShell::getInstance().finishSpawns(true);
+    }
+    if (numArgs == 2) {
+        // What the process has, it may have changed its own limits since it started
+        ResourceLimits current;
+        if (!readLimits(job->getPid(), &current)) {
+            perror("smash error: prlimit failed");
+            exitStatus = 1;
+            return;
+        }
+        cout << formatLimits(current);
+        return;
+    }
+    // Raising a hard limit takes CAP_SYS_RESOURCE, prlimit fails with EPERM otherwise
+    if (!applyLimits(job->getPid(), limits)) {
+        perror("smash error: prlimit failed");
+        exitStatus = 1;
+        return;
+    }
+    ResourceLimits updated = job->getLimits();
+    updated.merge(limits);
+    job->setLimits(updated);
+}
+
 
-    string command = args[1][0] == '-' ? args[2] : args[1];
-
+AfterCommand::AfterCommand(const shared_ptr<CommandNode>& node) : BuiltInCommand(node->text, AFTER), node(node),
+                                                                  isBackground(false)
+{}
+void AfterCommand::setBackground(bool isBackground)
+{
+    this->isBackground = isBackground;
+}
+// The redirections of node applied to command, in place of the SIMPLE node they wrap
+static shared_ptr<CommandNode> withRedirections(const shared_ptr<CommandNode>& node,
+                                                const shared_ptr<CommandNode>& command)
+{
+    if (node->kind != CommandNode::REDIRECT) {
+        return command;
+    }
+    shared_ptr<CommandNode> copy = make_shared<CommandNode>(*node);
+    copy->children[0] = withRedirections(node->children[0], command);
+    return copy;
+}
+
+void AfterCommand::execute()
+{
+    SmallShell& smash = SmallShell::getInstance();
+    JobsList& jobs = smash.getJobs();
+    const CommandNode* simple = node.get();
+    while (simple->kind == CommandNode::REDIRECT) {
+        simple = simple->children[0].get();
+    }
+    const vector<string>& words = simple->words;
+    const string& name = words[0];
+    bool requireSuccess = (name == "after-ok");
+
+    // The job ids, with or without '%', up to the first word that is not one
+    vector<int> dependencies;
+    size_t next = 1;
+    for (; next < words.size(); next++) {
+        string id = words[next].substr((words[next][0] == '%') ? 1 : 0);
+        if (!_isNumber(id)) {
+            break;
+        }
+        dependencies.push_back(stoi(id));
+    }
+    if (dependencies.empty() || next >= words.size()) {
+        cerr << "smash error: " << name << ": invalid arguments" << endl;
+        exitStatus = 1;
+        return;
+    }
+    // Only smash can wait for its jobs, a copy of the list in a child is of no use
+    if (smash.isInChild()) {
+        cerr << "smash error: " << name << ": cannot wait for jobs outside of smash" << endl;
+        exitStatus = 1;
+        return;
+    }
+    jobs.removeFinishedJobs();
+    for (int dependency : dependencies) {
+        if (jobs.getJobById(dependency) == nullptr) {
+            cerr << "smash error: " << name << ": job-id " << dependency << " does not exist" << endl;
+            exitStatus = 1;
+            return;
+        }
+    }
+
+    shared_ptr<CommandNode> command = withRedirections(node, subCommand(*simple, next));
+    if (isBackground) {
+        shared_ptr<Command> cmd = smash.CreateCommand(command);
+        cmd->setOriginalCmdLine(node);
+        char* cwd = getcwd(nullptr, 0);
+        int jobId = jobs.addPendingJob(cmd, command, dependencies, requireSuccess, (cwd != nullptr) ? cwd : "");
+        free(cwd);
+        if (jobId == 0) {
+            cerr << "smash error: " << name << ": the job would wait for itself" << endl;
+            exitStatus = 1;
+            return;
+        }
+        smash.launchReadyJobs();
+        return;
+    }
+
+    // In the foreground the shell waits like for any command, until ctrl-C
+    JobsList::DependencyState state;
+    smash.takeInterrupt();
+    while ((state = jobs.checkDependencies(dependencies, requireSuccess)) == JobsList::DEPS_WAITING) {
+        smash.waitForEvents(-1, -1);
+        if (smash.takeInterrupt()) {
+            exitStatus = 130;
+            return;
+        }
+    }
+    if (state == JobsList::DEPS_FAILED) {
+        cerr << "smash error: " << name << ": a job it waits for failed or was cancelled" << endl;
+        exitStatus = 1;
+        return;
+    }
+    smash.executeNode(command, false);
+    exitStatus = smash.getLastStatus();
+}
+
+
+ExportCommand::ExportCommand(const shared_ptr<CommandNode>& node) : BuiltInCommand(node->text), node(node)
+{}
+void ExportCommand::execute()
+{
+    Environment& environment = SmallShell::getInstance().getEnvironment();
+    // The words after quote removal, so a value may hold spaces. Without 'export' they are bare assignments.
+    const vector<string>& words = node->words;
+    size_t first = (words[0] == "export") ? 1 : 0;
+    if (first == words.size()) {
+        vector<string> entries;
+        for (char* const* entry = environment.getEnvp(); *entry != nullptr; entry++) {
+            entries.push_back(*entry);
+        }
+        sort(entries.begin(), entries.end());
+        for (const string& entry : entries) {
+            cout << entry << endl;
+        }
+        return;
+    }
+    for (size_t i = first; i < words.size(); i++) {
+        if (Environment::isAssignment(words[i])) {
+            environment.assign(words[i]);
+        } else if (!Environment::isName(words[i])) {
+            // Without a value a valid name is left as it is, smash has no unexported variables
+            cerr << "smash error: export: " << words[i] << ": not a valid identifier" << endl;
+            exitStatus = 1;
+        }
+    }
+}
+
+
+UnsetCommand::UnsetCommand(const string& cmd_line) : BuiltInCommand(cmd_line)
+{}
+void UnsetCommand::execute()
+{
+    char* args[COMMAND_MAX_ARGS];
+    int numArgs = parseArgs(args);
+    Environment& environment = SmallShell::getInstance().getEnvironment();
+    for (int i = 1; i < numArgs; i++) {
+        if (!Environment::isName(args[i])) {
+            cerr << "smash error: unset: " << args[i] << ": not a valid identifier" << endl;
+            exitStatus = 1;
+            continue;
+        }
+        environment.unset(args[i]);
+    }
+    freeArgs(args, numArgs);
+}
+
+
+SnapshotCommand::SnapshotCommand(const string& cmd_line) : BuiltInCommand(cmd_line)
+{}
+void SnapshotCommand::execute()
+{
+    char* args[COMMAND_MAX_ARGS];
+    int numArgs = parseArgs(args);
+    vector<string> words(args, args + numArgs);
+    freeArgs(args, numArgs);
+    if (numArgs != 3 || words[1] != "save") {
+        cerr << "smash error: snapshot: invalid arguments" << endl;
+        exitStatus = 1;
+        return;
+    }
+    if (!saveSnapshot(SmallShell::getInstance(), words[2])) {
+        perror("smash error: snapshot: save failed");
+        exitStatus = 1;
+    }
+}
+
+
+DirCacheCommand::DirCacheCommand(const string& cmd_line) : BuiltInCommand(cmd_line)
+{}
+void DirCacheCommand::execute()
+{
+    char* args[COMMAND_MAX_ARGS];
+    int numArgs = parseArgs(args);
+    vector<string> words(args, args + numArgs);
+    freeArgs(args, numArgs);
+    DirCache& dirCache = SmallShell::getInstance().getDirCache();
+    if (numArgs == 2 && (words[1] == "on" || words[1] == "off")) {
+        if (!dirCache.setEnabled(words[1] == "on")) {
+            perror("smash error: dircache: inotify_init1 failed");
+            exitStatus = 1;
+        }
+        return;
+    }
+    if (numArgs != 1) {
+        cerr << "smash error: dircache: invalid arguments" << endl;
+        exitStatus = 1;
+        return;
+    }
+    DirCache::Stats stats = dirCache.getStats();
+    cout << "dircache: " << (dirCache.isEnabled() ? "on" : "off") << endl;
+    cout << "directories: " << stats.directories << endl;
+    cout << "entries: " << stats.entries << " (max " << DIRCACHE_MAX_ENTRIES << ")" << endl;
+    cout << "hits: " << stats.hits << endl;
+    cout << "misses: " << stats.misses << endl;
+    cout << "invalidations: " << stats.invalidations << endl;
+}
+
+
+WatchCommand::WatchCommand(const string& cmd_line) : Command(cmd_line, WATCH)
+{}
+void WatchCommand::execute()
+{
+    // Add a signal handler for SIGINT
+    signal(SIGINT, [](int signum) {
+        _exit(0);
+    });
+
+    char* args[COMMAND_MAX_ARGS];
+    int num_args = parseArgs(args);
+
+    int interval = 2; // Default interval is 2 seconds
+    if (num_args > 1 && args[1][0] == '-') {
+        try {
+            interval = std::stoi(args[1] + 1); // skip the '-' and convert to integer
+        } catch (std::invalid_argument& e) {
+            cerr << "smash error: watch: invalid interval" << endl;
+            freeArgs(args, num_args);
+            exitStatus = 1;
+            return;
+        }
+    }
+
+    // The command is the rest of the line, it is parsed once and run again every interval
+    string command = (num_args > 1) ? _skipWords(cmd_line, args[1][0] == '-' ? 2 : 1) : "";
     freeArgs(args, num_args);
 
+    if (command.empty()) {
+        cerr << "smash error: watch: command not specified" << endl;
+        exitStatus = 1;
+        return;
+    }
+
+    SmallShell& smash = SmallShell::getInstance();
+    string error;
+    shared_ptr<CommandNode> tree = parseCommandLine(command, smash.getAliases(), error);
+    if (!tree) {
+        cerr << "smash error: " << error << endl;
+        exitStatus = 1;
+        return;
+    }
+
     while (true) {
         // Clear the screen
         system("clear");
 
         // Execute the command
-        SmallShell::getInstance().executeCommand(command);
+        smash.executeNode(tree, false);
 
         // Sleep for the given interval
         sleep(interval);
     }
 }
 
+
+// Parses a signal given by number or by name, with or without the SIG prefix
+static int parseSignal(const string& str) {
+    static const pair<const char*, int> SIGNALS[] = {
+            {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"ABRT", SIGABRT}, {"KILL", SIGKILL},
+            {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"PIPE", SIGPIPE}, {"ALRM", SIGALRM}, {"TERM", SIGTERM},
+            {"CONT", SIGCONT}, {"STOP", SIGSTOP}, {"TSTP", SIGTSTP}, {"XCPU", SIGXCPU}, {"XFSZ", SIGXFSZ}
+    };
+    if (!str.empty() && all_of(str.begin(), str.end(), ::isdigit)) {
+        int signum = atoi(str.c_str());
+        return (signum > 0 && signum < NSIG) ? signum : -1;
+    }
+    string name = (str.compare(0, 3, "SIG") == 0) ? str.substr(3) : str;
+    for (const auto& signal : SIGNALS) {
+        if (name == signal.first) {
+            return signal.second;
+        }
+    }
+    return -1;
+}
+
+TimeoutCommand::TimeoutCommand(const shared_ptr<CommandNode>& node)
+        : Command(node->text, TIMEOUT), signum(SIGTERM), durationMs(0), killAfterMs(0), valid(false), pid(-1), fired(false)
+{
+    // timeout [-s SIG] [-k DURATION] DURATION command
+    const vector<string>& words = node->words;
+    size_t i = 1;
+    while (i + 1 < words.size() && (words[i] == "-s" || words[i] == "-k")) {
+        if (words[i] == "-s") {
+            signum = parseSignal(words[i + 1]);
+            if (signum == -1) {
+                return;
+            }
+        } else if (!parseDuration(words[i + 1], &killAfterMs)) {
+            return;
+        }
+        i += 2;
+    }
+    if (i + 1 >= words.size() || !parseDuration(words[i], &durationMs)) {
+        return;
+    }
+    command = subCommand(*node, i + 1);
+    valid = true;
+
+    timer.callback = onDeadline;
+    timer.data = this;
+}
+
+TimeoutCommand::~TimeoutCommand() {
+    stop();
+}
+
+void TimeoutCommand::execute() {
+    if (!valid) {
+        cerr << "smash error: timeout: invalid arguments" << endl;
+        exitStatus = 125;
+        return;
+    }
+    SmallShell::getInstance().executeInChild(command);
+}
+
+bool TimeoutCommand::isValid() const {
+    return valid;
+}
+
+void TimeoutCommand::start(pid_t pid) {
+    this->pid = pid;
+    if (durationMs > 0) {
+        SmallShell::getInstance().getTimers().add(&timer, durationMs);
+    }
+}
+
+void TimeoutCommand::stop() {
+    if (valid) {
+        SmallShell::getInstance().getTimers().cancel(&timer);
+    }
+}
+
+bool TimeoutCommand::hasTimedOut() const {
+    return fired;
+}
+
+long TimeoutCommand::getRemainingMs() const {
+    return SmallShell::getInstance().getTimers().remainingMs(&timer);
+}
+
+void TimeoutCommand::onDeadline(Timer* timer) {
+    TimeoutCommand* cmd = (TimeoutCommand*)timer->data;
+    int signum = cmd->fired ? SIGKILL : cmd->signum;
+    if (!cmd->fired) {
+        cmd->fired = true;
+        cout << "smash: got an alarm" << endl;
+        cout << "smash: " << cmd->getOriginalCmdLine() << " timed out!" << endl;
+        if (cmd->killAfterMs > 0) {
+            // Escalate to SIGKILL if the command is still around after the grace period
+            SmallShell::getInstance().getTimers().add(timer, cmd->killAfterMs);
+        }
+    }
+    // The child leads its own process group, so the whole job gets the signal
+    if (killpg(cmd->pid, signum) == -1) {
+        kill(cmd->pid, signum);
+    }
+}
+
+// Passes the output of a cached command through to stdout as it comes, keeping a copy for the store
+class CacheRecorder : public TextFilter {
+public:
+    string output;
+    bool tooLarge = false;
+
+    bool consume(const char* data, size_t length) override {
+        write(data, length);
+        flush();
+        if (!tooLarge && output.size() + length <= CACHE_MAX_ENTRY_SIZE) {
+            output.append(data, length);
+        } else {
+            tooLarge = true;
+            output.clear();
+        }
+        return true;
+    }
+
+    int finish() override {
+        flush();
+        return 0;
+    }
+};
+
+CacheCommand::CacheCommand(const shared_ptr<CommandNode>& node) : BuiltInCommand(node->text, CACHE), node(node)
+{}
+void CacheCommand::execute()
+{
+    SmallShell& smash = SmallShell::getInstance();
+    OutputCache& cache = smash.getCache();
+    const vector<string>& words = node->words;
+    if (words.size() == 2 && words[1] == "stats") {
+        OutputCache::Stats stats = cache.getStats();
+        cout << "entries: " << stats.entries << endl;
+        cout << "size: " << stats.bytes << " bytes (max " << CACHE_MAX_SIZE << ")" << endl;
+        cout << "hits: " << stats.hits << endl;
+        cout << "misses: " << stats.misses << endl;
+        cout << "evictions: " << stats.evictions << endl;
+        return;
+    }
+    if (words.size() == 2 && words[1] == "clear") {
+        if (!cache.clear()) {
+            perror("smash error: cache: clear failed");
+            exitStatus = 1;
+        }
+        return;
+    }
+
+    // --ttl DURATION and any number of --dep FILE, where FILE may be a wildcard
+    long ttlMs = 0;
+    vector<string> deps;
+    size_t next = 1;
+    for (; next + 1 < words.size() && words[next].compare(0, 2, "--") == 0; next += 2) {
+        if (words[next] == "--ttl" && parseDuration(words[next + 1], &ttlMs) && ttlMs > 0) {
+            continue;
+        } else if (words[next] == "--dep") {
+            vector<string> files = expandWildcards(vector<string>(1, node->patterns[next + 1]));
+            deps.insert(deps.end(), files.begin(), files.end());
+        } else {
+            next = words.size();
+        }
+    }
+    if (next >= words.size() || words[next].compare(0, 2, "--") == 0) {
+        cerr << "smash error: cache: invalid arguments" << endl;
+        exitStatus = 1;
+        return;
+    }
+
+    // The key is the directory, the expanded command and the identity and version of every dependency
+    shared_ptr<CommandNode> command = subCommand(*node, next);
+    char* cwd = getcwd(nullptr, 0);
+    string key = string("cwd ") + (cwd != nullptr ? cwd : "") + '\0';
+    free(cwd);
+    for (const string& arg : expandWildcards(command->patterns)) {
+        key += "arg " + arg + '\0';
+    }
+    for (const string& dep : deps) {
+        struct stat st;
+        key += "dep " + dep + '\0';
+        if (stat(dep.c_str(), &st) == 0) {
+            key += to_string(st.st_dev) + ":" + to_string(st.st_ino) + ":" + to_string(st.st_size) + ":" +
+                   to_string(st.st_mtim.tv_sec) + "." + to_string(st.st_mtim.tv_nsec) + '\0';
+        } else {
+            key += string("missing") + '\0';
+        }
+    }
+
+    OutputCache::Entry entry;
+    if (cache.lookup(key, entry)) {
+        cout.write(entry.output.data(), entry.output.size());
+        cout.flush();
+        exitStatus = entry.status;
+        return;
+    }
+
+    // A miss runs the command in a child whose stdout is a pipe read by the shell
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) == -1) {
+        perror("smash error: pipe failed");
+        exitStatus = 1;
+        return;
+    }
+    cout.flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("smash error: fork failed");
+        close(pipefd[0]);
+        close(pipefd[1]);
+        exitStatus = 1;
+        return;
+    }
+    if (pid == 0) {
+        if (!smash.isInChild() && setpgrp() == -1) {
+            perror("smash error: setpgrp failed");
+            _exitChild(1);
+        }
+        close(pipefd[0]);
+        if (dup2(pipefd[1], STDOUT_FILENO) == -1) {
+            perror("smash error: dup2 failed");
+            _exitChild(1);
+        }
+        close(pipefd[1]);
+        smash.executeInChild(command);
+    }
+
+    traceEvent('B', node->display, pid);
+    smash.noteFork(pid);
+    close(pipefd[1]);
+    CacheRecorder recorder;
+    smash.setFgPid(pid);
+    runFilter(recorder, pipefd[0]);
+    smash.setFgPid(-1);
+    close(pipefd[0]);
+
+    int status;
+    if (smash.waitForeground(pid, &status, 0) == -1) {
+        perror("smash error: waitpid failed");
+        exitStatus = 1;
+        return;
+    }
+    exitStatus = exitStatusOf(status);
+    // A command that was killed did not get to write all of its output
+    if (WIFEXITED(status) && !recorder.tooLarge) {
+        entry.status = exitStatus;
+        entry.output = recorder.output;
+        cache.store(key, entry, (ttlMs + 999) / 1000);
+    }
+}
+
+
 //---------------------------------- Job List ----------------------------------
 
-JobsList::JobsList() : maxJobId(1)
+JobsList::JobsList() : maxJobId(1), numPending(0)
+{}
+
+JobsList::JobEntry::JobEntry(int jobId, shared_ptr<Command> cmd, InternedString cmdLine, pid_t pid, int pidFd,
+                             bool ownGroup, InternedString cwd)
+        : jobId(jobId), pid(pid), pidFd(pidFd), status(0), ownGroup(ownGroup), reaped(false), pending(false),
+          spawning(false), cancelled(false), startTime(AuditLog::now()), cmdLine(move(cmdLine)), cwd(move(cwd)),
+          cmd(move(cmd))
+{
+    if (pid != -1) {
+        dropCommand();
+    }
+}
+
+JobsList::JobEntry::JobEntry(int jobId, shared_ptr<Command> cmd, InternedString cmdLine, shared_ptr<CommandNode> node,
+                             vector<int> waitingFor, bool requireSuccess, InternedString cwd)
+        : jobId(jobId), pid(-1), pidFd(-1), status(0), ownGroup(false), reaped(false), pending(true),
+          spawning(false), cancelled(false), startTime(AuditLog::now()), cmdLine(move(cmdLine)), cwd(move(cwd)),
+          cmd(move(cmd)), dependencies(new Dependencies{requireSuccess, move(waitingFor), move(node)})
 {}
 
-void JobsList::removeFinishedJobs() {
+void JobsList::JobEntry::dropCommand() {
+    if (cmd != nullptr && cmd->getKind() != Command::TIMEOUT) {
+        cmd.reset();
+    }
+}
+
+shared_ptr<CommandNode> JobsList::JobEntry::getNode() const {
+    return (dependencies != nullptr) ? dependencies->node : nullptr;
+}
+
+const ResourceLimits& JobsList::JobEntry::getLimits() const {
+    static const ResourceLimits none;
+    return (limits != nullptr) ? *limits : none;
+}
+
+void JobsList::JobEntry::setLimits(const ResourceLimits& limits) {
+    // Most jobs run without limits, and keep no room for them
+    this->limits.reset(limits.empty() ? nullptr : new ResourceLimits(limits));
+}
+
+bool JobsList::JobEntry::requiresSuccess() const {
+    return dependencies != nullptr && dependencies->requireSuccess;
+}
+
+const vector<int>& JobsList::JobEntry::getWaitingFor() const {
+    static const vector<int> none;
+    return (dependencies != nullptr) ? dependencies->waitingFor : none;
+}
+
+vector<int>& JobsList::JobEntry::getWaitingFor() {
+    return dependencies->waitingFor;
+}
+
+bool JobsList::JobEntry::isFinished() {
+    // A job without a process must never get to waitpid, which would take any child for -1
+    if (pid == -1) {
+        return cancelled || reaped;
+    }
+    if (!reaped && waitpid(pid, &status, WNOHANG) != 0) {
+        setReaped(status);
+    }
+    return reaped;
+}
+
+bool JobsList::JobEntry::peekExit(int* exitStatus) {
+    if (reaped) {
+        *exitStatus = exitStatusOf(status);
+        return true;
+    }
+    if (pid == -1) {
+        return false;
+    }
+    siginfo_t info;
+    info.si_pid = 0;
+    if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == -1) {
+        // Reaped by someone the list does not know about, the outcome is lost
+        *exitStatus = 0;
+        return true;
+    }
+    if (info.si_pid == 0) {
+        return false;
+    }
+    *exitStatus = (info.si_code == CLD_EXITED) ? info.si_status : 128 + info.si_status;
+    return true;
+}
+
+void JobsList::JobEntry::setStatus(int status) {
+    reaped = true;
+    this->status = status;
+}
+
+void JobsList::JobEntry::start(pid_t pid, int pidFd, bool ownGroup) {
+    this->pid = pid;
+    this->pidFd = pidFd;
+    this->ownGroup = ownGroup;
+    pending = false;
+    spawning = false;
+    startTime = AuditLog::now();
+    dependencies.reset();
+    dropCommand();
+}
+
+void JobsList::JobEntry::spawnFailed() {
+    spawning = false;
+    reaped = true;
+    status = W_EXITCODE(1, 0);
+}
+
+void JobsList::JobEntry::cancel() {
+    pending = false;
+    cancelled = true;
+    dependencies.reset();
+}
+
+void JobsList::JobEntry::setReaped(int status) {
+    reaped = true;
+    this->status = status;
+    traceEvent('E', "reaped", pid);
+    SmallShell& smash = SmallShell::getInstance();
+    smash.getAudit().log('j', cmdLine.str(), cwd.str(), pid, exitStatusOf(status), startTime);
+    smash.getJobTable().finish(pid, exitStatusOf(status));
+}
+
+int JobsList::JobEntry::signal(int signum) const {
+    if (reaped || pid == -1) {
+        errno = ESRCH;
+        return -1;
+    }
+    if (ownGroup) {
+        return killpg(pid, signum);
+    }
+    if (pidFd != -1) {
+        return syscall(SYS_pidfd_send_signal, pidFd, signum, nullptr, 0);
+    }
+    return kill(pid, signum);
+}
+
+const char* JobsList::JobEntry::getLimitReason() const {
+    return (reaped && pid != -1) ? limitKillReason(status, getLimits()) : nullptr;
+}
+
+void JobsList::JobEntry::release() {
+    if (pidFd != -1) {
+        close(pidFd);
+        pidFd = -1;
+    }
+}
+
+void JobsList::removeFinishedJobs(vector<string>* finished) {
+    // The ids of the jobs removed here may be given to new jobs, so nothing may still wait for them
+    resolvePending();
     int highestRemainingJobId = 0;
     for (auto it = jobs.begin(); it != jobs.end(); ) {
         if (it->isFinished()) {
+            const char* limit = it->getLimitReason();
+            string notice = "[" + to_string(it->getJobId()) + "] " + it->getCmdLine() +
+                            ((limit != nullptr) ? string(" killed: ") + limit
+                                                : (it->isCancelled() ? " cancelled" : " done"));
+            if (finished != nullptr) {
+                finished->push_back(notice);
+            } else if (limit != nullptr) {
+                limitNotices.push_back(notice);
+            }
+            it->release();
             it = jobs.erase(it);
         } else {
             highestRemainingJobId = std::max(highestRemainingJobId, it->getJobId());
             ++it;
         }
     }
-    maxJobId = highestRemainingJobId;
+    maxJobId = highestRemainingJobId;
+}
+
+vector<string> JobsList::takeLimitNotices() {
+    vector<string> notices;
+    notices.swap(limitNotices);
+    return notices;
+}
+
+void JobsList::printJobsList() {
+    for (const auto& job : jobs) {
+        cout << "[" << job.getJobId() << "] "
+             << job.getCmdLine();
+        shared_ptr<Command> cmd = job.getCmd();
+        TimeoutCommand* timeoutCmd = (cmd != nullptr && cmd->getKind() == Command::TIMEOUT) ? static_cast<TimeoutCommand*>(cmd.get())
+                                                                           : nullptr;
+        if (timeoutCmd && !timeoutCmd->hasTimedOut()) {
+            char remaining[32];
+            snprintf(remaining, sizeof(remaining), "%.1fs", timeoutCmd->getRemainingMs() / 1000.0);
+            cout << " (timeout in " << remaining << ")";
+        }
+        if (job.isSpawning()) {
+            cout << " (starting)";
+        }
+        if (job.isPending()) {
+            cout << " (waiting for";
+            for (int dependency : job.getWaitingFor()) {
+                cout << " %" << dependency;
+            }
+            cout << ")";
+        }
+        cout << endl;
+    }
+}
+
+void JobsList::printGraph() {
+    set<int> listed;
+    for (const auto& job : jobs) {
+        listed.insert(job.getJobId());
+    }
+    set<int> shown;
+    for (const auto& job : jobs) {
+        const vector<int>& waitingFor = job.getWaitingFor();
+        if (none_of(waitingFor.begin(), waitingFor.end(), [&](int id) { return listed.count(id) > 0; })) {
+            printGraphFrom(job, 0, shown);
+        }
+    }
+}
+
+void JobsList::printGraphFrom(const JobEntry& job, int depth, set<int>& shown) {
+    cout << string(2 * depth, ' ') << (depth > 0 ? "-> " : "") << "[" << job.getJobId() << "] ";
+    // A job waiting for several others is listed under each of them, in full only the first time
+    if (!shown.insert(job.getJobId()).second) {
+        cout << "(see above)" << endl;
+        return;
+    }
+    cout << job.getCmdLine() << (job.isPending() ? " (waiting)" : "") << endl;
+    for (const auto& dependent : jobs) {
+        const vector<int>& waitingFor = dependent.getWaitingFor();
+        if (find(waitingFor.begin(), waitingFor.end(), job.getJobId()) != waitingFor.end()) {
+            printGraphFrom(dependent, depth + 1, shown);
+        }
+    }
+}
+
+int JobsList::addJob(shared_ptr<Command> cmd, pid_t pid, bool ownGroup) {
+
+    // Remove finished jobs from the jobs list
+    removeFinishedJobs();
+    int jobId = jobs.empty() ? 1 : maxJobId + 1;
+    // Without a pidfd (an old kernel, or no fds left) the job is signalled by its pid
+    int pidFd = syscall(SYS_pidfd_open, pid, 0);
+    InternedString cwd;
+    char buffer[PATH_MAX];
+    if (SmallShell::getInstance().getAudit().isEnabled() && getcwd(buffer, sizeof(buffer)) != nullptr) {
+        cwd = lines.intern(buffer);
+    }
+    ResourceLimits limits = SmallShell::getInstance().getDefaultLimits();
+    limits.merge(cmd->getLimits());
+    jobs.push_back(JobEntry(jobId, cmd, lines.intern(cmd->getOriginalCmdLine()), pid, pidFd, ownGroup, cwd));
+    jobs.back().setLimits(limits);
+    SmallShell::getInstance().getJobTable().add(jobId, pid, jobs.back().getCmdLine());
+    maxJobId = jobId;  // Update the maximum job ID
+    return jobId;
+}
+
+int JobsList::addSpawningJob(shared_ptr<Command> cmd) {
+    removeFinishedJobs();
+    int jobId = jobs.empty() ? 1 : maxJobId + 1;
+    jobs.push_back(JobEntry(jobId, cmd, lines.intern(cmd->getOriginalCmdLine()), -1, -1, true, InternedString()));
+    jobs.back().spawn();
+    maxJobId = jobId;
+    return jobId;
+}
+
+int JobsList::addPendingJob(shared_ptr<Command> cmd, shared_ptr<CommandNode> node, const vector<int>& dependencies,
+                            bool requireSuccess, const string& cwd) {
+    removeFinishedJobs();
+    int jobId = jobs.empty() ? 1 : maxJobId + 1;
+    for (int dependency : dependencies) {
+        if (dependency == jobId || dependsOn(dependency, jobId)) {
+            return 0;
+        }
+    }
+    jobs.push_back(JobEntry(jobId, cmd, lines.intern(cmd->getOriginalCmdLine()), node, dependencies, requireSuccess,
+                            lines.intern(cwd)));
+    maxJobId = jobId;
+    numPending++;
+    return jobId;
+}
+
+bool JobsList::dependsOn(int jobId, int target) {
+    const JobEntry* job = getJobById(jobId);
+    if (job == nullptr) {
+        return false;
+    }
+    for (int dependency : job->getWaitingFor()) {
+        if (dependency == target || dependsOn(dependency, target)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void JobsList::startJob(int jobId, pid_t pid, bool ownGroup) {
+    JobEntry* job = getJobById(jobId);
+    if (job == nullptr || !(job->isPending() || job->isSpawning())) {
+        return;
+    }
+    if (job->isPending()) {
+        numPending--;
+    }
+    // The command is dropped by start
+    ResourceLimits limits = SmallShell::getInstance().getDefaultLimits();
+    limits.merge(job->getCmd()->getLimits());
+    job->start(pid, syscall(SYS_pidfd_open, pid, 0), ownGroup);
+    job->setLimits(limits);
+    SmallShell::getInstance().getJobTable().add(jobId, pid, job->getCmdLine());
+}
+
+void JobsList::cancelJob(JobEntry& job) {
+    if (job.isPending()) {
+        job.cancel();
+        numPending--;
+    }
+}
+
+bool JobsList::hasPending() const {
+    return numPending > 0;
+}
+
+JobsList::DependencyState JobsList::checkDependencies(vector<int>& waitingFor, bool requireSuccess) {
+    for (auto it = waitingFor.begin(); it != waitingFor.end(); ) {
+        JobEntry* dependency = getJobById(*it);
+        int exitStatus = 0;
+        // A job that left the list without being seen to finish, such as one stopped by fg, no longer holds
+        // anything back
+        if (dependency != nullptr && !dependency->isCancelled() && !dependency->peekExit(&exitStatus)) {
+            ++it;
+            continue;
+        }
+        if (dependency != nullptr && (dependency->isCancelled() || (requireSuccess && exitStatus != 0))) {
+            return DEPS_FAILED;
+        }
+        it = waitingFor.erase(it);
+    }
+    return waitingFor.empty() ? DEPS_READY : DEPS_WAITING;
 }
 
-void JobsList::printJobsList() {
-    for (const auto& job : jobs) {
-        ExternalCommand* extCmd = dynamic_cast<ExternalCommand*>(job.getCmd().get());
-        if (extCmd) {
-            cout << "[" << job.getJobId() << "] "
-                 << extCmd->getOriginalCmdLine() << endl;
+vector<int> JobsList::resolvePending() {
+    vector<int> ready;
+    // Every cancellation may cancel the jobs waiting for the cancelled one
+    bool cancelled = true;
+    while (numPending > 0 && cancelled) {
+        cancelled = false;
+        ready.clear();
+        for (auto& job : jobs) {
+            if (!job.isPending()) {
+                continue;
+            }
+            DependencyState state = checkDependencies(job.getWaitingFor(), job.requiresSuccess());
+            if (state == DEPS_FAILED) {
+                cancelJob(job);
+                cancelled = true;
+            } else if (state == DEPS_READY) {
+                ready.push_back(job.getJobId());
+            }
         }
     }
+    return ready;
 }
 
-void JobsList::addJob(shared_ptr<Command> cmd, pid_t pid) {
+static long monotonicMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
 
-    // Remove finished jobs from the jobs list
-    removeFinishedJobs();
-    int jobId = jobs.empty() ? 1 : maxJobId + 1;
-    jobs.push_back(JobEntry(jobId, cmd, pid));
-    maxJobId = jobId;  // Update the maximum job ID
+void JobsList::reapJobs(const vector<JobEntry*>& targets, long timeoutMs) {
+    unordered_map<pid_t, JobEntry*> waiting;
+    for (JobEntry* job : targets) {
+        if (!job->isFinished()) {
+            waiting[job->getPid()] = job;
+        }
+    }
+    // Every wakeup reaps whichever children exited, so the cost does not grow with the jobs still running
+    SmallShell& smash = SmallShell::getInstance();
+    long deadline = monotonicMs() + timeoutMs;
+    while (!waiting.empty()) {
+        int status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            auto it = waiting.find(pid);
+            if (it != waiting.end()) {
+                it->second->setReaped(status);
+                waiting.erase(it);
+            }
+        }
+        long remaining = deadline - monotonicMs();
+        if ((pid == -1 && errno == ECHILD) || remaining <= 0) {
+            break;
+        }
+        // A child gets SIGCHLD the usual way and cannot be woken up by it
+        smash.waitForEvents(-1, (int)(smash.isInChild() ? min(remaining, 10L) : remaining));
+    }
 }
 
-void JobsList::killAllJobs() {
-    cout << "smash: sending SIGKILL signal to " << jobs.size() << " jobs:" << endl;
+void JobsList::killAllJobs(long graceMs) {
+    int signum = (graceMs > 0) ? SIGTERM : SIGKILL;
+    // Every job needs its pid, and reapJobs must not reap a child it does not know yet
+    SmallShell::getInstance().finishSpawns(true);
+    // Jobs that did not start yet never will
+    size_t count = 0;
+    for (auto &job : jobs) {
+        cancelJob(job);
+        count += job.isCancelled() ? 0 : 1;
+    }
+    cout << "smash: sending " << (graceMs > 0 ? "SIGTERM" : "SIGKILL") << " signal to " << count << " jobs:" << endl;
+    vector<JobEntry*> running;
     for (auto &job : jobs) {
         if (!job.isFinished()) {
-            ExternalCommand* extCmd = dynamic_cast<ExternalCommand*>(job.getCmd().get());
-            if (extCmd) {
-                cout << job.getPid() << ": " << extCmd->getOriginalCmdLine() << endl;
-            }
-            if(kill(job.getPid(), SIGKILL) == -1) {
+            cout << job.getPid() << ": " << job.getCmdLine() << endl;
+            if (job.signal(signum) == -1) {
                 perror("smash error: kill failed");
+                continue;
+            }
+            if (signum == SIGTERM) {
+                // A stopped job has to run to act on SIGTERM
+                job.signal(SIGCONT);
+            }
+            running.push_back(&job);
+        }
+    }
+
+    if (graceMs > 0) {
+        reapJobs(running, graceMs);
+        vector<JobEntry*> survivors;
+        for (JobEntry* job : running) {
+            if (!job->isFinished()) {
+                survivors.push_back(job);
+            }
+        }
+        if (!survivors.empty()) {
+            cout << "smash: sending SIGKILL signal to " << survivors.size() << " jobs:" << endl;
+            for (JobEntry* job : survivors) {
+                cout << job->getPid() << ": " << job->getCmdLine() << endl;
+                if (job->signal(SIGKILL) == -1) {
+                    perror("smash error: kill failed");
+                }
             }
         }
+        running = survivors;
     }
+    reapJobs(running, JOBS_REAP_TIMEOUT_MS);
 }
 
 JobsList::JobEntry* JobsList::getJobById(int jobId) {
@@ -824,12 +2459,18 @@ JobsList::JobEntry* JobsList::getJobById(int jobId) {
 }
 
 void JobsList::removeJobById(int jobId) {
+    resolvePending();
     for (auto it = jobs.begin(); it != jobs.end(); ++it) {
         if (it->getJobId() == jobId) {
             // If the job to be removed has the maximum job ID, decrement maxJobId
             if (it->getJobId() == maxJobId) {
                 --maxJobId;
             }
+            if (it->isPending()) {
+                numPending--;
+            }
+            SmallShell::getInstance().getJobTable().remove(it->getPid());
+            it->release();
             jobs.erase(it);
             return;
         }
@@ -856,172 +2497,770 @@ JobsList::JobEntry *JobsList::getLastJob(int *lastJobId) {
 
 //---------------------------------- External Command ----------------------------------
 
-ExternalCommand::ExternalCommand(const string& cmd_line) : Command(cmd_line)
+ExternalCommand::ExternalCommand(const string& cmd_line, const vector<string>& patterns)
+        : Command(cmd_line, EXTERNAL), patterns(patterns)
 {}
 void ExternalCommand::execute() {
-    // Parse the command line into arguments
-    char* args[COMMAND_MAX_ARGS];
-    int num_args = _parseCommandLine(cmd_line.c_str(), args);
-
-    // Ensure args is null-terminated
-    args[num_args] = nullptr;
-
-    // Check if the command line contains any special characters
-    if (cmd_line.find('*') != string::npos || cmd_line.find('?') != string::npos) {
-        // This is a complex command, run it using bash
-        const char* bash_args[4];
-        bash_args[0] = "/bin/bash";
-        bash_args[1] = "-c";
-        bash_args[2] = cmd_line.c_str();
-        bash_args[3] = nullptr;
-        if (execvp(bash_args[0], const_cast<char* const*>(bash_args)) < 0) {
-            perror("smash error: execvp failed");
-            exit(1);
-        }
-    } else {
-        // This is a simple command, run it directly
-        if (execvp(args[0], args) < 0) {
-            perror("smash error: execvp failed");
-            exit(1);
-        }
+    if (args.empty()) {
+        prepareArguments();
     }
 
-    freeArgs(args, num_args);
+    // Build a null-terminated argv pointing into the expanded arguments
+    vector<char*> argv;
+    argv.reserve(args.size() + 1);
+    for (auto& arg : args) {
+        argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+
+    traceEvent('i', "exec", getpid());
+    char* const* envp = SmallShell::getInstance().getEnvironment().getEnvp();
+    if (!path.empty()) {
+        execve(path.c_str(), argv.data(), envp);
+    }
+    // execvpe searches PATH itself, also when the file found in the cache cannot be run
+    if (execvpe(argv[0], argv.data(), envp) < 0) {
+        perror("smash error: execvp failed");
+        _exitChild(1);
+    }
+}
+
+const vector<string>& ExternalCommand::getArgs() const
+{
+    return args;
 }
 
-void ExternalCommand::setOriginalCmdLine(const string &cmd_line)
+const string& ExternalCommand::getPath() const
 {
-    originalCmdLine = cmd_line;
+    return path;
 }
 
-std::string ExternalCommand::getOriginalCmdLine() const
+void ExternalCommand::prepareArguments()
 {
-    return originalCmdLine;
+    // Wildcards are expanded here instead of running the line through bash
+    args = expandWildcards(patterns);
+
+    // The parent finds the command in the cached PATH directories, which execvp would otherwise try
+    // one by one with a failed execve each
+    SmallShell& smash = SmallShell::getInstance();
+    DirCache& dirCache = smash.getDirCache();
+    const char* searchPath = getenv("PATH");
+    path.clear();
+    if (args.empty() || args[0].find('/') != string::npos || !dirCache.isEnabled() || smash.isInChild() ||
+        searchPath == nullptr) {
+        return;
+    }
+    // PATH=... before the command changes where it is looked for
+    for (const string& assignment : assignments) {
+        if (assignment.compare(0, 5, "PATH=") == 0) {
+            return;
+        }
+    }
+    string dirs = searchPath;
+    size_t start = 0;
+    while (start <= dirs.size()) {
+        size_t end = dirs.find(':', start);
+        if (end == string::npos) {
+            end = dirs.size();
+        }
+        // An empty entry stands for the cwd
+        string dir = (end > start) ? dirs.substr(start, end - start) : ".";
+        unsigned char type;
+        if (dirCache.find(dir, args[0], &type) && (type == DT_REG || type == DT_LNK || type == DT_UNKNOWN)) {
+            path = dir + "/" + args[0];
+            return;
+        }
+        start = end + 1;
+    }
 }
 
 
 //---------------------------------- Small Shell ----------------------------------
 
-SmallShell::SmallShell(): lastPwd(nullptr), fgPid(-1)
-{}
+SmallShell::SmallShell(): lastPwd(nullptr), fgPid(-1), lastStatus(0), isChildProcess(false), processPid(getpid()),
+                         linePid(-1), interrupted(false), childrenChanged(false), asyncSpawn(true)
+{
+    signalFd = openSignalFd();
+
+    // SMASH_HISTFILE overrides the log location, an empty value disables the history
+    const char* histFile = getenv("SMASH_HISTFILE");
+    const char* home = getenv("HOME");
+    string path;
+    if (histFile != nullptr) {
+        path = histFile;
+    } else if (home != nullptr) {
+        path = string(home) + "/.smash_history";
+    }
+    if (!path.empty() && !history.open(path)) {
+        perror("smash error: open failed");
+    }
+
+    // SMASH_AUDIT names the audit log, there is none by default
+    const char* auditFile = getenv("SMASH_AUDIT");
+    if (auditFile != nullptr && *auditFile != '\0' && !audit.open(auditFile)) {
+        perror("smash error: open failed");
+    }
+
+    // Publishing the jobs is a service to monitoring tools, without shared memory smash runs as usual
+    jobTable.open();
+
+    const char* spawnThread = getenv("SMASH_SPAWN_THREAD");
+    asyncSpawn = (spawnThread == nullptr || strcmp(spawnThread, "0") != 0);
+}
 
 SmallShell::~SmallShell() {
     if (lastPwd != nullptr) {
         free(lastPwd);
     }
+    if (signalFd != -1) {
+        close(signalFd);
+    }
+}
+
+void SmallShell::enterChild()
+{
+    if (getpid() == processPid) {
+        return;
+    }
+    processPid = getpid();
+    isChildProcess = true;
+    restoreChildSignals();
+    timers.reset();
+    audit.reset();
+    dirCache.reset();
+    jobTable.reset();
+    spawner.reset();
+    // The defaults of ulimit hold for every child, the limits of a limit prefix come on top of them
+    if (!defaultLimits.empty() && !applyLimits(defaultLimits)) {
+        perror("smash error: setrlimit failed");
+        _exitChild(1);
+    }
+    traceEvent('i', "child start", processPid);
+}
+
+void SmallShell::handleSignals()
+{
+    struct signalfd_siginfo info;
+    while (read(signalFd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGINT) {
+            ctrlCHandler(SIGINT);
+        } else if (info.ssi_signo == SIGCHLD) {
+            childrenChanged = true;
+        } else if (info.ssi_signo == SIGALRM) {
+            timers.advance();
+        }
+    }
+    // Jobs waiting for the one that exited start right away, not at the next prompt
+    if (childrenChanged) {
+        launchReadyJobs();
+    }
+}
+
+bool SmallShell::waitForEvents(int fd, int timeoutMs)
+{
+    struct pollfd extra = {fd, POLLIN, 0};
+    // A hangup counts as readable, the read then sees the end of the input
+    return waitForEvents(&extra, (fd != -1) ? 1 : 0, timeoutMs);
+}
+
+bool SmallShell::waitForEvents(struct pollfd* extraFds, size_t numExtraFds, int timeoutMs)
+{
+    vector<struct pollfd> fds;
+    fds.reserve(5 + numExtraFds);
+    fds.push_back({signalFd, POLLIN, 0});
+    fds.push_back({timers.getFd(), POLLIN, 0});
+    fds.push_back({captures.getFd(), POLLIN, 0});
+    fds.push_back({dirCache.getFd(), POLLIN, 0});
+    fds.push_back({spawner.getFd(), POLLIN, 0});
+    fds.insert(fds.end(), extraFds, extraFds + numExtraFds);
+
+    // The jobs launched since the shell was last idle start while it waits
+    spawner.flush();
+    if (poll(fds.data(), fds.size(), timeoutMs) == -1) {
+        if (errno != EINTR) {
+            perror("smash error: poll failed");
+        }
+        return false;
+    }
+    if (fds[0].revents != 0) {
+        handleSignals();
+    }
+    if (fds[1].revents != 0) {
+        timers.advance();
+    }
+    if (fds[2].revents != 0) {
+        captures.drain();
+    }
+    if (fds[3].revents != 0) {
+        dirCache.drain();
+    }
+    if (fds[4].revents != 0) {
+        finishSpawns(false);
+    }
+    bool ready = false;
+    for (size_t i = 0; i < numExtraFds; i++) {
+        extraFds[i].revents = fds[5 + i].revents;
+        ready = ready || extraFds[i].revents != 0;
+    }
+    return ready;
+}
+
+pid_t SmallShell::waitForeground(pid_t pid, int* status, int options)
+{
+    if (isChildProcess) {
+        // A child gets its signals the usual way, it only has to keep its own timers going
+        int pidFd = timers.isEmpty() ? -1 : syscall(SYS_pidfd_open, pid, 0);
+        if (pidFd != -1) {
+            struct pollfd fds[2] = {{pidFd, POLLIN, 0}, {timers.getFd(), POLLIN, 0}};
+            while (poll(fds, 2, -1) != -1 && fds[0].revents == 0) {
+                if (fds[1].revents != 0) {
+                    timers.advance();
+                }
+            }
+            close(pidFd);
+        }
+        pid_t result = waitpid(pid, status, options);
+        traceEvent('E', "waitpid", pid);
+        return result;
+    }
+
+    fgPid = pid;
+    pid_t result;
+    int localStatus;
+    if (status == nullptr) {
+        status = &localStatus;
+    }
+    // SIGCHLD is only delivered through signalFd, so it cannot be missed between waitpid and poll
+    while ((result = waitpid(pid, status, options | WNOHANG)) == 0) {
+        waitForEvents(-1, -1);
+    }
+    fgPid = -1;
+    if (result > 0 && !WIFSTOPPED(*status) && !WIFCONTINUED(*status)) {
+        traceEvent('E', "waitpid", pid);
+    }
+    return result;
+}
+
+bool SmallShell::reportFinishedJobs()
+{
+    if (!childrenChanged) {
+        return false;
+    }
+    childrenChanged = false;
+    // Notices would only clutter the output of a script, jobs still tells about the jobs a limit killed
+    vector<string> finished;
+    bool interactive = isatty(STDIN_FILENO);
+    jobs.removeFinishedJobs(interactive ? &finished : nullptr);
+    if (finished.empty()) {
+        return false;
+    }
+    cout << endl;
+    for (const string& job : finished) {
+        cout << job << endl;
+    }
+    return true;
+}
+
+void SmallShell::launchReadyJobs()
+{
+    if (isChildProcess || !jobs.hasPending()) {
+        return;
+    }
+    vector<int> ready;
+    while (!(ready = jobs.resolvePending()).empty()) {
+        // Launching a job in the middle of another command must not change what that command reports
+        int savedStatus = lastStatus;
+        pid_t savedLinePid = linePid;
+        cout.flush();
+        for (int jobId : ready) {
+            JobsList::JobEntry* job = jobs.getJobById(jobId);
+            if (job == nullptr) {
+                continue;
+            }
+            executeExternalCommand(job->getCmd(), job->getNode(), true, jobId);
+            // A job that could not be forked is given up, along with the jobs waiting for it
+            job = jobs.getJobById(jobId);
+            if (job != nullptr && job->isPending()) {
+                jobs.cancelJob(*job);
+            }
+        }
+        lastStatus = savedStatus;
+        linePid = savedLinePid;
+    }
+}
+
+void SmallShell::interrupt()
+{
+    interrupted = true;
+}
+
+bool SmallShell::takeInterrupt()
+{
+    bool wasInterrupted = interrupted;
+    interrupted = false;
+    return wasInterrupted;
 }
 
-shared_ptr<Command> SmallShell::CreateCommand(const std::string& cmd_line)
+template <typename T, typename... Args>
+shared_ptr<Command> SmallShell::newCommand(const shared_ptr<CommandNode>& node, Args&&... args)
 {
-    std::string cmd_s = _trim(cmd_line);
-    std::string firstWord = cmd_s.substr(0, cmd_s.find_first_of(" \n"));
+    shared_ptr<Command> cmd = allocate_shared<T>(PoolAllocator<T>(&commandPool), std::forward<Args>(args)...);
+    cmd->setSource(node);
+    return cmd;
+}
 
-    // Check if the first word is an alias
-    if (isAlias(firstWord)) {
-        // If it is an alias, replace it with its command
-        std::string aliasCommand = getAlias(firstWord);
-        cmd_s = cmd_s.replace(0, firstWord.length(), aliasCommand);
-        firstWord = cmd_s.substr(0, cmd_s.find_first_of(" \n")); // Update firstWord after replacing alias
+shared_ptr<Command> SmallShell::CreateCommand(const shared_ptr<CommandNode>& node)
+{
+    if (node->kind == CommandNode::REDIRECT) {
+        // after takes its redirections along to the command it runs
+        shared_ptr<CommandNode> inner = node->children[0];
+        while (inner->kind == CommandNode::REDIRECT) {
+            inner = inner->children[0];
+        }
+        if (inner->words[0] == "after" || inner->words[0] == "after-ok") {
+            return newCommand<AfterCommand>(node, node);
+        }
+        return newCommand<RedirectionCommand>(node, node);
+    } else if (node->kind == CommandNode::PIPELINE) {
+        return newCommand<PipeCommand>(node, node);
+    } else if (node->kind == CommandNode::LIST) {
+        return newCommand<ListCommand>(node, node);
+    }
+
+    // Leading NAME=value words are assignments for the command after them, alone they set the variables
+    size_t numAssignments = 0;
+    while (numAssignments < node->words.size() && Environment::isAssignment(node->words[numAssignments])) {
+        numAssignments++;
+    }
+    if (numAssignments == node->words.size()) {
+        return newCommand<ExportCommand>(node, node);
+    } else if (numAssignments > 0) {
+        shared_ptr<Command> cmd = CreateCommand(subCommand(*node, numAssignments));
+        cmd->setAssignments(vector<string>(node->words.begin(), node->words.begin() + numAssignments));
+        return cmd;
+    }
+
+    // limit and its options before a command are limits for it, the nearest prefix wins
+    if (node->words[0] == "limit") {
+        ResourceLimits limits;
+        size_t next;
+        if (parseLimits(node->words, 1, &limits, &next) && next < node->words.size()) {
+            shared_ptr<Command> cmd = CreateCommand(subCommand(*node, next));
+            limits.merge(cmd->getLimits());
+            cmd->setLimits(limits);
+            return cmd;
+        }
+        return newCommand<LimitCommand>(node, node->text);
     }
 
+    // Aliases were already expanded by the parser
+    const std::string& cmd_s = node->text;
+    const std::string& firstWord = node->words[0];
+
     if (firstWord == "alias") {
-        return make_shared<aliasCommand>(cmd_s);
-    } else if (cmd_s.find('|') != std::string::npos) { // Check if the command line contains '|'
-        return make_shared<PipeCommand>(cmd_s);
-    } else if (cmd_s.find('>') != std::string::npos) { // Check if the command line contains '>'
-        return make_shared<RedirectionCommand>(cmd_s);
+        return newCommand<aliasCommand>(node, cmd_s);
     } else if (firstWord == "chprompt") {
-        return make_shared<ChpromptCommand>(cmd_s);
+        return newCommand<ChpromptCommand>(node, cmd_s);
     } else if (firstWord == "showpid") {
-        return make_shared<ShowPidCommand>(cmd_s);
+        return newCommand<ShowPidCommand>(node, cmd_s);
     } else if (firstWord == "pwd") {
-        return make_shared<GetCurrDirCommand>(cmd_s);
+        return newCommand<GetCurrDirCommand>(node, cmd_s);
     } else if (firstWord == "cd") {
-        return make_shared<ChangeDirCommand>(cmd_s, &lastPwd);
+        return newCommand<ChangeDirCommand>(node, cmd_s, &lastPwd);
     } else if (firstWord == "jobs") {
-        return make_shared<JobsCommand>(cmd_s, &jobs);
+        return newCommand<JobsCommand>(node, cmd_s, &jobs);
     } else if (firstWord == "unalias") {
-        return make_shared<unaliasCommand>(cmd_s);
+        return newCommand<unaliasCommand>(node, cmd_s);
     } else if (firstWord == "quit") {
-        return make_shared<QuitCommand>(cmd_s, &jobs);
+        return newCommand<QuitCommand>(node, cmd_s, &jobs);
     } else if (firstWord == "kill") {
-        return make_shared<KillCommand>(cmd_s, &jobs);
+        return newCommand<KillCommand>(node, cmd_s, &jobs);
     } else if (firstWord == "fg") {
-        return make_shared<ForegroundCommand>(cmd_s, &jobs);
+        return newCommand<ForegroundCommand>(node, cmd_s, &jobs);
     } else if (firstWord == "listdir") {
-        return make_shared<ListDirCommand>(cmd_s);
+        return newCommand<ListDirCommand>(node, cmd_s);
     } else if (firstWord == "getuser") {
-        return make_shared<GetUserCommand>(cmd_s);
+        return newCommand<GetUserCommand>(node, cmd_s);
+    } else if (firstWord == "history") {
+        return newCommand<HistoryCommand>(node, cmd_s);
     } else if (firstWord == "watch") {
-        return make_shared<WatchCommand>(cmd_s);
-    } else {
-        return make_shared<ExternalCommand>(cmd_s);
+        return newCommand<WatchCommand>(node, cmd_s);
+    } else if (firstWord == "timeout") {
+        return newCommand<TimeoutCommand>(node, node);
+    } else if (firstWord == "pipeconf") {
+        return newCommand<PipeConfCommand>(node, node);
+    } else if (firstWord == "cache") {
+        return newCommand<CacheCommand>(node, node);
+    } else if (firstWord == "trace") {
+        return newCommand<TraceCommand>(node, cmd_s);
+    } else if (firstWord == "audit") {
+        return newCommand<AuditCommand>(node, cmd_s);
+    } else if (firstWord == "export") {
+        return newCommand<ExportCommand>(node, node);
+    } else if (firstWord == "unset") {
+        return newCommand<UnsetCommand>(node, cmd_s);
+    } else if (firstWord == "snapshot") {
+        return newCommand<SnapshotCommand>(node, cmd_s);
+    } else if (firstWord == "dircache") {
+        return newCommand<DirCacheCommand>(node, cmd_s);
+    } else if (firstWord == "bench") {
+        return newCommand<BenchCommand>(node, node);
+    } else if (firstWord == "ulimit") {
+        return newCommand<UlimitCommand>(node, cmd_s);
+    } else if (firstWord == "prlimit") {
+        return newCommand<PrlimitCommand>(node, cmd_s, &jobs);
+    } else if (firstWord == "after" || firstWord == "after-ok") {
+        return newCommand<AfterCommand>(node, node);
+    } else if (isUtilityName(firstWord)) {
+        vector<string> args = expandWildcards(node->patterns);
+        if (isUtility(args)) {
+            return newCommand<UtilityCommand>(node, cmd_s, move(args));
+        }
     }
+    return newCommand<ExternalCommand>(node, cmd_s, node->patterns);
 }
 
-void SmallShell::executeExternalCommand(const shared_ptr<Command>& cmd, bool isBackground)
+void SmallShell::executeExternalCommand(const shared_ptr<Command>& cmd, const shared_ptr<CommandNode>& node,
+                                        bool isBackground, int jobId)
 {
+    if (isBackground && jobId == 0 && spawnInBackground(cmd, node)) {
+        lastStatus = 0;
+        return;
+    }
+
+    // In capture mode a background job writes its stdout and stderr to a pipe drained by the shell
+    int capturePipe[2] = {-1, -1};
+    if (isBackground && !isChildProcess && captures.isEnabled() && pipe2(capturePipe, O_CLOEXEC) == -1) {
+        perror("smash error: pipe failed");
+    }
+
     pid_t pid = fork();
 
     if (pid < 0) {
         // Fork failed
         perror("smash error: fork failed");
+        lastStatus = 1;
+        if (capturePipe[0] != -1) {
+            close(capturePipe[0]);
+            close(capturePipe[1]);
+        }
         return;
     } else if (pid == 0) {
         // This is the child process
-        // Call setpgrp to create a new process group
-        if(setpgrp() == -1) {
+        // Call setpgrp to create a new process group, unless this is already a job's child
+        if (!isChildProcess && setpgrp() == -1) {
             perror("smash error: setpgrp failed");
-            exit(1);
+            _exitChild(1);
+        }
+        enterChild();
+        if (capturePipe[0] != -1) {
+            if (dup2(capturePipe[1], STDOUT_FILENO) == -1 || dup2(capturePipe[1], STDERR_FILENO) == -1) {
+                perror("smash error: dup2 failed");
+                _exitChild(1);
+            }
+            close(capturePipe[0]);
+            close(capturePipe[1]);
+        }
+        // A pending job runs where it was submitted, its wildcards are expanded there by execute
+        JobsList::JobEntry* job = (jobId != 0) ? jobs.getJobById(jobId) : nullptr;
+        if (job != nullptr && !job->getCwd().empty() && chdir(job->getCwd().c_str()) == -1) {
+            perror("smash error: chdir failed");
+            _exitChild(1);
+        }
+        if (node->kind != CommandNode::SIMPLE) {
+            executeInChild(node);
+        }
+        for (const string& assignment : cmd->getAssignments()) {
+            environment.assign(assignment);
+        }
+        if (!cmd->getLimits().empty() && !applyLimits(cmd->getLimits())) {
+            perror("smash error: setrlimit failed");
+            _exitChild(1);
         }
         // Execute the command
         cmd->execute();
-        exit(0);
+        _exitChild(cmd->getExitStatus());
     } else {
         // This is the parent process
+        traceEvent('B', node->display, pid);
+        noteFork(pid);
+        // The group is set on both sides, so it exists before anyone signals it
+        if (!isChildProcess) {
+            setpgid(pid, pid);
+        }
+        TimeoutCommand* timeoutCmd = (cmd->getKind() == Command::TIMEOUT) ? static_cast<TimeoutCommand*>(cmd.get())
+                                                                           : nullptr;
+        if (timeoutCmd) {
+            timeoutCmd->start(pid);
+        }
         if (isBackground) {
             // Don't wait for the child process to finish
-            // Add the job to the jobs list
-            jobs.addJob(cmd, pid);
+            // Add the job to the jobs list, a pending job is already there
+            if (jobId != 0) {
+                jobs.startJob(jobId, pid, !isChildProcess);
+            } else {
+                jobId = jobs.addJob(cmd, pid, !isChildProcess);
+            }
+            if (capturePipe[0] != -1) {
+                close(capturePipe[1]);
+                captures.attach(jobId, capturePipe[0]);
+            } else if (!isChildProcess) {
+                captures.discard(jobId);
+            }
+            lastStatus = 0;
         } else {
             // Wait for the child process to finish
-            fgPid = pid; // Update the PID of the foreground process
             int status;
-            if(waitpid(pid, &status, 0) == -1) {
+            if(waitForeground(pid, &status, 0) == -1) {
                 perror("smash error: waitpid failed");
+                lastStatus = 1;
+            } else {
+                lastStatus = exitStatusOf(status);
+            }
+            if (timeoutCmd) {
+                timeoutCmd->stop();
+                if (timeoutCmd->hasTimedOut()) {
+                    // Same status as coreutils timeout
+                    lastStatus = 124;
+                }
             }
         }
     }
 }
 
-void SmallShell::executeCommand(const std::string& cmd_line)
+bool SmallShell::spawnInBackground(const shared_ptr<Command>& cmd, const shared_ptr<CommandNode>& node)
 {
-    jobs.removeFinishedJobs();
+    if (!asyncSpawn || isChildProcess || cmd->getKind() != Command::EXTERNAL || node->kind != CommandNode::SIMPLE ||
+        !cmd->getLimits().empty() || !defaultLimits.empty() || audit.isEnabled()) {
+        return false;
+    }
+    const vector<string>& assignments = cmd->getAssignments();
+    for (const string& assignment : assignments) {
+        if (assignment.compare(0, 5, "PATH=") == 0) {
+            return false;
+        }
+    }
+    ExternalCommand* external = static_cast<ExternalCommand*>(cmd.get());
+    SpawnRequest request;
+    request.args = external->getArgs();
+    if (request.args.empty()) {
+        return false;
+    }
+    request.path = external->getPath();
+    const char* searchPath = environment.get("PATH");
+    request.searchPath = (searchPath != nullptr) ? searchPath : SPAWN_DEFAULT_PATH;
+    // The environment of the job, with its NAME=value words applied like environment.assign does in a child
+    request.env.reserve(environment.size() + assignments.size());
+    for (char* const* entry = environment.getEnvp(); *entry != nullptr; entry++) {
+        const char* equals = strchr(*entry, '=');
+        size_t nameLength = (equals != nullptr) ? equals - *entry : strlen(*entry);
+        bool assigned = any_of(assignments.begin(), assignments.end(), [&](const string& assignment) {
+            return assignment.size() > nameLength && assignment[nameLength] == '=' &&
+                   assignment.compare(0, nameLength, *entry, nameLength) == 0;
+        });
+        if (!assigned) {
+            request.env.push_back(*entry);
+        }
+    }
+    for (size_t i = 0; i < assignments.size(); i++) {
+        // Of several assignments to one name the last one holds
+        size_t nameLength = assignments[i].find('=') + 1;
+        if (none_of(assignments.begin() + i + 1, assignments.end(), [&](const string& later) {
+                return later.compare(0, nameLength, assignments[i], 0, nameLength) == 0;
+            })) {
+            request.env.push_back(assignments[i]);
+        }
+    }
+    char* cwd = getcwd(nullptr, 0);
+    if (cwd == nullptr) {
+        return false;
+    }
+    request.cwd = cwd;
+    free(cwd);
 
-    bool isBackground = isBackgroundCommand(cmd_line);
-    string cmd_line_copy = cmd_line;
-    if (isBackground) {
-        // Remove the '&' from the command line copy
-        cmd_line_copy.pop_back();
-        // Trim trailing spaces
-        cmd_line_copy = _rtrim(cmd_line_copy);
+    // In capture mode a background job writes its stdout and stderr to a pipe drained by the shell
+    int capturePipe[2] = {-1, -1};
+    if (captures.isEnabled() && pipe2(capturePipe, O_CLOEXEC) == -1) {
+        perror("smash error: pipe failed");
+    }
+    request.outputFd = capturePipe[1];
+    // The job gets the stdio the shell has now, whatever the next line does to it before the spawn
+    int stdFds[3];
+    for (int fd = 0; fd < 3; fd++) {
+        stdFds[fd] = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+        request.stdFds[fd] = stdFds[fd];
+    }
+    int jobId = jobs.addSpawningJob(cmd);
+    request.jobId = jobId;
+    if (!spawner.submit(move(request))) {
+        jobs.removeJobById(jobId);
+        if (capturePipe[0] != -1) {
+            close(capturePipe[0]);
+            close(capturePipe[1]);
+        }
+        for (int fd : stdFds) {
+            if (fd != -1) {
+                close(fd);
+            }
+        }
+        return false;
+    }
+    if (capturePipe[0] != -1) {
+        captures.attach(jobId, capturePipe[0]);
+    } else {
+        captures.discard(jobId);
+    }
+    return true;
+}
+
+void SmallShell::finishSpawns(bool wait)
+{
+    if (wait && spawner.inFlight() == 0) {
+        return;
+    }
+    vector<SpawnResult> results = spawner.takeResults(wait);
+    for (const SpawnResult& result : results) {
+        JobsList::JobEntry* job = jobs.getJobById(result.jobId);
+        if (job == nullptr) {
+            continue;
+        }
+        if (result.pid == -1) {
+            errno = result.error;
+            perror("smash error: execvp failed");
+            job->spawnFailed();
+            continue;
+        }
+        traceEvent('B', job->getCmdLine(), result.pid);
+        jobs.startJob(result.jobId, result.pid, true);
+    }
+    // A job may have exited before it got its pid, and its SIGCHLD was taken for nothing
+    if (!results.empty()) {
+        childrenChanged = true;
+        launchReadyJobs();
+    }
+}
+
+void SmallShell::executeInChild(const shared_ptr<CommandNode>& node)
+{
+    enterChild();
+
+    // Nothing has to be restored in a child, so its redirections are simply applied
+    shared_ptr<CommandNode> current = node;
+    while (current->kind == CommandNode::REDIRECT) {
+        int fd = openRedirection(*current);
+        if (fd == -1 || dup2(fd, STDOUT_FILENO) == -1) {
+            _exitChild(1);
+        }
+        close(fd);
+        current = current->children[0];
     }
 
+    shared_ptr<Command> cmd = CreateCommand(current);
+    cmd->setOriginalCmdLine(current);
+    for (const string& assignment : cmd->getAssignments()) {
+        environment.assign(assignment);
+    }
+    if (!cmd->getLimits().empty() && !applyLimits(cmd->getLimits())) {
+        perror("smash error: setrlimit failed");
+        _exitChild(1);
+    }
+    try {
+        if (cmd->getKind() == Command::EXTERNAL) {
+            // The child becomes the external command without forking again
+            static_cast<ExternalCommand*>(cmd.get())->prepareArguments();
+        } else if (cmd->getKind() == Command::TIMEOUT && static_cast<TimeoutCommand*>(cmd.get())->isValid()) {
+            // The deadline is kept by this process, so the command needs a child of its own
+            executeExternalCommand(cmd, current, false);
+            _exitChild(lastStatus);
+        }
+        cmd->execute();
+    } catch (const QuitException &e) {
+        _exitChild(0);
+    }
+    _exitChild(cmd->getExitStatus());
+}
 
+void SmallShell::executeNode(const shared_ptr<CommandNode>& node, bool isBackground)
+{
+    shared_ptr<Command> cmd = CreateCommand(node);
+    cmd->setOriginalCmdLine(node);
+
+    Command::Kind kind = cmd->getKind();
+    if (kind == Command::EXTERNAL) {
+        // Expand the arguments in the parent so the child only has to exec
+        static_cast<ExternalCommand*>(cmd.get())->prepareArguments();
+    } else if (kind == Command::AFTER) {
+        static_cast<AfterCommand*>(cmd.get())->setBackground(isBackground);
+    }
+
+    // Built-in commands run in smash itself, unless a compound command is sent to the background
+    bool isBuiltIn = kind != Command::EXTERNAL && kind != Command::WATCH &&
+                     !(kind == Command::TIMEOUT && static_cast<TimeoutCommand*>(cmd.get())->isValid());
+    // Builtin utilities, cache and bench sent to the background still become jobs with a process of their own
+    if (isBackground && (kind == Command::UTILITY || kind == Command::CACHE || kind == Command::BENCH)) {
+        isBuiltIn = false;
+    }
+    // Limits must not touch smash itself, a builtin under a limit prefix runs in a child
+    if (!cmd->getLimits().empty() && kind != Command::AFTER) {
+        isBuiltIn = false;
+    }
+    if (isBuiltIn && (!isBackground || node->kind == CommandNode::SIMPLE || kind == Command::AFTER)) {
+        // A list is traced through the commands in it
+        uint64_t start = (traceEnabled() && node->kind != CommandNode::LIST) ? traceNow() : 0;
+        cmd->execute();
+        lastStatus = cmd->getExitStatus();
+        traceEvent('X', node->display, processPid, start);
+    } else {
+        executeExternalCommand(cmd, node, isBackground);
+    }
+}
 
-    shared_ptr<Command> cmd = CreateCommand(cmd_line_copy);
+void SmallShell::executeCommand(const std::string& cmd_line)
+{
+    // The jobs of the last line start at the latest before this one runs
+    spawner.flush();
+    finishSpawns(false);
     jobs.removeFinishedJobs();
+    launchReadyJobs();
+
+    // The audit record is taken once the line is done, with the cwd it started in
+    uint64_t auditStart = 0;
+    char cwd[PATH_MAX] = "";
+    if (audit.isEnabled()) {
+        auditStart = AuditLog::now();
+        linePid = -1;
+        if (getcwd(cwd, sizeof(cwd)) == nullptr) {
+            cwd[0] = '\0';
+        }
+    }
 
-    // Check if the command is a built-in command
-    if (!dynamic_cast<ExternalCommand*>(cmd.get()) && !dynamic_cast<WatchCommand*>(cmd.get())) {
-        cmd->execute();
+    string error;
+    uint64_t start = traceEnabled() ? traceNow() : 0;
+    shared_ptr<CommandNode> tree = parseCommandLine(cmd_line, aliases, error);
+    traceEvent('X', "parse", processPid, start);
+    if (!tree) {
+        cerr << "smash error: " << error << endl;
+        lastStatus = 2;
     } else {
-        if (dynamic_cast<ExternalCommand*>(cmd.get())) {
-            // Set the original command line for external commands
-            dynamic_cast<ExternalCommand*>(cmd.get())->setOriginalCmdLine(cmd_line);
+        try {
+            executeNode(tree, false);
+        } catch (const QuitException &e) {
+            audit.log('c', cmd_line, cwd, processPid, 0, auditStart);
+            throw;
         }
-        executeExternalCommand(cmd, isBackground);
     }
+
+    audit.log('c', cmd_line, cwd, (linePid != -1) ? linePid : processPid, lastStatus, auditStart);
+}
+
+bool SmallShell::isInChild() const
+{
+    return isChildProcess;
+}
+
+int SmallShell::getLastStatus() const
+{
+    return lastStatus;
 }
 
 const string& SmallShell::getPrompt() const
@@ -1071,6 +3310,63 @@ JobsList& SmallShell::getJobs()
     return jobs;
 }
 
+HistoryLog& SmallShell::getHistory()
+{
+    return history;
+}
+
+TimerWheel& SmallShell::getTimers()
+{
+    return timers;
+}
+
+OutputCapture& SmallShell::getCaptures()
+{
+    return captures;
+}
+
+OutputCache& SmallShell::getCache()
+{
+    return cache;
+}
+
+DirCache& SmallShell::getDirCache()
+{
+    return dirCache;
+}
+
+Environment& SmallShell::getEnvironment()
+{
+    return environment;
+}
+
+AuditLog& SmallShell::getAudit()
+{
+    return audit;
+}
+
+JobTable& SmallShell::getJobTable()
+{
+    return jobTable;
+}
+
+void SmallShell::noteFork(pid_t pid)
+{
+    if (linePid == -1) {
+        linePid = pid;
+    }
+}
+
+PipeConfig& SmallShell::getPipeConfig()
+{
+    return pipeConfig;
+}
+
+ResourceLimits& SmallShell::getDefaultLimits()
+{
+    return defaultLimits;
+}
+
 pid_t SmallShell::getFgPid() const
 {
     return fgPid;
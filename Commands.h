@@ -1,18 +1,36 @@
 #ifndef SMASH_COMMAND_H_
 #define SMASH_COMMAND_H_
 
+#include <string>
 #include <utility>
 #include <list>
 #include <map>
 #include <memory>
+#include <poll.h>
 #include <sys/wait.h>
 #include <set>
 #include <unordered_map>
 #include <vector>
+#include "audit.h"
+#include "cache.h"
+#include "capture.h"
+#include "dircache.h"
+#include "environment.h"
+#include "history.h"
+#include "intern.h"
+#include "jobtable.h"
+#include "parser.h"
+#include "pipes.h"
+#include "pool.h"
+#include "rlimits.h"
+#include "spawner.h"
+#include "timers.h"
 
 
 #define COMMAND_MAX_LENGTH (200)
 #define COMMAND_MAX_ARGS (20)
+#define FILTER_READ_SIZE (128 * 1024)
+#define JOBS_REAP_TIMEOUT_MS (2000)
 
 
 class QuitException : public std::exception {
@@ -23,27 +41,100 @@ public:
 };
 
 class Command {
+public:
+    // What smash has to know about a command before running it, instead of asking for its class
+    enum Kind {
+        BUILTIN,  // runs in smash itself
+        EXTERNAL, // a program, forked and exec'd
+        UTILITY,  // a builtin utility, forked in the background
+        TIMEOUT,  // keeps a deadline for the child it forks
+        WATCH,    // runs in a child of its own
+        CACHE,    // forked in the background
+        BENCH,    // forked in the background
+        AFTER     // starts a job itself, also in the background
+    };
+
 protected:
-    std::string cmd_line;
+    // cmd_line is the text of the parse tree node the command was made of. Commands are only made by
+    // SmallShell::CreateCommand, which gives them that node, so the line is never copied; a job keeps
+    // its command, and with it the node, until it starts.
+    std::shared_ptr<CommandNode> source;
+    std::shared_ptr<CommandNode> shown; // the node whose display jobs and fg show
+    const std::string& cmd_line;
+    Kind kind;
+    int exitStatus;
+    std::vector<std::string> assignments;
+    ResourceLimits limits;
 public:
-    explicit Command(const std::string& cmd_line);
+    explicit Command(const std::string& cmd_line, Kind kind = BUILTIN);
     virtual ~Command();
 
     virtual void execute() = 0;
 
     const std::string& getCmdLine() const;
+    Kind getKind() const;
+
+    void setSource(const std::shared_ptr<CommandNode>& node);
+
+    // The command as the user typed it, shown by jobs and fg
+    void setOriginalCmdLine(const std::shared_ptr<CommandNode>& node);
+    const std::string& getOriginalCmdLine() const;
+
+    // 0 if the command succeeded, set by execute
+    int getExitStatus() const;
 
+    // The NAME=value words before the command, set in the child that runs it. A builtin that runs in
+    // smash itself does not see them.
+    void setAssignments(const std::vector<std::string>& assignments);
+    const std::vector<std::string>& getAssignments() const;
+
+    // The limits of a limit prefix, applied with the assignments. A builtin that has them is forked.
+    void setLimits(const ResourceLimits& limits);
+    const ResourceLimits& getLimits() const;
+
+protected:
+    // The arguments of the command as the parser left them, after quote removal, in args like
+    // _parseCommandLine does. Free them with freeArgs.
+    int parseArgs(char** args) const;
 };
 
 class JobsList {
 public:
     class JobEntry {
+        // What a pending job waits for and runs, dropped once it starts
+        struct Dependencies {
+            bool requireSuccess; // after-ok
+            std::vector<int> waitingFor; // the ids of the jobs it still waits for
+            std::shared_ptr<CommandNode> node;
+        };
+
         int jobId;
-        std::shared_ptr<Command> cmd;
         pid_t pid;
+        int pidFd;     // -1 if the pidfd could not be opened
+        int status;    // the wait status once reaped
+        bool ownGroup; // the job leads a process group of its own
+        bool reaped;
+        // An after job stays pending, without a process, until the jobs it depends on finish
+        bool pending;
+        bool spawning;  // handed to the spawner thread, without its pid yet
+        bool cancelled; // a pending job that will never run
+        uint64_t startTime; // AuditLog::now() when the job started
+        // Shared with every job of the same line, see StringPool
+        InternedString cmdLine;
+        InternedString cwd; // where the job was started, empty for a running job when the audit log is off
+        // Only kept until the job starts, the parse tree of its line goes with it. A timeout job keeps
+        // it for good, its timer lives in the command.
+        std::shared_ptr<Command> cmd;
+        std::unique_ptr<Dependencies> dependencies; // nullptr unless pending
+        std::unique_ptr<ResourceLimits> limits; // the shell defaults and the job's own, nullptr for none
+
+        void dropCommand();
     public:
-        JobEntry(int jobId, std::shared_ptr<Command> cmd, pid_t pid)
-                : jobId(jobId), cmd(std::move(cmd)), pid(pid)  {}
+        JobEntry(int jobId, std::shared_ptr<Command> cmd, InternedString cmdLine, pid_t pid, int pidFd,
+                 bool ownGroup, InternedString cwd);
+
+        JobEntry(int jobId, std::shared_ptr<Command> cmd, InternedString cmdLine, std::shared_ptr<CommandNode> node,
+                 std::vector<int> waitingFor, bool requireSuccess, InternedString cwd);
 
         int getJobId() const {
             return jobId;
@@ -53,36 +144,149 @@ public:
             return pid;
         }
 
-        std::string getCmdLine() const {
-            return cmd->getCmdLine();
+        // The command as the user typed it
+        const std::string& getCmdLine() const {
+            return cmdLine.str();
         }
 
+        // nullptr once the job started, unless it is a timeout job
         std::shared_ptr<Command> getCmd() const {
             return cmd;
         }
 
-        bool isFinished() const {
-            int status;
-            pid_t result = waitpid(pid, &status, WNOHANG);
-            return result != 0;
+        // What a pending job runs, nullptr for any other
+        std::shared_ptr<CommandNode> getNode() const;
+
+        const std::string& getCwd() const {
+            return cwd.str();
+        }
+
+        bool isPending() const {
+            return pending;
+        }
+
+        bool isCancelled() const {
+            return cancelled;
+        }
+
+        bool isSpawning() const {
+            return spawning;
+        }
+
+        // The job was handed to the spawner thread
+        void spawn() {
+            spawning = true;
         }
+
+        const ResourceLimits& getLimits() const;
+
+        void setLimits(const ResourceLimits& limits);
+
+        // The limit that killed a reaped job, or nullptr, see limitKillReason
+        const char* getLimitReason() const;
+
+        bool requiresSuccess() const;
+
+        // Empty for a job that is not pending
+        const std::vector<int>& getWaitingFor() const;
+
+        // Only for a pending job
+        std::vector<int>& getWaitingFor();
+
+        // A cancelled job counts as finished
+        bool isFinished();
+
+        // Tells whether the job exited and with which status, without reaping it, so it never takes
+        // the exit of a job from whoever waits for it
+        bool peekExit(int* exitStatus);
+
+        // For a job reaped by someone else, such as fg
+        void setStatus(int status);
+
+        // Turns a pending or spawning job into a running one
+        void start(pid_t pid, int pidFd, bool ownGroup);
+
+        // The spawner could not start the job, it ends with status 1 like a child whose exec failed
+        void spawnFailed();
+
+        void cancel();
+
+        // For a job reaped by a wait for any child
+        void setReaped(int status);
+
+        // Signals the job's whole process group if it has one, or its process through the pidfd.
+        // Until the shell reaps the job its pid cannot be reused, so the signal never reaches a stranger.
+        int signal(int signum) const;
+
+        // Closes the pidfd when the job leaves the list
+        void release();
+    };
+
+    enum DependencyState {
+        DEPS_WAITING,
+        DEPS_READY,
+        DEPS_FAILED // a job that was waited for was cancelled, or failed for after-ok
     };
 
 private:
+    StringPool lines; // the command lines and directories of the jobs, it outlives them
     std::list<JobEntry> jobs;
     int maxJobId;
+    int numPending;
+    std::vector<std::string> limitNotices;
+
+    bool dependsOn(int jobId, int target);
+    void printGraphFrom(const JobEntry& job, int depth, std::set<int>& shown);
+
+    // Reaps the given jobs as they exit, all of them at once, for at most timeoutMs
+    void reapJobs(const std::vector<JobEntry*>& targets, long timeoutMs);
 public:
     JobsList();
 
     ~JobsList() = default;
 
-    void addJob(std::shared_ptr<Command> cmd, pid_t pid);
+    // Returns the id given to the job. ownGroup if the job is the leader of its own process group.
+    int addJob(std::shared_ptr<Command> cmd, pid_t pid, bool ownGroup);
+
+    // Adds a job that runs node once the jobs in dependencies finish, successfully if requireSuccess.
+    // Returns the id given to the job, or 0 if it would end up waiting for itself.
+    int addPendingJob(std::shared_ptr<Command> cmd, std::shared_ptr<CommandNode> node,
+                      const std::vector<int>& dependencies, bool requireSuccess, const std::string& cwd);
+
+    // Adds a job that the spawner thread is starting, it gets its process through startJob
+    int addSpawningJob(std::shared_ptr<Command> cmd);
+
+    // A pending or spawning job got its process
+    void startJob(int jobId, pid_t pid, bool ownGroup);
+
+    // The job will never run, the jobs that wait for it are cancelled by the next resolvePending
+    void cancelJob(JobEntry& job);
+
+    // Drops the finished jobs from waitingFor and tells whether the rest can go ahead
+    DependencyState checkDependencies(std::vector<int>& waitingFor, bool requireSuccess);
+
+    // Cancels the pending jobs that can no longer run, the jobs waiting for them included,
+    // and returns the ids of the ones that are ready to be launched
+    std::vector<int> resolvePending();
+
+    bool hasPending() const;
 
     void printJobsList();
 
-    void killAllJobs();
+    // The jobs as a forest in which every job is listed under the jobs it waits for
+    void printGraph();
 
-    void removeFinishedJobs();
+    // Sends SIGKILL to every job, or SIGTERM first and SIGKILL only to the jobs still running
+    // after graceMs, then waits a bounded time for all of them to be reaped
+    void killAllJobs(long graceMs = 0);
+
+    // Removes the jobs that finished, adding a "[id] command done" notice for each of them to finished
+    // if it is given, "killed: cpu time limit" instead of done for a job that hit a limit. Without
+    // finished the notices of the jobs that hit a limit are kept for takeLimitNotices.
+    void removeFinishedJobs(std::vector<std::string>* finished = nullptr);
+
+    // The notices of the jobs killed by a limit that were removed without being reported, for jobs
+    std::vector<std::string> takeLimitNotices();
 
     JobEntry *getJobById(int jobId);
 
@@ -95,21 +299,50 @@ public:
 class SmallShell {
 private:
     // members
+    ObjectPool commandPool; // first, so it outlives every command
     char* lastPwd;
     std::string prompt = "smash";
     JobsList jobs;
     std::unordered_map<std::string, std::string> aliases;
     std::vector<std::string> aliasOrder;
     pid_t fgPid;
+    HistoryLog history;
+    int lastStatus;
+    bool isChildProcess;
+    pid_t processPid; // the process the state below belongs to, a forked child has to set up its own
+    TimerWheel timers;
+    OutputCapture captures;
+    OutputCache cache;
+    DirCache dirCache;
+    Environment environment;
+    AuditLog audit;
+    JobTable jobTable;
+    pid_t linePid; // the first process forked for the command line being run
+    int signalFd;
+    PipeConfig pipeConfig;
+    bool interrupted;
+    bool childrenChanged;
+    ResourceLimits defaultLimits; // set by ulimit for every process smash forks
+    Spawner spawner;
+    bool asyncSpawn; // SMASH_SPAWN_THREAD=0 forks background jobs at the prompt instead
 
     // methods
     SmallShell();
-    void executeExternalCommand(const std::shared_ptr<Command>& cmd, bool isBackground);
+    void handleSignals();
+    // jobId is the id of a pending job being launched, which keeps it, 0 for a new job
+    void executeExternalCommand(const std::shared_ptr<Command>& cmd, const std::shared_ptr<CommandNode>& node,
+                                bool isBackground, int jobId = 0);
+    // Hands a background external command to the spawner thread, returns false if it has to be forked:
+    // a limit, a PATH assignment or the audit log, which records the pid of the line, need the fork
+    bool spawnInBackground(const std::shared_ptr<Command>& cmd, const std::shared_ptr<CommandNode>& node);
+    // Makes a command of node from the command pool
+    template <typename T, typename... Args>
+    std::shared_ptr<Command> newCommand(const std::shared_ptr<CommandNode>& node, Args&&... args);
 
 public:
     static const std::set<std::string> RESERVED_KEYWORDS;
 
-    std::shared_ptr<Command> CreateCommand(const std::string& cmd_line);
+    std::shared_ptr<Command> CreateCommand(const std::shared_ptr<CommandNode>& node);
     SmallShell(SmallShell const &) = delete; // disable copy ctor
     void operator=(SmallShell const &) = delete; // disable = operator
     static SmallShell &getInstance() // make SmallShell singleton
@@ -122,6 +355,35 @@ public:
 
     void executeCommand(const std::string& cmd_line);
 
+    // Runs a parsed command, isBackground if it was followed by '&'
+    void executeNode(const std::shared_ptr<CommandNode>& node, bool isBackground);
+
+    // Runs a command inside a forked child and exits, external commands replace the child
+    void executeInChild(const std::shared_ptr<CommandNode>& node);
+    bool isInChild() const;
+    // Called first in a forked child, drops the signal handling, timers, audit log and job table of the parent
+    void enterChild();
+
+    // Exit status of the last command, used by '&&' and '||'
+    int getLastStatus() const;
+
+    // Waits until fd is readable (-1 for no fd) or timeoutMs passes (-1 for no limit), handling signals,
+    // due timers and captured output meanwhile. Returns true if fd is readable.
+    bool waitForEvents(int fd, int timeoutMs);
+    // The same for several fds, whose revents are filled in. Returns true if any of them is ready.
+    bool waitForEvents(struct pollfd* extraFds, size_t numExtraFds, int timeoutMs);
+
+    // waitpid for a foreground process that keeps handling events while it runs
+    pid_t waitForeground(pid_t pid, int* status, int options);
+
+    // Reports the background jobs that finished while smash was waiting at the prompt,
+    // returns true if anything was printed
+    bool reportFinishedJobs();
+
+    // Set by ctrl-C, so builtins that wait can stop. takeInterrupt returns and clears it.
+    void interrupt();
+    bool takeInterrupt();
+
     //prompt
     const std::string& getPrompt() const;
     void setPrompt(const std::string& newPrompt);
@@ -136,6 +398,37 @@ public:
 
     JobsList& getJobs();
 
+    HistoryLog& getHistory();
+
+    TimerWheel& getTimers();
+
+    OutputCapture& getCaptures();
+
+    OutputCache& getCache();
+
+    DirCache& getDirCache();
+
+    Environment& getEnvironment();
+
+    AuditLog& getAudit();
+
+    // The jobs list as published in shared memory for monitoring tools
+    JobTable& getJobTable();
+
+    // Records the first process forked for the current command line, the pid the audit log shows for it
+    void noteFork(pid_t pid);
+
+    // Starts the after jobs whose dependencies are done, called whenever a child exits
+    void launchReadyJobs();
+
+    // Gives the jobs the spawner started their pids. With wait, first waits for every spawn in flight,
+    // for whoever needs the pid of a job right away.
+    void finishSpawns(bool wait);
+
+    PipeConfig& getPipeConfig();
+
+    ResourceLimits& getDefaultLimits();
+
     pid_t getFgPid() const;
     void setFgPid(pid_t fgPid);
 };
@@ -144,7 +437,7 @@ public:
 
 class BuiltInCommand : public Command {
 public:
-    explicit BuiltInCommand(const std::string& cmd_line);
+    explicit BuiltInCommand(const std::string& cmd_line, Kind kind = BUILTIN);
 
     ~BuiltInCommand() override = default;
 };
@@ -249,6 +542,27 @@ public:
     void execute() override;
 };
 
+class HistoryCommand : public BuiltInCommand {
+public:
+    explicit HistoryCommand(const std::string& cmd_line);
+
+    ~HistoryCommand() override = default;
+
+    void execute() override;
+};
+
+class PipeConfCommand : public BuiltInCommand {
+public:
+    explicit PipeConfCommand(const std::shared_ptr<CommandNode>& node);
+
+    ~PipeConfCommand() override = default;
+
+    void execute() override;
+
+private:
+    std::vector<std::string> words;
+};
+
 class ListDirCommand : public BuiltInCommand {
 public:
     explicit ListDirCommand(const std::string& cmd_line);
@@ -271,21 +585,40 @@ public:
 
 class ExternalCommand : public Command {
 public:
-    explicit ExternalCommand(const std::string& cmd_line);
+    ExternalCommand(const std::string& cmd_line, const std::vector<std::string>& patterns);
 
     ~ExternalCommand() override = default;
 
     void execute() override;
 
-    void setOriginalCmdLine(const std::string& cmd_line);
-    std::string getOriginalCmdLine() const;
+    // Expands the wildcards of the arguments, called by the parent before forking. With the directory
+    // cache on, the parent also finds the command in PATH.
+    void prepareArguments();
+
+    const std::vector<std::string>& getArgs() const;
+    const std::string& getPath() const;
 private:
-    std::string originalCmdLine;
+    std::vector<std::string> patterns;
+    std::vector<std::string> args;
+    std::string path; // where the command was found in PATH, empty to leave the search to execvp
+};
+
+// sleep, echo, true, false, test, [ and printf run by smash itself, see utilities.h. Sent to the
+// background they are still forked, so they show up in jobs and can be killed and brought back with fg.
+class UtilityCommand : public BuiltInCommand {
+    std::vector<std::string> args;
+public:
+    UtilityCommand(const std::string& cmd_line, std::vector<std::string> args);
+
+    ~UtilityCommand() override = default;
+
+    void execute() override;
 };
 
 class RedirectionCommand : public Command {
+    std::shared_ptr<CommandNode> node;
 public:
-    explicit RedirectionCommand(const std::string& cmd_line);
+    explicit RedirectionCommand(const std::shared_ptr<CommandNode>& node);
 
     ~RedirectionCommand() override = default;
 
@@ -293,14 +626,196 @@ public:
 };
 
 class PipeCommand : public Command {
+    std::shared_ptr<CommandNode> node;
 public:
-    explicit PipeCommand(const std::string& cmd_line);
+    explicit PipeCommand(const std::shared_ptr<CommandNode>& node);
 
     virtual ~PipeCommand() = default;
 
     void execute() override;
 };
 
+class ListCommand : public Command {
+    std::shared_ptr<CommandNode> node;
+public:
+    explicit ListCommand(const std::shared_ptr<CommandNode>& node);
+
+    virtual ~ListCommand() = default;
+
+    void execute() override;
+};
+
+class TimeoutCommand : public Command {
+    std::shared_ptr<CommandNode> command; // the command that runs under the deadline
+    int signum;
+    long durationMs;
+    long killAfterMs;
+    bool valid;
+    pid_t pid;
+    bool fired;
+    Timer timer;
+
+    static void onDeadline(Timer* timer);
+public:
+    explicit TimeoutCommand(const std::shared_ptr<CommandNode>& node);
+
+    ~TimeoutCommand() override;
+
+    // Runs the command in the forked child
+    void execute() override;
+
+    bool isValid() const;
+
+    // Starts and stops the deadline of the forked child
+    void start(pid_t pid);
+    void stop();
+
+    bool hasTimedOut() const;
+    long getRemainingMs() const;
+};
+
+// cache [--ttl DURATION] [--dep FILE]... COMMAND replays the stored stdout and exit status of COMMAND
+// as long as the expanded command line and the dependency files are unchanged. cache stats and
+// cache clear look after the store.
+class CacheCommand : public BuiltInCommand {
+    std::shared_ptr<CommandNode> node;
+public:
+    explicit CacheCommand(const std::shared_ptr<CommandNode>& node);
+
+    ~CacheCommand() override = default;
+
+    void execute() override;
+};
+
+// trace start FILE records the lifecycle of every command (parse, fork, child start, exec, pipeline
+// stages, waitpid, jobs reaped) until trace stop writes it to FILE as a Chrome trace.
+class TraceCommand : public BuiltInCommand {
+public:
+    explicit TraceCommand(const std::string& cmd_line);
+
+    ~TraceCommand() override = default;
+
+    void execute() override;
+};
+
+// audit shows where the audit log goes and how many records were logged, are still queued, were
+// dropped because the queue was full, or were lost to write errors
+class AuditCommand : public BuiltInCommand {
+public:
+    explicit AuditCommand(const std::string& cmd_line);
+
+    ~AuditCommand() override = default;
+
+    void execute() override;
+};
+
+// export NAME=value... sets environment variables for the programs smash runs, export alone lists them
+class ExportCommand : public BuiltInCommand {
+    std::shared_ptr<CommandNode> node;
+public:
+    explicit ExportCommand(const std::shared_ptr<CommandNode>& node);
+
+    ~ExportCommand() override = default;
+
+    void execute() override;
+};
+
+class UnsetCommand : public BuiltInCommand {
+public:
+    explicit UnsetCommand(const std::string& cmd_line);
+
+    ~UnsetCommand() override = default;
+
+    void execute() override;
+};
+
+// snapshot save FILE writes the aliases, prompt, cwd and exported variables of smash to FILE, for
+// smash --snapshot FILE to start with
+class SnapshotCommand : public BuiltInCommand {
+public:
+    explicit SnapshotCommand(const std::string& cmd_line);
+
+    ~SnapshotCommand() override = default;
+
+    void execute() override;
+};
+
+// dircache on|off turns the directory cache of listdir and PATH lookups on or off, dircache alone
+// shows how it does
+class DirCacheCommand : public BuiltInCommand {
+public:
+    explicit DirCacheCommand(const std::string& cmd_line);
+
+    ~DirCacheCommand() override = default;
+
+    void execute() override;
+};
+
+// bench [-n N] [-w WARMUPS] [--min-time DURATION] [--json] COMMAND [COMMAND2] runs a command line
+// N times (10 by default), and for at least DURATION if given, through the usual execution path with its stdout
+// on /dev/null, and reports the statistics of its run times, see bench.h. Every COMMAND is a single
+// word, so a command with arguments or a pipeline is quoted. With two commands their runs alternate
+// and the report says how they compare.
+class BenchCommand : public BuiltInCommand {
+    std::shared_ptr<CommandNode> node;
+public:
+    explicit BenchCommand(const std::shared_ptr<CommandNode>& node);
+
+    ~BenchCommand() override = default;
+
+    void execute() override;
+};
+
+// limit [-v KB] [-t SECONDS] [-n FILES] [-f KB] COMMAND runs COMMAND under these limits, see rlimits.h.
+// CreateCommand gives the limits to COMMAND itself, this command only reports a limit without a command.
+class LimitCommand : public BuiltInCommand {
+public:
+    explicit LimitCommand(const std::string& cmd_line);
+
+    ~LimitCommand() override = default;
+
+    void execute() override;
+};
+
+// ulimit [-a] lists the limits of new jobs, ulimit -v prints one of them and ulimit -v KB [-t SECONDS]...
+// sets them for every process smash forks from now on, smash itself stays unlimited
+class UlimitCommand : public BuiltInCommand {
+public:
+    explicit UlimitCommand(const std::string& cmd_line);
+
+    ~UlimitCommand() override = default;
+
+    void execute() override;
+};
+
+// prlimit JOB_ID [-v KB] [-t SECONDS]... changes the limits of a running job, or lists the ones it has
+class PrlimitCommand : public BuiltInCommand {
+    JobsList* jobs;
+public:
+    PrlimitCommand(const std::string& cmd_line, JobsList* jobs);
+
+    ~PrlimitCommand() override = default;
+
+    void execute() override;
+};
+
+// after [%]ID... COMMAND runs COMMAND once the jobs with these ids finished, after-ok only if they all
+// succeeded. With '&' it becomes a pending job that the shell launches as soon as its dependencies
+// are done, without it the shell waits for them and runs COMMAND in the foreground. node may be the
+// redirections around the after command, they apply to COMMAND.
+class AfterCommand : public BuiltInCommand {
+    std::shared_ptr<CommandNode> node;
+    bool isBackground;
+public:
+    explicit AfterCommand(const std::shared_ptr<CommandNode>& node);
+
+    ~AfterCommand() override = default;
+
+    void setBackground(bool isBackground);
+
+    void execute() override;
+};
+
 class WatchCommand : public Command {
 public:
     WatchCommand(const std::string& cmd_line);
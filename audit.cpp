@@ -0,0 +1,219 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pwd.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "audit.h"
+
+using namespace std;
+
+#define AUDIT_BATCH_SIZE (64 * 1024)
+
+AuditLog::AuditLog() : ring(nullptr), head(0), tail(0), dropped(0), logged(0), failed(0), stopping(false),
+                       fd(-1), wakeFd(-1), enabled(false), owner(-1)
+{}
+
+AuditLog::~AuditLog() {
+    if (enabled && owner == getpid()) {
+        // The writer drains the ring and syncs once more before it exits
+        stopping.store(true, memory_order_release);
+        uint64_t one = 1;
+        if (write(wakeFd, &one, sizeof(one)) == -1) {
+            perror("smash error: audit: write failed");
+        }
+        pthread_join(writer, nullptr);
+    }
+    reset();
+    delete[] ring;
+}
+
+bool AuditLog::open(const string& path) {
+    fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        return false;
+    }
+    wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wakeFd == -1) {
+        int savedErrno = errno;
+        close(fd);
+        fd = -1;
+        errno = savedErrno;
+        return false;
+    }
+    // Commands run as the user of the shell
+    struct passwd* entry = getpwuid(getuid());
+    user = ((entry != nullptr) ? string(entry->pw_name) : to_string(getuid())).substr(0, 32);
+    this->path = path;
+    ring = new Record[AUDIT_RING_SIZE];
+    owner = getpid();
+
+    // Signals are handled by the main thread only, the writer is created with all of them blocked
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int error = pthread_create(&writer, nullptr, writerLoop, this);
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    if (error != 0) {
+        reset();
+        errno = error;
+        return false;
+    }
+    enabled = true;
+    return true;
+}
+
+bool AuditLog::isEnabled() const {
+    return enabled;
+}
+
+const string& AuditLog::getPath() const {
+    return path;
+}
+
+uint64_t AuditLog::now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void copyField(char* field, const string& value) {
+    size_t length = min(value.size(), (size_t)AUDIT_FIELD_SIZE - 1);
+    memcpy(field, value.data(), length);
+    field[length] = '\0';
+}
+
+void AuditLog::log(char kind, const string& command, const string& cwd, pid_t pid, int status,
+                   uint64_t startMonotonic) {
+    if (!enabled) {
+        return;
+    }
+    uint64_t position = head.load(memory_order_relaxed);
+    uint64_t used = position - tail.load(memory_order_acquire);
+    if (used >= AUDIT_RING_SIZE) {
+        dropped.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    Record& record = ring[position & (AUDIT_RING_SIZE - 1)];
+    struct timespec realtime;
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    record.duration = now() - startMonotonic;
+    record.start = realtime.tv_sec * 1000000000ULL + realtime.tv_nsec - record.duration;
+    record.pid = pid;
+    record.status = status;
+    record.kind = kind;
+    copyField(record.cwd, cwd);
+    copyField(record.command, command);
+    head.store(position + 1, memory_order_release);
+    // Otherwise the writer picks the records up on its next AUDIT_FLUSH_MS round
+    if (used + 1 == AUDIT_RING_SIZE / 2) {
+        uint64_t one = 1;
+        if (write(wakeFd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+            perror("smash error: audit: write failed");
+        }
+    }
+}
+
+AuditLog::Stats AuditLog::getStats() const {
+    Stats stats;
+    stats.logged = logged.load(memory_order_relaxed);
+    stats.pending = head.load(memory_order_relaxed) - tail.load(memory_order_relaxed);
+    stats.dropped = dropped.load(memory_order_relaxed);
+    stats.failed = failed.load(memory_order_relaxed);
+    return stats;
+}
+
+void AuditLog::reset() {
+    enabled = false;
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+    if (wakeFd != -1) {
+        close(wakeFd);
+        wakeFd = -1;
+    }
+}
+
+// Tabs and newlines would break the line format
+static size_t appendField(char* out, const char* field) {
+    size_t length = 0;
+    for (const char* c = field; *c != '\0'; c++) {
+        out[length++] = (*c == '\t' || *c == '\n' || *c == '\r') ? ' ' : *c;
+    }
+    return length;
+}
+
+void* AuditLog::writerLoop(void* self) {
+    AuditLog* log = (AuditLog*)self;
+    struct pollfd wake = {log->wakeFd, POLLIN, 0};
+    uint64_t lastSync = now();
+    bool unsynced = false;
+    while (true) {
+        if (poll(&wake, 1, AUDIT_FLUSH_MS) > 0) {
+            uint64_t count;
+            if (read(log->wakeFd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+                perror("smash error: audit: read failed");
+            }
+        }
+        bool stop = log->stopping.load(memory_order_acquire);
+        unsynced = log->drain() || unsynced;
+        if (unsynced && (stop || now() - lastSync >= AUDIT_SYNC_MS * 1000000ULL)) {
+            fdatasync(log->fd);
+            lastSync = now();
+            unsynced = false;
+        }
+        if (stop) {
+            return nullptr;
+        }
+    }
+}
+
+bool AuditLog::drain() {
+    static char batch[AUDIT_BATCH_SIZE];
+    uint64_t position = tail.load(memory_order_relaxed);
+    uint64_t end = head.load(memory_order_acquire);
+    bool wrote = position != end;
+    while (position != end) {
+        // Records are formatted into the batch, so their slots can be handed back before the write
+        size_t length = 0;
+        uint64_t first = position;
+        while (position != end && AUDIT_BATCH_SIZE - length >= 2 * AUDIT_FIELD_SIZE + 128) {
+            const Record& record = ring[position & (AUDIT_RING_SIZE - 1)];
+            time_t seconds = record.start / 1000000000ULL;
+            struct tm utc;
+            gmtime_r(&seconds, &utc);
+            length += strftime(batch + length, 32, "%Y-%m-%dT%H:%M:%S", &utc);
+            length += snprintf(batch + length, 128, ".%03uZ\t%s\t%d\t%s\t%d\t%llu.%06llu\t",
+                               (unsigned)(record.start / 1000000 % 1000), user.c_str(), record.pid,
+                               record.kind == 'j' ? "job" : "cmd", record.status,
+                               (unsigned long long)(record.duration / 1000000000ULL),
+                               (unsigned long long)(record.duration / 1000 % 1000000));
+            length += appendField(batch + length, record.cwd);
+            batch[length++] = '\t';
+            length += appendField(batch + length, record.command);
+            batch[length++] = '\n';
+            position++;
+        }
+        tail.store(position, memory_order_release);
+
+        size_t written = 0;
+        while (written < length) {
+            ssize_t result = write(fd, batch + written, length - written);
+            if (result == -1 && errno != EINTR) {
+                break;
+            }
+            written += (result > 0) ? result : 0;
+        }
+        if (written < length) {
+            failed.fetch_add(position - first, memory_order_relaxed);
+        } else {
+            logged.fetch_add(position - first, memory_order_relaxed);
+        }
+    }
+    return wrote;
+}
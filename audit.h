@@ -0,0 +1,84 @@
+#ifndef SMASH_AUDIT_H_
+#define SMASH_AUDIT_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <atomic>
+#include <string>
+
+#define AUDIT_RING_SIZE (1024) // records, a power of two
+#define AUDIT_FIELD_SIZE (256)
+#define AUDIT_FLUSH_MS (100)
+#define AUDIT_SYNC_MS (1000)
+
+// Audit trail of every command smash runs, kept in an append-only file with one tab-separated line
+// per record: start time, user, pid, kind, exit status, duration, cwd and command line. The shell
+// only copies a fixed-size record into a single-producer single-consumer ring, and a writer thread
+// batches the records into the file and calls fdatasync at most every AUDIT_SYNC_MS, so no disk
+// latency ever reaches the command path. When the ring is full the record is dropped and counted.
+class AuditLog {
+public:
+    struct Record {
+        uint64_t start;    // CLOCK_REALTIME, ns
+        uint64_t duration; // ns
+        pid_t pid;
+        int status;
+        char kind;         // 'c' for a command line, 'j' for a background job that ended
+        char cwd[AUDIT_FIELD_SIZE];
+        char command[AUDIT_FIELD_SIZE];
+    };
+
+    struct Stats {
+        uint64_t logged;  // records written to the file
+        uint64_t pending; // records still in the ring
+        uint64_t dropped; // records lost to a full ring
+        uint64_t failed;  // records lost to write errors
+    };
+
+    AuditLog();
+    ~AuditLog();
+
+    AuditLog(AuditLog const &) = delete; // disable copy ctor
+    void operator=(AuditLog const &) = delete; // disable = operator
+
+    // Opens the log for appending and starts the writer thread
+    bool open(const std::string& path);
+    bool isEnabled() const;
+    const std::string& getPath() const;
+
+    // Never blocks. startMonotonic is a now() value taken when the command started.
+    void log(char kind, const std::string& command, const std::string& cwd, pid_t pid, int status,
+             uint64_t startMonotonic);
+
+    Stats getStats() const;
+
+    // Drops the log inherited by a forked child, the ring and the writer belong to the shell
+    void reset();
+
+    // CLOCK_MONOTONIC in nanoseconds
+    static uint64_t now();
+
+private:
+    Record* ring;
+    // The shell only writes head and the writer only writes tail, each on a cache line of its own
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+    alignas(64) std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> logged;
+    std::atomic<uint64_t> failed;
+    std::atomic<bool> stopping;
+    int fd;
+    int wakeFd; // eventfd, kicked when the ring is half full or the shell exits
+    bool enabled;
+    pid_t owner;
+    std::string user;
+    std::string path;
+    pthread_t writer;
+
+    static void* writerLoop(void* self);
+    // Writes out the records in the ring, returns true if there were any
+    bool drain();
+};
+
+#endif //SMASH_AUDIT_H_
@@ -0,0 +1,168 @@
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include "bench.h"
+#include "trace.h"
+
+using namespace std;
+
+// Linear interpolation between the closest ranks, sorted must not be empty
+static double quantile(const vector<double>& sorted, double q) {
+    double position = q * (sorted.size() - 1);
+    size_t lower = (size_t)position;
+    if (lower + 1 >= sorted.size()) {
+        return sorted.back();
+    }
+    return sorted[lower] + (position - lower) * (sorted[lower + 1] - sorted[lower]);
+}
+
+BenchStats computeBenchStats(const vector<BenchSample>& samples) {
+    BenchStats stats = {};
+    stats.runs = samples.size();
+    if (samples.empty()) {
+        return stats;
+    }
+    vector<double> times;
+    for (const BenchSample& sample : samples) {
+        times.push_back(sample.wall);
+        stats.mean += sample.wall;
+        stats.user += sample.user;
+        stats.system += sample.system;
+        stats.failed += (sample.status != 0);
+    }
+    stats.mean /= samples.size();
+    stats.user /= samples.size();
+    stats.system /= samples.size();
+    for (double time : times) {
+        stats.stddev += (time - stats.mean) * (time - stats.mean);
+    }
+    stats.stddev = (samples.size() > 1) ? sqrt(stats.stddev / (samples.size() - 1)) : 0;
+
+    sort(times.begin(), times.end());
+    stats.min = times.front();
+    stats.max = times.back();
+    stats.median = quantile(times, 0.5);
+    // Nearest rank, so p99 is a time that was actually measured
+    stats.p99 = times[(size_t)ceil(0.99 * times.size()) - 1];
+
+    // Tukey's fences
+    double q1 = quantile(times, 0.25);
+    double q3 = quantile(times, 0.75);
+    double fence = 1.5 * (q3 - q1);
+    for (double time : times) {
+        stats.outliers += (time < q1 - fence || time > q3 + fence);
+    }
+    return stats;
+}
+
+void compareBenchStats(const BenchStats& a, const BenchStats& b, double* ratio, double* stddev) {
+    *ratio = b.mean / a.mean;
+    // The relative errors of independent measurements add up in quadrature
+    *stddev = *ratio * sqrt((a.stddev / a.mean) * (a.stddev / a.mean) + (b.stddev / b.mean) * (b.stddev / b.mean));
+}
+
+// In the unit that suits reference, so a mean and its deviation read alike
+static string formatDuration(double seconds, double reference) {
+    char text[32];
+    if (reference < 1e-3) {
+        snprintf(text, sizeof(text), "%.1f us", seconds * 1e6);
+    } else if (reference < 1) {
+        snprintf(text, sizeof(text), "%.2f ms", seconds * 1e3);
+    } else {
+        snprintf(text, sizeof(text), "%.3f s", seconds);
+    }
+    return text;
+}
+
+string formatBenchReport(const vector<string>& commands, const vector<vector<BenchSample>>& samples,
+                         size_t warmups) {
+    string out;
+    vector<BenchStats> stats;
+    for (size_t i = 0; i < commands.size(); i++) {
+        stats.push_back(computeBenchStats(samples[i]));
+        const BenchStats& s = stats.back();
+        out += "bench: " + commands[i] + "\n";
+        out += "  runs:     " + to_string(s.runs) + (warmups > 0 ? " (" + to_string(warmups) + " warmups)" : "") + "\n";
+        out += "  time:     " + formatDuration(s.mean, s.mean) + " +- " + formatDuration(s.stddev, s.mean) +
+               "   user " + formatDuration(s.user, s.mean) + ", sys " + formatDuration(s.system, s.mean) + "\n";
+        out += "  range:    min " + formatDuration(s.min, s.mean) + ", median " + formatDuration(s.median, s.mean) +
+               ", p99 " + formatDuration(s.p99, s.mean) + ", max " + formatDuration(s.max, s.mean) + "\n";
+        if (s.outliers > 0) {
+            out += "  outliers: " + to_string(s.outliers) + " of " + to_string(s.runs) +
+                   " runs, the system may have been busy\n";
+        }
+        if (s.failed > 0) {
+            out += "  failed:   " + to_string(s.failed) + " of " + to_string(s.runs) +
+                   " runs ended with a non-zero status\n";
+        }
+    }
+    if (stats.size() == 2 && stats[0].mean > 0 && stats[1].mean > 0) {
+        bool firstFaster = stats[0].mean <= stats[1].mean;
+        const BenchStats& fast = firstFaster ? stats[0] : stats[1];
+        const BenchStats& slow = firstFaster ? stats[1] : stats[0];
+        double ratio, stddev;
+        compareBenchStats(fast, slow, &ratio, &stddev);
+        char text[64];
+        snprintf(text, sizeof(text), " ran %.2f +- %.2f times faster than ", ratio, stddev);
+        out += commands[firstFaster ? 0 : 1] + text + commands[firstFaster ? 1 : 0] + "\n";
+    }
+    return out;
+}
+
+static void appendJsonNumber(string& out, const char* name, double value) {
+    char text[64];
+    snprintf(text, sizeof(text), "\"%s\": %.9g", name, value);
+    out += text;
+}
+
+string formatBenchJson(const vector<string>& commands, const vector<vector<BenchSample>>& samples,
+                       size_t warmups) {
+    string out = "{\"results\": [";
+    vector<BenchStats> stats;
+    for (size_t i = 0; i < commands.size(); i++) {
+        stats.push_back(computeBenchStats(samples[i]));
+        const BenchStats& s = stats.back();
+        out += (i > 0) ? ", {\"command\": " : "{\"command\": ";
+        appendJsonString(out, commands[i].c_str());
+        out += ", \"runs\": " + to_string(s.runs) + ", \"warmups\": " + to_string(warmups) + ", ";
+        appendJsonNumber(out, "mean", s.mean);
+        out += ", ";
+        appendJsonNumber(out, "stddev", s.stddev);
+        out += ", ";
+        appendJsonNumber(out, "min", s.min);
+        out += ", ";
+        appendJsonNumber(out, "median", s.median);
+        out += ", ";
+        appendJsonNumber(out, "p99", s.p99);
+        out += ", ";
+        appendJsonNumber(out, "max", s.max);
+        out += ", ";
+        appendJsonNumber(out, "user", s.user);
+        out += ", ";
+        appendJsonNumber(out, "system", s.system);
+        out += ", \"outliers\": " + to_string(s.outliers) + ", \"failed\": " + to_string(s.failed) + ", \"times\": [";
+        for (size_t j = 0; j < samples[i].size(); j++) {
+            char text[32];
+            snprintf(text, sizeof(text), (j > 0) ? ", %.9g" : "%.9g", samples[i][j].wall);
+            out += text;
+        }
+        out += "], \"exit_codes\": [";
+        for (size_t j = 0; j < samples[i].size(); j++) {
+            out += ((j > 0) ? ", " : "") + to_string(samples[i][j].status);
+        }
+        out += "]}";
+    }
+    out += "]";
+    if (stats.size() == 2 && stats[0].mean > 0 && stats[1].mean > 0) {
+        // How many times slower the second command is than the first
+        double ratio, stddev;
+        compareBenchStats(stats[0], stats[1], &ratio, &stddev);
+        out += ", \"comparison\": {";
+        appendJsonNumber(out, "ratio", ratio);
+        out += ", ";
+        appendJsonNumber(out, "stddev", stddev);
+        out += "}";
+    }
+    out += "}\n";
+    return out;
+}
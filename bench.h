@@ -0,0 +1,45 @@
+#ifndef SMASH_BENCH_H_
+#define SMASH_BENCH_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#define BENCH_DEFAULT_RUNS (10)
+#define BENCH_MAX_RUNS (1000000) // --min-time stops here even if the time is not up
+
+// One run of a command measured by the bench builtin, in seconds. user and system are what smash
+// and the children it reaped during the run used, the same accounting wait4 reports.
+struct BenchSample {
+    double wall;
+    double user;
+    double system;
+    int status;
+};
+
+struct BenchStats {
+    size_t runs;
+    double mean;
+    double stddev; // of the sample, 0 for a single run
+    double min;
+    double median;
+    double p99;
+    double max;
+    double user;   // mean
+    double system; // mean
+    size_t outliers; // runs further than 1.5 interquartile ranges from the quartiles
+    size_t failed;   // runs with a non-zero exit status
+};
+
+BenchStats computeBenchStats(const std::vector<BenchSample>& samples);
+
+// How much slower the command of b is than the one of a, with its standard deviation
+void compareBenchStats(const BenchStats& a, const BenchStats& b, double* ratio, double* stddev);
+
+// The report of the bench builtin for its commands, as text or as a JSON object
+std::string formatBenchReport(const std::vector<std::string>& commands,
+                              const std::vector<std::vector<BenchSample>>& samples, size_t warmups);
+std::string formatBenchJson(const std::vector<std::string>& commands,
+                            const std::vector<std::vector<BenchSample>>& samples, size_t warmups);
+
+#endif //SMASH_BENCH_H_
@@ -0,0 +1,279 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <vector>
+#include "cache.h"
+
+using namespace std;
+
+#define CACHE_MAGIC "smash-cache 1\n"
+#define CACHE_STATS_FILE "stats"
+
+// 64-bit FNV-1a, the full key is kept in the entry to tell apart keys with the same hash
+static uint64_t hashKey(const string& key) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : key) {
+        hash = (hash ^ c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Entries are the files named with 16 hex digits
+static bool isEntryName(const char* name) {
+    return strlen(name) == 16 && strspn(name, "0123456789abcdef") == 16;
+}
+
+// What the cache itself writes: entries, the stats file, and the temporary files of writeFile that a
+// killed smash left behind, named <entry or stats>.tmp.<pid>
+static bool isCacheFileName(const char* name) {
+    string base = name;
+    size_t temp = base.find(".tmp.");
+    if (temp != string::npos) {
+        const char* pid = name + temp + 5;
+        if (*pid == '\0' || strspn(pid, "0123456789") != strlen(pid)) {
+            return false;
+        }
+        base.resize(temp);
+    }
+    return isEntryName(base.c_str()) || base == CACHE_STATS_FILE;
+}
+
+static bool readFile(const string& path, string& contents) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    contents.clear();
+    char buffer[64 * 1024];
+    ssize_t length;
+    while ((length = read(fd, buffer, sizeof(buffer))) > 0 || (length == -1 && errno == EINTR)) {
+        if (length > 0) {
+            contents.append(buffer, length);
+        }
+    }
+    close(fd);
+    return length == 0;
+}
+
+// Writes a temporary file and renames it over path, so readers never see half an entry
+static bool writeFile(const string& path, const string& contents) {
+    string temp = path + ".tmp." + to_string(getpid());
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        return false;
+    }
+    size_t written = 0;
+    while (written < contents.size()) {
+        ssize_t length = write(fd, contents.data() + written, contents.size() - written);
+        if (length == -1 && errno != EINTR) {
+            close(fd);
+            unlink(temp.c_str());
+            return false;
+        }
+        written += (length > 0) ? length : 0;
+    }
+    close(fd);
+    if (rename(temp.c_str(), path.c_str()) == -1) {
+        unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+OutputCache::OutputCache() {
+    const char* cacheDir = getenv("SMASH_CACHE_DIR");
+    const char* home = getenv("HOME");
+    if (cacheDir != nullptr) {
+        dir = cacheDir;
+    } else if (home != nullptr) {
+        dir = string(home) + "/.cache/smash";
+    }
+}
+
+bool OutputCache::makeDir() {
+    if (dir.empty()) {
+        errno = ENOENT;
+        return false;
+    }
+    // Creates the missing parents too
+    for (size_t slash = dir.find('/', 1); ; slash = dir.find('/', slash + 1)) {
+        string prefix = dir.substr(0, slash);
+        if (mkdir(prefix.c_str(), 0700) == -1 && errno != EEXIST) {
+            return false;
+        }
+        if (slash == string::npos) {
+            return true;
+        }
+    }
+}
+
+string OutputCache::pathOf(const string& key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)hashKey(key));
+    return dir + "/" + name;
+}
+
+bool OutputCache::lookup(const string& key, Entry& entry) {
+    string path = pathOf(key);
+    string contents;
+    // magic, key length, key, status, expiry time, output
+    bool hit = false;
+    if (!dir.empty() && readFile(path, contents) && contents.compare(0, strlen(CACHE_MAGIC), CACHE_MAGIC) == 0) {
+        const char* position = contents.c_str() + strlen(CACHE_MAGIC);
+        char* end;
+        size_t keyLength = strtoul(position, &end, 10);
+        size_t keyStart = end + 1 - contents.c_str();
+        if (*end == '\n' && keyStart + keyLength <= contents.size() &&
+            contents.compare(keyStart, keyLength, key) == 0) {
+            char* statusEnd;
+            char* expiresEnd = nullptr;
+            long long status = strtoll(contents.c_str() + keyStart + keyLength, &statusEnd, 10);
+            // An entry cut off after its status ends at the terminating null, nothing follows it
+            long long expires = (*statusEnd == '\n') ? strtoll(statusEnd + 1, &expiresEnd, 10) : 0;
+            if (expiresEnd != nullptr && *expiresEnd == '\n' && (expires == 0 || expires > time(nullptr))) {
+                entry.status = (int)status;
+                entry.output = contents.substr(expiresEnd + 1 - contents.c_str());
+                hit = true;
+                // The mtime of an entry is its last use
+                utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+            }
+        }
+    }
+    count(hit ? &Stats::hits : &Stats::misses, 1);
+    return hit;
+}
+
+bool OutputCache::store(const string& key, const Entry& entry, long ttlSeconds) {
+    if (entry.output.size() > CACHE_MAX_ENTRY_SIZE || !makeDir()) {
+        return false;
+    }
+    long long expires = (ttlSeconds > 0) ? (long long)time(nullptr) + ttlSeconds : 0;
+    string contents = CACHE_MAGIC + to_string(key.size()) + "\n" + key + to_string(entry.status) + "\n" +
+                      to_string(expires) + "\n" + entry.output;
+    if (!writeFile(pathOf(key), contents)) {
+        return false;
+    }
+    evict();
+    return true;
+}
+
+void OutputCache::evict() {
+    struct File {
+        string path;
+        struct timespec used;
+        off_t size;
+    };
+    vector<File> files;
+    uint64_t total = 0;
+    DIR* directory = opendir(dir.c_str());
+    if (directory == nullptr) {
+        return;
+    }
+    struct dirent* item;
+    while ((item = readdir(directory)) != nullptr) {
+        struct stat st;
+        string path = dir + "/" + item->d_name;
+        if (isEntryName(item->d_name) && stat(path.c_str(), &st) == 0) {
+            files.push_back({path, st.st_mtim, st.st_size});
+            total += st.st_size;
+        }
+    }
+    closedir(directory);
+    if (total <= CACHE_MAX_SIZE) {
+        return;
+    }
+
+    sort(files.begin(), files.end(), [](const File& a, const File& b) {
+        return a.used.tv_sec != b.used.tv_sec ? a.used.tv_sec < b.used.tv_sec : a.used.tv_nsec < b.used.tv_nsec;
+    });
+    uint64_t evicted = 0;
+    for (size_t i = 0; i < files.size() && total > CACHE_MAX_SIZE; i++) {
+        if (unlink(files[i].path.c_str()) == 0) {
+            total -= files[i].size;
+            evicted++;
+        }
+    }
+    count(&Stats::evictions, evicted);
+}
+
+bool OutputCache::clear() {
+    DIR* directory = opendir(dir.c_str());
+    if (directory == nullptr) {
+        return errno == ENOENT;
+    }
+    bool success = true;
+    struct dirent* item;
+    while ((item = readdir(directory)) != nullptr) {
+        // The directory may be shared with other files, only the cache's own go
+        if (isCacheFileName(item->d_name)) {
+            success = (unlink((dir + "/" + item->d_name).c_str()) == 0 || errno == ENOENT) && success;
+        }
+    }
+    closedir(directory);
+    return success;
+}
+
+void OutputCache::readCounters(Stats& stats) {
+    string contents;
+    stats.hits = stats.misses = stats.evictions = 0;
+    if (readFile(dir + "/" + CACHE_STATS_FILE, contents)) {
+        unsigned long long hits, misses, evictions;
+        if (sscanf(contents.c_str(), "%llu %llu %llu", &hits, &misses, &evictions) == 3) {
+            stats.hits = hits;
+            stats.misses = misses;
+            stats.evictions = evictions;
+        }
+    }
+}
+
+void OutputCache::count(uint64_t Stats::*counter, uint64_t amount) {
+    if (amount == 0 || !makeDir()) {
+        return;
+    }
+    // The counters file is updated under a lock, the entries themselves need none
+    int lockFd = open((dir + "/" + CACHE_STATS_FILE).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lockFd == -1) {
+        return;
+    }
+    flock(lockFd, LOCK_EX);
+    Stats stats;
+    readCounters(stats);
+    stats.*counter += amount;
+    char line[96];
+    int length = snprintf(line, sizeof(line), "%llu %llu %llu\n", (unsigned long long)stats.hits,
+                          (unsigned long long)stats.misses, (unsigned long long)stats.evictions);
+    if (pwrite(lockFd, line, length, 0) == length) {
+        ftruncate(lockFd, length);
+    }
+    flock(lockFd, LOCK_UN);
+    close(lockFd);
+}
+
+OutputCache::Stats OutputCache::getStats() {
+    Stats stats;
+    stats.entries = 0;
+    stats.bytes = 0;
+    readCounters(stats);
+    DIR* directory = opendir(dir.c_str());
+    if (directory == nullptr) {
+        return stats;
+    }
+    struct dirent* item;
+    while ((item = readdir(directory)) != nullptr) {
+        struct stat st;
+        if (isEntryName(item->d_name) && stat((dir + "/" + item->d_name).c_str(), &st) == 0) {
+            stats.entries++;
+            stats.bytes += st.st_size;
+        }
+    }
+    closedir(directory);
+    return stats;
+}
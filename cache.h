@@ -0,0 +1,54 @@
+#ifndef SMASH_CACHE_H_
+#define SMASH_CACHE_H_
+
+#include <stdint.h>
+#include <string>
+
+#define CACHE_MAX_SIZE (64 * 1024 * 1024)
+#define CACHE_MAX_ENTRY_SIZE (CACHE_MAX_SIZE / 8)
+
+// On-disk store of command outputs for the cache builtin. Every entry is a file named after the
+// hash of its key (the command and the state of the files it depends on) that holds the key, the
+// exit status, an expiry time and the output. Files are replaced with rename, so several shells can
+// share the store. A hit touches the file, and once the store grows past CACHE_MAX_SIZE the least
+// recently used entries are removed. The directory is $SMASH_CACHE_DIR, or ~/.cache/smash.
+class OutputCache {
+public:
+    struct Entry {
+        int status;
+        std::string output;
+    };
+
+    struct Stats {
+        size_t entries;
+        uint64_t bytes;
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+    };
+
+    OutputCache();
+
+    // Returns true on a hit that has not expired, and counts it as a hit or a miss
+    bool lookup(const std::string& key, Entry& entry);
+
+    // ttlSeconds 0 keeps the entry until it is evicted. Outputs over CACHE_MAX_ENTRY_SIZE are not stored.
+    bool store(const std::string& key, const Entry& entry, long ttlSeconds);
+
+    // Removes every entry and resets the counters, leaving any other file of the directory alone
+    bool clear();
+
+    Stats getStats();
+
+private:
+    std::string dir;
+
+    bool makeDir();
+    std::string pathOf(const std::string& key) const;
+    // The counters are kept in a file of the store as well, so they add up across shells
+    void count(uint64_t Stats::*counter, uint64_t amount);
+    void readCounters(Stats& stats);
+    void evict();
+};
+
+#endif //SMASH_CACHE_H_
@@ -0,0 +1,193 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <algorithm>
+#include "capture.h"
+
+using namespace std;
+
+#define DRAIN_CHUNK (16 * 1024)
+#define DRAIN_EVENTS (32)
+
+// An epoll key holds the job id and the generation of its ring
+static uint64_t makeKey(int jobId, uint32_t generation) {
+    return ((uint64_t)generation << 32) | (uint32_t)jobId;
+}
+
+string OutputCapture::Ring::from(uint64_t position) const {
+    uint64_t oldest = (written > data.size()) ? written - data.size() : 0;
+    if (position < oldest) {
+        position = oldest;
+    }
+    size_t offset = position % data.size();
+    size_t length = written - position;
+    size_t first = min(length, data.size() - offset);
+    string result(data.begin() + offset, data.begin() + offset + first);
+    result.append(data.begin(), data.begin() + (length - first));
+    return result;
+}
+
+void OutputCapture::Ring::write(const char* buffer, size_t length) {
+    // Only the tail of a chunk larger than the ring can survive
+    if (length > data.size()) {
+        written += length - data.size();
+        buffer += length - data.size();
+        length = data.size();
+    }
+    size_t offset = written % data.size();
+    size_t first = min(length, data.size() - offset);
+    copy(buffer, buffer + first, data.begin() + offset);
+    copy(buffer + first, buffer + length, data.begin());
+    written += length;
+}
+
+OutputCapture::OutputCapture() : enabled(false), epollFd(-1), nextGeneration(0)
+{}
+
+OutputCapture::~OutputCapture() {
+    for (auto& entry : rings) {
+        close(*entry.second);
+    }
+    if (epollFd != -1) {
+        ::close(epollFd);
+    }
+}
+
+bool OutputCapture::isEnabled() const {
+    return enabled;
+}
+
+bool OutputCapture::setEnabled(bool enabled) {
+    if (enabled && epollFd == -1) {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd == -1) {
+            perror("smash error: capture failed");
+            return false;
+        }
+    }
+    this->enabled = enabled;
+    return true;
+}
+
+int OutputCapture::getFd() const {
+    return epollFd;
+}
+
+void OutputCapture::attach(int jobId, int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    shared_ptr<Ring> ring = make_shared<Ring>();
+    ring->fd = fd;
+    ring->data.resize(CAPTURE_RING_SIZE);
+    ring->written = 0;
+    ring->finished = false;
+
+    auto previous = rings.find(jobId);
+    if (previous != rings.end()) {
+        // The earlier job may have left descendants that still hold its pipe
+        close(*previous->second);
+    }
+    ring->generation = nextGeneration++;
+    rings[jobId] = ring;
+
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = makeKey(jobId, ring->generation);
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        perror("smash error: capture failed");
+        close(*ring);
+        ring->finished = true;
+    }
+}
+
+void OutputCapture::discard(int jobId) {
+    auto it = rings.find(jobId);
+    if (it != rings.end()) {
+        close(*it->second);
+        rings.erase(it);
+    }
+}
+
+void OutputCapture::close(Ring& ring) {
+    if (ring.fd != -1) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, ring.fd, nullptr);
+        ::close(ring.fd);
+        ring.fd = -1;
+    }
+}
+
+bool OutputCapture::read(int jobId, size_t numLines, string& output) {
+    auto it = rings.find(jobId);
+    if (it == rings.end()) {
+        return false;
+    }
+    output = it->second->from(0);
+    if (numLines > 0 && !output.empty()) {
+        // Walk back over numLines line breaks, not counting the one that ends the output
+        size_t start = output.length() - 1;
+        while (start > 0) {
+            if (output[start - 1] == '\n' && --numLines == 0) {
+                break;
+            }
+            start--;
+        }
+        output.erase(0, start);
+    }
+    return true;
+}
+
+bool OutputCapture::readFrom(int jobId, uint64_t& position, string& output, bool& finished) {
+    auto it = rings.find(jobId);
+    if (it == rings.end()) {
+        return false;
+    }
+    output = it->second->from(position);
+    position = it->second->written;
+    finished = it->second->finished;
+    return true;
+}
+
+void OutputCapture::drain() {
+    if (epollFd == -1) {
+        return;
+    }
+    epoll_event events[DRAIN_EVENTS];
+    int numEvents = epoll_wait(epollFd, events, DRAIN_EVENTS, 0);
+    for (int i = 0; i < numEvents; i++) {
+        drainOne(events[i].data.u64);
+    }
+}
+
+void OutputCapture::drainOne(uint64_t key) {
+    // One read per wakeup, epoll is level-triggered so a busy job cannot starve the others
+    char buffer[DRAIN_CHUNK];
+    int jobId = (int)(uint32_t)key;
+    auto it = rings.find(jobId);
+    if (it == rings.end() || makeKey(jobId, it->second->generation) != key || it->second->fd == -1) {
+        return;
+    }
+    shared_ptr<Ring> ring = it->second;
+    ssize_t length = ::read(ring->fd, buffer, sizeof(buffer));
+    if (length > 0) {
+        ring->write(buffer, length);
+    } else if (length == 0 || (errno != EAGAIN && errno != EINTR)) {
+        finish(ring, jobId);
+    }
+}
+
+void OutputCapture::finish(const shared_ptr<Ring>& ring, int jobId) {
+    close(*ring);
+    ring->finished = true;
+    finishedOrder.push_back(make_pair(jobId, ring->generation));
+
+    // Only the output of the most recently finished jobs is kept
+    while (finishedOrder.size() > CAPTURE_MAX_FINISHED) {
+        pair<int, uint32_t> oldest = finishedOrder.front();
+        finishedOrder.pop_front();
+        auto it = rings.find(oldest.first);
+        if (it != rings.end() && it->second->generation == oldest.second) {
+            rings.erase(it);
+        }
+    }
+}
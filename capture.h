@@ -0,0 +1,70 @@
+#ifndef SMASH_CAPTURE_H_
+#define SMASH_CAPTURE_H_
+
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define CAPTURE_RING_SIZE (64 * 1024)
+#define CAPTURE_MAX_FINISHED (16)
+
+// Captures the stdout and stderr of background jobs. Every captured job writes into a pipe, all
+// the pipes are watched by one epoll instance that the shell's event loop waits on, and whatever
+// arrives is copied into a fixed-size ring per job, which keeps only the most recent CAPTURE_RING_SIZE bytes.
+// The output of finished jobs is kept for the last CAPTURE_MAX_FINISHED of them.
+class OutputCapture {
+public:
+    OutputCapture();
+    ~OutputCapture();
+
+    OutputCapture(OutputCapture const &) = delete; // disable copy ctor
+    void operator=(OutputCapture const &) = delete; // disable = operator
+
+    bool isEnabled() const;
+    // Creates the epoll instance the first time capture is enabled, returns false if it could not
+    bool setEnabled(bool enabled);
+
+    // Readable when a captured pipe has data, -1 until capture is enabled
+    int getFd() const;
+    // Copies the output that is ready into the rings without blocking
+    void drain();
+
+    // Starts draining the read end of a job's output pipe, the capture takes ownership of fd
+    void attach(int jobId, int fd);
+    // Forgets the output of an earlier job with the same id
+    void discard(int jobId);
+
+    // Gets the captured output of a job, only its last numLines lines if numLines > 0
+    bool read(int jobId, size_t numLines, std::string& output);
+    // Gets the output of a job from position on and advances position, for following a job.
+    // finished is set once the job closed its output and everything was read.
+    bool readFrom(int jobId, uint64_t& position, std::string& output, bool& finished);
+
+private:
+    struct Ring {
+        int fd;
+        uint32_t generation; // tells a job apart from an earlier job with the same id
+        std::vector<char> data;
+        uint64_t written; // bytes written since the job started, data holds the last of them
+        bool finished;
+
+        // Bytes from position up to the end, or the oldest bytes still held if position was overwritten
+        std::string from(uint64_t position) const;
+        void write(const char* buffer, size_t length);
+    };
+
+    bool enabled;
+    int epollFd;
+    uint32_t nextGeneration;
+    std::map<int, std::shared_ptr<Ring>> rings; // by job id
+    std::deque<std::pair<int, uint32_t>> finishedOrder; // finished jobs, oldest first
+
+    void drainOne(uint64_t key);
+    void finish(const std::shared_ptr<Ring>& ring, int jobId);
+    void close(Ring& ring);
+};
+
+#endif //SMASH_CAPTURE_H_
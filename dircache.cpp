@@ -0,0 +1,236 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <algorithm>
+#include "dircache.h"
+#include "dirents.h"
+
+using namespace std;
+
+// Anything that adds, removes or renames an entry, or the directory itself
+#define DIRCACHE_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | \
+                         IN_ONLYDIR)
+
+static shared_ptr<const DirCache::Listing> readListing(const string& dir) {
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return nullptr;
+    }
+    shared_ptr<DirCache::Listing> listing = make_shared<DirCache::Listing>();
+    bool complete = forEachDirent(fd, [&](const char* name, unsigned char type) {
+        listing->push_back({name, type});
+        return true;
+    });
+    int savedErrno = errno;
+    close(fd);
+    if (!complete) {
+        errno = savedErrno;
+        return nullptr;
+    }
+    sort(listing->begin(), listing->end(), [](const DirCache::Entry& a, const DirCache::Entry& b) {
+        return a.name < b.name;
+    });
+    return listing;
+}
+
+DirCache::DirCache() : enabled(false), fd(-1), numEntries(0), hits(0), misses(0), invalidations(0)
+{}
+
+DirCache::~DirCache() {
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+bool DirCache::isEnabled() const {
+    return enabled;
+}
+
+bool DirCache::setEnabled(bool enabled) {
+    if (!enabled) {
+        clear();
+        if (fd != -1) {
+            close(fd);
+            fd = -1;
+        }
+        this->enabled = false;
+        return true;
+    }
+    if (fd == -1 && !open()) {
+        return false;
+    }
+    this->enabled = true;
+    return true;
+}
+
+bool DirCache::open() {
+    // What a forked child inherited belongs to the watches of its parent
+    clear();
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    return fd != -1;
+}
+
+int DirCache::getFd() const {
+    return fd;
+}
+
+void DirCache::clear() {
+    if (fd != -1) {
+        for (const auto& watch : pathsOf) {
+            inotify_rm_watch(fd, watch.first);
+        }
+    }
+    directories.clear();
+    pathsOf.clear();
+    lru.clear();
+    numEntries = 0;
+}
+
+void DirCache::drain() {
+    if (fd == -1) {
+        return;
+    }
+    alignas(struct inotify_event) char buffer[4096];
+    ssize_t length;
+    while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (char* next = buffer; next < buffer + length; ) {
+            const struct inotify_event* event = (const struct inotify_event*)next;
+            next += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Events were lost, so any directory may have changed
+                invalidations += directories.size();
+                clear();
+            } else {
+                removeWatch(event->wd);
+            }
+        }
+    }
+}
+
+void DirCache::removeWatch(int wd) {
+    auto it = pathsOf.find(wd);
+    if (it == pathsOf.end()) {
+        return;
+    }
+    vector<string> paths = it->second;
+    for (const string& path : paths) {
+        remove(path);
+        invalidations++;
+    }
+}
+
+void DirCache::remove(const string& path) {
+    auto it = directories.find(path);
+    if (it == directories.end()) {
+        return;
+    }
+    int wd = it->second.wd;
+    numEntries -= it->second.listing->size();
+    lru.erase(it->second.lru);
+    directories.erase(it);
+
+    vector<string>& paths = pathsOf[wd];
+    paths.erase(std::find(paths.begin(), paths.end(), path));
+    if (paths.empty()) {
+        pathsOf.erase(wd);
+        inotify_rm_watch(fd, wd);
+    }
+}
+
+string DirCache::absolutePath(const string& dir) {
+    string path = dir;
+    while (path.size() > 1 && path.back() == '/') {
+        path.pop_back();
+    }
+    if (path[0] == '/') {
+        return path;
+    }
+    if (cwd.empty()) {
+        char* current = getcwd(nullptr, 0);
+        if (current == nullptr) {
+            return "";
+        }
+        cwd = current;
+        free(current);
+    }
+    return (path == ".") ? cwd : cwd + "/" + path;
+}
+
+shared_ptr<const DirCache::Listing> DirCache::list(const string& dir) {
+    if (!enabled || dir.empty() || (fd == -1 && !open())) {
+        return readListing(dir);
+    }
+    drain();
+    string path = absolutePath(dir);
+    if (path.empty()) {
+        return readListing(dir);
+    }
+    auto it = directories.find(path);
+    if (it != directories.end()) {
+        hits++;
+        lru.splice(lru.begin(), lru, it->second.lru);
+        return it->second.listing;
+    }
+
+    misses++;
+    // The watch goes first, so a change made while the directory is read drops the listing
+    int wd = inotify_add_watch(fd, path.c_str(), DIRCACHE_EVENTS);
+    shared_ptr<const Listing> listing = readListing(path);
+    if (wd == -1 || listing == nullptr || listing->size() > DIRCACHE_MAX_ENTRIES) {
+        int savedErrno = errno;
+        if (wd != -1 && pathsOf.count(wd) == 0) {
+            inotify_rm_watch(fd, wd);
+        }
+        errno = savedErrno;
+        return listing;
+    }
+    lru.push_front(path);
+    directories[path] = {listing, wd, lru.begin()};
+    pathsOf[wd].push_back(path);
+    numEntries += listing->size();
+    while (numEntries > DIRCACHE_MAX_ENTRIES) {
+        string oldest = lru.back();
+        remove(oldest);
+    }
+    return listing;
+}
+
+bool DirCache::find(const string& dir, const string& name, unsigned char* type) {
+    shared_ptr<const Listing> listing = list(dir);
+    if (listing == nullptr) {
+        return false;
+    }
+    auto it = lower_bound(listing->begin(), listing->end(), name, [](const Entry& entry, const string& name) {
+        return entry.name < name;
+    });
+    if (it == listing->end() || it->name != name) {
+        return false;
+    }
+    *type = it->type;
+    return true;
+}
+
+void DirCache::changedDir() {
+    cwd.clear();
+}
+
+DirCache::Stats DirCache::getStats() const {
+    Stats stats;
+    // A child that did not use the cache yet still holds the directories of its parent
+    stats.directories = (fd != -1) ? directories.size() : 0;
+    stats.entries = (fd != -1) ? numEntries : 0;
+    stats.hits = hits;
+    stats.misses = misses;
+    stats.invalidations = invalidations;
+    return stats;
+}
+
+void DirCache::reset() {
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+    // A pending job changes directory in its child
+    cwd.clear();
+}
@@ -0,0 +1,90 @@
+#ifndef SMASH_DIRCACHE_H_
+#define SMASH_DIRCACHE_H_
+
+#include <stdint.h>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define DIRCACHE_MAX_ENTRIES (64 * 1024) // directory entries over all the cached directories
+
+// Listings of directories with the type of every entry, for listdir and for finding commands in PATH.
+// Every cached directory is watched by one inotify instance, whose events are drained by the shell's
+// event loop and before every lookup, and a directory that changed is dropped. An unchanged directory
+// costs no syscall but that drain. The least recently used directories are dropped once the cache
+// holds more than DIRCACHE_MAX_ENTRIES entries. Directories are cached by path, relative ones under the
+// cwd of the shell, so renaming a parent of a cached directory goes unnoticed.
+class DirCache {
+public:
+    struct Entry {
+        std::string name;
+        unsigned char type; // d_type, DT_UNKNOWN if the file system does not tell
+    };
+    typedef std::vector<Entry> Listing; // sorted by name, without "." and ".."
+
+    struct Stats {
+        size_t directories;
+        size_t entries;
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t invalidations;
+    };
+
+    DirCache();
+    ~DirCache();
+
+    DirCache(DirCache const &) = delete; // disable copy ctor
+    void operator=(DirCache const &) = delete; // disable = operator
+
+    bool isEnabled() const;
+    // Creates the inotify instance the first time the cache is enabled, returns false if it could not.
+    // Disabling drops everything.
+    bool setEnabled(bool enabled);
+
+    // Readable when a watched directory changed, -1 while disabled
+    int getFd() const;
+    // Drops the directories that changed, without blocking
+    void drain();
+
+    // The listing of dir, read from the directory itself when the cache is off. Returns nullptr with
+    // errno set if dir cannot be read.
+    std::shared_ptr<const Listing> list(const std::string& dir);
+    // Looks name up in the listing of dir, returns false if it is not there
+    bool find(const std::string& dir, const std::string& name, unsigned char* type);
+
+    // Called after the shell changed its cwd, relative paths mean other directories now
+    void changedDir();
+
+    Stats getStats() const;
+
+    // Drops the instance inherited by a forked child, which opens its own if it uses the cache
+    void reset();
+
+private:
+    struct Directory {
+        std::shared_ptr<const Listing> listing;
+        int wd;
+        std::list<std::string>::iterator lru;
+    };
+
+    bool enabled;
+    int fd;
+    std::string cwd; // empty until a relative path needs it
+    std::unordered_map<std::string, Directory> directories; // by absolute path
+    std::unordered_map<int, std::vector<std::string>> pathsOf; // several paths may lead to one directory
+    std::list<std::string> lru; // most recently used first
+    size_t numEntries;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t invalidations;
+
+    bool open();
+    void clear();
+    std::string absolutePath(const std::string& dir);
+    void remove(const std::string& path);
+    void removeWatch(int wd);
+};
+
+#endif //SMASH_DIRCACHE_H_
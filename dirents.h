@@ -0,0 +1,42 @@
+#ifndef SMASH_DIRENTS_H_
+#define SMASH_DIRENTS_H_
+
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define DIRENTS_BUFFER_SIZE (32768) // bytes read by one getdents64
+
+// What getdents64 fills the buffer with, glibc has no declaration of it
+struct linux_dirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Calls onEntry(name, d_type) for every entry of the open directory fd except "." and "..", reading
+// many entries per syscall instead of one readdir each. onEntry returns false to stop early.
+// Returns false with errno set if reading the directory failed.
+template<typename Callback>
+bool forEachDirent(int fd, Callback onEntry) {
+    alignas(linux_dirent64) char buffer[DIRENTS_BUFFER_SIZE];
+    long bytesRead;
+    while ((bytesRead = syscall(SYS_getdents64, fd, buffer, sizeof(buffer))) > 0) {
+        for (long i = 0; i < bytesRead; ) {
+            const struct linux_dirent64* dirent = (const struct linux_dirent64*)(&buffer[i]);
+            i += dirent->d_reclen;
+            const char* name = dirent->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            if (!onEntry(name, dirent->d_type)) {
+                return true;
+            }
+        }
+    }
+    return bytesRead == 0;
+}
+
+#endif //SMASH_DIRENTS_H_
@@ -0,0 +1,106 @@
+#include <ctype.h>
+#include <string.h>
+#include <unistd.h>
+#include "environment.h"
+
+using namespace std;
+
+Environment::Environment() : initial(environ)
+{
+    envp.push_back(nullptr);
+    for (char** entry = environ; entry != nullptr && *entry != nullptr; entry++) {
+        const char* equals = strchr(*entry, '=');
+        if (equals != nullptr) {
+            set(string(*entry, equals - *entry), equals + 1);
+        }
+    }
+    for (auto& variable : variables) {
+        variable.second.exported = false;
+    }
+}
+
+Environment::~Environment() {
+    // Whatever runs after smash is destroyed may still call getenv
+    environ = initial;
+}
+
+bool Environment::isName(const string& name) {
+    if (name.empty() || isdigit((unsigned char)name[0])) {
+        return false;
+    }
+    for (char c : name) {
+        if (!isalnum((unsigned char)c) && c != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Environment::isAssignment(const string& word) {
+    size_t equals = word.find('=');
+    return equals != string::npos && isName(word.substr(0, equals));
+}
+
+void Environment::set(const string& name, const string& value) {
+    auto it = variables.find(name);
+    if (it != variables.end()) {
+        it->second.entry = name + "=" + value;
+        it->second.exported = true;
+        envp[it->second.index] = &it->second.entry[0];
+        return;
+    }
+    Variable& variable = variables[name];
+    variable.entry = name + "=" + value;
+    variable.index = order.size();
+    variable.exported = true;
+    order.push_back(&variable);
+    envp.back() = &variable.entry[0];
+    envp.push_back(nullptr);
+    // The array may have moved
+    environ = envp.data();
+}
+
+void Environment::assign(const string& assignment) {
+    size_t equals = assignment.find('=');
+    set(assignment.substr(0, equals), assignment.substr(equals + 1));
+}
+
+bool Environment::unset(const string& name) {
+    auto it = variables.find(name);
+    if (it == variables.end()) {
+        return false;
+    }
+    size_t index = it->second.index;
+    size_t last = order.size() - 1;
+    order[index] = order[last];
+    order[index]->index = index;
+    envp[index] = envp[last];
+    order.pop_back();
+    envp.pop_back();
+    envp[last] = nullptr;
+    variables.erase(it);
+    return true;
+}
+
+const char* Environment::get(const string& name) const {
+    auto it = variables.find(name);
+    return (it != variables.end()) ? it->second.entry.c_str() + name.size() + 1 : nullptr;
+}
+
+vector<string> Environment::getExported() const {
+    vector<string> exported;
+    for (const Variable* variable : order) {
+        if (variable->exported) {
+            exported.push_back(variable->entry);
+        }
+    }
+    return exported;
+}
+
+char* const* Environment::getEnvp() const {
+    return envp.data();
+}
+
+size_t Environment::size() const {
+    return order.size();
+}
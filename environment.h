@@ -0,0 +1,55 @@
+#ifndef SMASH_ENVIRONMENT_H_
+#define SMASH_ENVIRONMENT_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The environment smash passes to the programs it runs. The variables are kept in a hash map, and the
+// envp array handed to exec is updated with every change instead of being built for every spawn: a new
+// variable is appended and a removed one takes the place of the last. environ points at the same array,
+// so getenv and execvp in smash and in its forked children see the exported variables as well.
+class Environment {
+public:
+    // Takes over the variables smash was started with
+    Environment();
+    ~Environment();
+
+    Environment(Environment const &) = delete; // disable copy ctor
+    void operator=(Environment const &) = delete; // disable = operator
+
+    // A letter or '_' followed by letters, digits and '_'
+    static bool isName(const std::string& name);
+    // NAME=value with a valid name
+    static bool isAssignment(const std::string& word);
+
+    void set(const std::string& name, const std::string& value);
+    // Sets the variable of a NAME=value word
+    void assign(const std::string& assignment);
+    // Returns false if the variable was not set
+    bool unset(const std::string& name);
+
+    // nullptr if the variable is not set
+    const char* get(const std::string& name) const;
+
+    // The NAME=value entries of the variables set in smash, not inherited unchanged
+    std::vector<std::string> getExported() const;
+
+    // The NAME=value entries followed by nullptr, valid until the next change
+    char* const* getEnvp() const;
+    size_t size() const;
+
+private:
+    struct Variable {
+        std::string entry; // NAME=value
+        size_t index;      // of the entry in envp
+        bool exported;     // set in smash
+    };
+
+    char** initial; // environ as smash got it, put back on exit
+    std::unordered_map<std::string, Variable> variables; // by name, the nodes never move
+    std::vector<Variable*> order; // order[i] is the variable envp[i] points into
+    std::vector<char*> envp;
+};
+
+#endif //SMASH_ENVIRONMENT_H_
@@ -0,0 +1,151 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "dirents.h"
+#include "expansion.h"
+
+using namespace std;
+
+bool hasWildcard(const string& word) {
+    for (size_t i = 0; i < word.length(); i++) {
+        if (word[i] == '\\') {
+            // An escaped character is never a wildcard
+            i++;
+        } else if (word[i] == '*' || word[i] == '?' || word[i] == '[') {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Removes the backslashes that escape characters of a literal word or path component
+static string unescape(const string& component) {
+    string result;
+    result.reserve(component.length());
+    for (size_t i = 0; i < component.length(); i++) {
+        if (component[i] == '\\' && i + 1 < component.length()) {
+            i++;
+        }
+        result += component[i];
+    }
+    return result;
+}
+
+// d_type is enough for most entries, only symbolic links and file systems without d_type need a stat
+static bool isDirectory(const string& dir, const char* name, unsigned char type) {
+    if (type == DT_DIR) {
+        return true;
+    }
+    if (type != DT_LNK && type != DT_UNKNOWN) {
+        return false;
+    }
+    struct stat entry_stat;
+    string path = dir + name;
+    return stat(path.c_str(), &entry_stat) == 0 && S_ISDIR(entry_stat.st_mode);
+}
+
+// Calls onEntry(name, d_type) for every entry of dir except "." and ".."
+template<typename Callback>
+static void readDirectory(const string& dir, Callback onEntry) {
+    int fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return;
+    }
+
+    forEachDirent(fd, [&](const char* name, unsigned char type) {
+        onEntry(name, type);
+        return true;
+    });
+    close(fd);
+}
+
+// Matches components[idx..] against the file system below dir (which is empty or ends with '/')
+static void expandComponents(const string& dir, const vector<string>& components, size_t idx,
+                             bool trailingSlash, vector<string>& matches) {
+    const string& component = components[idx];
+    bool last = (idx + 1 == components.size());
+
+    if (!hasWildcard(component)) {
+        string path = dir + unescape(component);
+        if (!last) {
+            expandComponents(path + "/", components, idx + 1, trailingSlash, matches);
+            return;
+        }
+        struct stat entry_stat;
+        if (trailingSlash) {
+            if (stat(path.c_str(), &entry_stat) == 0 && S_ISDIR(entry_stat.st_mode)) {
+                matches.push_back(path + "/");
+            }
+        } else if (lstat(path.c_str(), &entry_stat) == 0) {
+            matches.push_back(path);
+        }
+        return;
+    }
+
+    readDirectory(dir, [&](const char* name, unsigned char type) {
+        // FNM_PERIOD: a leading '.' is only matched by a '.' in the pattern, like in bash
+        if (fnmatch(component.c_str(), name, FNM_PERIOD) != 0) {
+            return;
+        }
+        if (last && !trailingSlash) {
+            matches.push_back(dir + name);
+        } else if (isDirectory(dir, name, type)) {
+            if (last) {
+                matches.push_back(dir + name + "/");
+            } else {
+                expandComponents(dir + name + "/", components, idx + 1, trailingSlash, matches);
+            }
+        }
+    });
+}
+
+static vector<string> expandWord(const string& word) {
+    vector<string> components;
+    size_t start = 0;
+    while (start < word.length()) {
+        size_t end = word.find('/', start);
+        if (end == string::npos) {
+            end = word.length();
+        }
+        if (end > start) {
+            components.push_back(word.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+
+    vector<string> matches;
+    if (components.empty()) {
+        return matches;
+    }
+    bool trailingSlash = word.back() == '/';
+    expandComponents(word[0] == '/' ? "/" : "", components, 0, trailingSlash, matches);
+
+    // bash sorts the matches of each word according to the collation order of the current locale
+    sort(matches.begin(), matches.end(), [](const string& a, const string& b) {
+        return strcoll(a.c_str(), b.c_str()) < 0;
+    });
+    return matches;
+}
+
+vector<string> expandWildcards(const vector<string>& words) {
+    vector<string> result;
+    result.reserve(words.size());
+    for (const auto& word : words) {
+        if (!hasWildcard(word)) {
+            result.push_back(unescape(word));
+            continue;
+        }
+        vector<string> matches = expandWord(word);
+        if (matches.empty()) {
+            // No match: the word is passed unchanged, like bash without nullglob
+            result.push_back(unescape(word));
+        } else {
+            result.insert(result.end(), matches.begin(), matches.end());
+        }
+    }
+    return result;
+}
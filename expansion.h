@@ -0,0 +1,16 @@
+#ifndef SMASH_EXPANSION_H_
+#define SMASH_EXPANSION_H_
+
+#include <string>
+#include <vector>
+
+// Returns true if the word contains an unescaped wildcard character (*, ? or [).
+bool hasWildcard(const std::string& word);
+
+// Expands the wildcards of every word in place of the word itself, keeping argument order.
+// A backslash escapes the next character, so quoted wildcards reach here as "\*".
+// Matches of a single word are sorted like bash does (strcoll); a word that matches nothing
+// is kept as-is, with its backslashes removed.
+std::vector<std::string> expandWildcards(const std::vector<std::string>& words);
+
+#endif //SMASH_EXPANSION_H_
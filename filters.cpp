@@ -0,0 +1,582 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include "filters.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SMASH_X86
+#endif
+
+using namespace std;
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+#define TAIL_TRIM_SIZE (1024 * 1024)
+
+//---------------------------------- Kernels ----------------------------------
+
+struct Kernels {
+    const char* name;
+    size_t (*countByte)(const char* data, size_t length, char c);
+    // Counts the words that start in data, inWord carries whether the previous chunk ended inside a word
+    size_t (*countWords)(const char* data, size_t length, bool* inWord);
+    // Position of the first occurrence of needle in data, or length if there is none
+    size_t (*find)(const char* data, size_t length, const string& needle);
+};
+
+static inline bool isSpace(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static size_t countByteScalar(const char* data, size_t length, char c) {
+    size_t count = 0;
+    for (size_t i = 0; i < length; i++) {
+        count += (data[i] == c);
+    }
+    return count;
+}
+
+static size_t countWordsScalar(const char* data, size_t length, bool* inWord) {
+    size_t count = 0;
+    bool word = *inWord;
+    for (size_t i = 0; i < length; i++) {
+        bool space = isSpace(data[i]);
+        count += (!space && !word);
+        word = !space;
+    }
+    *inWord = word;
+    return count;
+}
+
+static size_t findScalar(const char* data, size_t length, const string& needle) {
+    size_t size = needle.length();
+    for (size_t i = 0; i + size <= length; i++) {
+        if (data[i] == needle[0] && memcmp(data + i + 1, needle.data() + 1, size - 1) == 0) {
+            return i;
+        }
+    }
+    return length;
+}
+
+static const Kernels SCALAR_KERNELS = {"scalar", countByteScalar, countWordsScalar, findScalar};
+
+#ifdef SMASH_X86
+
+// Matches are counted in byte counters that are summed up before they can overflow
+__attribute__((target("sse2")))
+static size_t countByteSse2(const char* data, size_t length, char c) {
+    const __m128i needle = _mm_set1_epi8(c);
+    size_t count = 0;
+    size_t i = 0;
+    while (i + 16 <= length) {
+        __m128i counters = _mm_setzero_si128();
+        for (int round = 0; round < 255 && i + 16 <= length; round++, i += 16) {
+            __m128i block = _mm_loadu_si128((const __m128i*)(data + i));
+            counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(block, needle));
+        }
+        __m128i sums = _mm_sad_epu8(counters, _mm_setzero_si128());
+        count += _mm_extract_epi16(sums, 0) + _mm_extract_epi16(sums, 4);
+    }
+    return count + countByteScalar(data + i, length - i, c);
+}
+
+// Bit i is set if byte i is white space: ' ' or '\t' to '\r'
+__attribute__((target("sse2")))
+static inline uint32_t spaceMaskSse2(__m128i block) {
+    __m128i offset = _mm_sub_epi8(block, _mm_set1_epi8('\t'));
+    __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8('\r' - '\t')), offset);
+    __m128i blank = _mm_cmpeq_epi8(block, _mm_set1_epi8(' '));
+    return (uint32_t)_mm_movemask_epi8(_mm_or_si128(control, blank));
+}
+
+__attribute__((target("sse2")))
+static size_t countWordsSse2(const char* data, size_t length, bool* inWord) {
+    size_t count = 0;
+    uint32_t previousSpace = *inWord ? 0 : 1;
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        uint32_t space = spaceMaskSse2(_mm_loadu_si128((const __m128i*)(data + i)));
+        // A word starts at every byte that is not white space and follows white space
+        uint32_t starts = ~space & ((space << 1) | previousSpace) & 0xFFFF;
+        count += __builtin_popcount(starts);
+        previousSpace = (space >> 15) & 1;
+    }
+    bool word = !previousSpace;
+    count += countWordsScalar(data + i, length - i, &word);
+    *inWord = word;
+    return count;
+}
+
+// Compares the first and the last byte of the needle at 16 positions at once, and only the
+// positions where both match are compared in full
+__attribute__((target("sse2")))
+static size_t findSse2(const char* data, size_t length, const string& needle) {
+    size_t size = needle.length();
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[size - 1]);
+    size_t i = 0;
+    for (; i + size - 1 + 16 <= length; i += 16) {
+        __m128i blockFirst = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i blockLast = _mm_loadu_si128((const __m128i*)(data + i + size - 1));
+        uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(blockFirst, first),
+                                                        _mm_cmpeq_epi8(blockLast, last)));
+        while (mask != 0) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(data + i + bit + 1, needle.data() + 1, size > 2 ? size - 2 : 0) == 0) {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    size_t rest = findScalar(data + i, length - i, needle);
+    return i + rest;
+}
+
+__attribute__((target("avx2")))
+static size_t countByteAvx2(const char* data, size_t length, char c) {
+    const __m256i needle = _mm256_set1_epi8(c);
+    size_t count = 0;
+    size_t i = 0;
+    while (i + 32 <= length) {
+        __m256i counters = _mm256_setzero_si256();
+        for (int round = 0; round < 255 && i + 32 <= length; round++, i += 32) {
+            __m256i block = _mm256_loadu_si256((const __m256i*)(data + i));
+            counters = _mm256_sub_epi8(counters, _mm256_cmpeq_epi8(block, needle));
+        }
+        uint64_t sums[4];
+        _mm256_storeu_si256((__m256i*)sums, _mm256_sad_epu8(counters, _mm256_setzero_si256()));
+        count += sums[0] + sums[1] + sums[2] + sums[3];
+    }
+    return count + countByteSse2(data + i, length - i, c);
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t spaceMaskAvx2(__m256i block) {
+    __m256i offset = _mm256_sub_epi8(block, _mm256_set1_epi8('\t'));
+    __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8('\r' - '\t')), offset);
+    __m256i blank = _mm256_cmpeq_epi8(block, _mm256_set1_epi8(' '));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(control, blank));
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t countWordsAvx2(const char* data, size_t length, bool* inWord) {
+    size_t count = 0;
+    uint32_t previousSpace = *inWord ? 0 : 1;
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        uint32_t space = spaceMaskAvx2(_mm256_loadu_si256((const __m256i*)(data + i)));
+        uint32_t starts = ~space & ((space << 1) | previousSpace);
+        count += __builtin_popcount(starts);
+        previousSpace = space >> 31;
+    }
+    bool word = !previousSpace;
+    count += countWordsSse2(data + i, length - i, &word);
+    *inWord = word;
+    return count;
+}
+
+__attribute__((target("avx2")))
+static size_t findAvx2(const char* data, size_t length, const string& needle) {
+    size_t size = needle.length();
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[size - 1]);
+    size_t i = 0;
+    for (; i + size - 1 + 32 <= length; i += 32) {
+        __m256i blockFirst = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i blockLast = _mm256_loadu_si256((const __m256i*)(data + i + size - 1));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(blockFirst, first),
+                                                              _mm256_cmpeq_epi8(blockLast, last)));
+        while (mask != 0) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(data + i + bit + 1, needle.data() + 1, size > 2 ? size - 2 : 0) == 0) {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return i + findSse2(data + i, length - i, needle);
+}
+
+static const Kernels SSE2_KERNELS = {"sse2", countByteSse2, countWordsSse2, findSse2};
+static const Kernels AVX2_KERNELS = {"avx2", countByteAvx2, countWordsAvx2, findAvx2};
+
+#endif // SMASH_X86
+
+static const Kernels& kernels() {
+    static const Kernels* selected = nullptr;
+    if (selected == nullptr) {
+        selected = &SCALAR_KERNELS;
+#ifdef SMASH_X86
+        const char* forced = getenv("SMASH_SIMD");
+        string level = (forced != nullptr) ? forced : "avx2";
+        __builtin_cpu_init();
+        if (level == "avx2" && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+            selected = &AVX2_KERNELS;
+        } else if (level != "scalar" && __builtin_cpu_supports("sse2")) {
+            selected = &SSE2_KERNELS;
+        }
+#endif
+    }
+    return *selected;
+}
+
+const char* simdLevel() {
+    return kernels().name;
+}
+
+// Start of the last numLines lines of data, a final line without a newline counts as a line
+static size_t lastLinesStart(const char* data, size_t length, size_t numLines) {
+    size_t end = length;
+    if (end > 0 && data[end - 1] == '\n') {
+        end--;
+    }
+    // Whole blocks with fewer newlines than still needed are skipped by counting them
+    const size_t BLOCK = 64 * 1024;
+    while (end > 0) {
+        size_t blockStart = (end > BLOCK) ? end - BLOCK : 0;
+        size_t newlines = kernels().countByte(data + blockStart, end - blockStart, '\n');
+        if (newlines < numLines) {
+            numLines -= newlines;
+            end = blockStart;
+            continue;
+        }
+        while (true) {
+            const char* newline = (const char*)memrchr(data + blockStart, '\n', end - blockStart);
+            if (--numLines == 0) {
+                return newline - data + 1;
+            }
+            end = newline - data;
+        }
+    }
+    return 0;
+}
+
+//---------------------------------- Filters ----------------------------------
+
+TextFilter::~TextFilter()
+{}
+
+void TextFilter::write(const char* data, size_t length) {
+    if (output.size() + length > OUTPUT_BUFFER_SIZE) {
+        flush();
+    }
+    if (length > OUTPUT_BUFFER_SIZE) {
+        // Large blocks skip the buffer
+        output.assign(data, length);
+        flush();
+        return;
+    }
+    output.append(data, length);
+}
+
+void TextFilter::flush() {
+    size_t written = 0;
+    while (written < output.size()) {
+        ssize_t result = ::write(STDOUT_FILENO, output.data() + written, output.size() - written);
+        if (result == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        written += result;
+    }
+    output.clear();
+}
+
+namespace {
+
+class WcFilter : public TextFilter {
+    bool countLines;
+    bool countWords;
+    bool countBytes;
+    size_t lines;
+    size_t words;
+    size_t bytes;
+    bool inWord;
+public:
+    WcFilter(bool countLines, bool countWords, bool countBytes)
+            : countLines(countLines), countWords(countWords), countBytes(countBytes),
+              lines(0), words(0), bytes(0), inWord(false) {}
+
+    bool consume(const char* data, size_t length) override {
+        if (countLines) {
+            lines += kernels().countByte(data, length, '\n');
+        }
+        if (countWords) {
+            words += kernels().countWords(data, length, &inWord);
+        }
+        bytes += length;
+        return true;
+    }
+
+    int finish() override {
+        vector<size_t> counts;
+        if (countLines) {
+            counts.push_back(lines);
+        }
+        if (countWords) {
+            counts.push_back(words);
+        }
+        if (countBytes) {
+            counts.push_back(bytes);
+        }
+        // Like coreutils reading stdin: a single count as is, several in columns of 7
+        string line;
+        char field[32];
+        for (size_t i = 0; i < counts.size(); i++) {
+            snprintf(field, sizeof(field), (counts.size() == 1) ? "%zu" : "%7zu", counts[i]);
+            line += (i > 0) ? " " : "";
+            line += field;
+        }
+        line += '\n';
+        write(line.data(), line.length());
+        flush();
+        return 0;
+    }
+};
+
+class GrepFilter : public TextFilter {
+    string pattern;
+    bool countOnly;
+    bool invert;
+    size_t selected;
+    string pending; // a line that is not complete yet
+
+    // Selects the lines of data, which ends with a newline
+    void processLines(const char* data, size_t length) {
+        size_t position = 0;
+        while (position < length) {
+            size_t match = position + kernels().find(data + position, length - position, pattern);
+            size_t lineStart = length;
+            size_t lineEnd = length;
+            if (match < length) {
+                // The pattern has no newline, so a match lies within a single line
+                const char* newline = (const char*)memrchr(data + position, '\n', match - position);
+                lineStart = (newline != nullptr) ? newline - data + 1 : position;
+                lineEnd = (const char*)memchr(data + match, '\n', length - match) - data + 1;
+            }
+            if (invert) {
+                // Every line before the matching one is selected
+                selected += kernels().countByte(data + position, lineStart - position, '\n');
+                if (!countOnly) {
+                    write(data + position, lineStart - position);
+                }
+            } else if (match < length) {
+                selected++;
+                if (!countOnly) {
+                    write(data + lineStart, lineEnd - lineStart);
+                }
+            }
+            position = lineEnd;
+        }
+    }
+
+public:
+    GrepFilter(const string& pattern, bool countOnly, bool invert)
+            : pattern(pattern), countOnly(countOnly), invert(invert), selected(0) {}
+
+    bool consume(const char* data, size_t length) override {
+        const char* lastNewline = (const char*)memrchr(data, '\n', length);
+        if (lastNewline == nullptr) {
+            pending.append(data, length);
+            return true;
+        }
+        size_t complete = lastNewline - data + 1;
+        size_t start = 0;
+        if (!pending.empty()) {
+            // Only the line split between the chunks is put together
+            start = (const char*)memchr(data, '\n', length) - data + 1;
+            pending.append(data, start);
+            processLines(pending.data(), pending.length());
+        }
+        processLines(data + start, complete - start);
+        pending.assign(data + complete, length - complete);
+        return true;
+    }
+
+    int finish() override {
+        if (!pending.empty()) {
+            // grep ends the last line with a newline even if the input did not
+            pending += '\n';
+            processLines(pending.data(), pending.length());
+        }
+        if (countOnly) {
+            string line = to_string(selected) + "\n";
+            write(line.data(), line.length());
+        }
+        flush();
+        return (selected > 0) ? 0 : 1;
+    }
+};
+
+class HeadFilter : public TextFilter {
+    size_t remaining;
+    bool countLines;
+public:
+    HeadFilter(size_t count, bool countLines) : remaining(count), countLines(countLines) {}
+
+    bool consume(const char* data, size_t length) override {
+        size_t end = min(length, remaining);
+        if (countLines) {
+            size_t newlines = kernels().countByte(data, length, '\n');
+            if (newlines < remaining) {
+                end = length;
+                remaining -= newlines;
+            } else {
+                const char* position = data;
+                for (; remaining > 0; remaining--) {
+                    position = (const char*)memchr(position, '\n', data + length - position) + 1;
+                }
+                end = position - data;
+            }
+        } else {
+            remaining -= end;
+        }
+        write(data, end);
+        return remaining > 0;
+    }
+
+    int finish() override {
+        flush();
+        return 0;
+    }
+};
+
+class TailFilter : public TextFilter {
+    size_t count;
+    bool countLines;
+    string buffer;
+    size_t trimAt;
+
+    size_t keepFrom() const {
+        if (countLines) {
+            return lastLinesStart(buffer.data(), buffer.length(), count);
+        }
+        return (buffer.length() > count) ? buffer.length() - count : 0;
+    }
+
+public:
+    TailFilter(size_t count, bool countLines)
+            : count(count), countLines(countLines), trimAt(TAIL_TRIM_SIZE) {}
+
+    bool consume(const char* data, size_t length) override {
+        buffer.append(data, length);
+        // Only the tail is kept, trimming again once the buffer doubled keeps the work linear
+        if (buffer.length() >= trimAt) {
+            buffer.erase(0, keepFrom());
+            trimAt = max((size_t)TAIL_TRIM_SIZE, 2 * buffer.length());
+        }
+        return true;
+    }
+
+    int finish() override {
+        size_t start = (count == 0) ? buffer.length() : keepFrom();
+        write(buffer.data() + start, buffer.length() - start);
+        flush();
+        return 0;
+    }
+};
+
+bool parseCount(const string& str, size_t* count) {
+    if (str.empty() || str.length() > 18 || !all_of(str.begin(), str.end(), ::isdigit)) {
+        return false;
+    }
+    *count = strtoull(str.c_str(), nullptr, 10);
+    return true;
+}
+
+// head and tail: [-n N | -N | -c N], with 10 lines by default
+bool parseHeadTail(const vector<string>& words, size_t* count, bool* countLines) {
+    *count = 10;
+    *countLines = true;
+    for (size_t i = 1; i < words.size(); i++) {
+        const string& word = words[i];
+        if (word == "-n" || word == "-c") {
+            if (i + 1 == words.size() || !parseCount(words[i + 1], count)) {
+                return false;
+            }
+            *countLines = (word == "-n");
+            i++;
+        } else if (word.length() > 2 && (word.compare(0, 2, "-n") == 0 || word.compare(0, 2, "-c") == 0)) {
+            if (!parseCount(word.substr(2), count)) {
+                return false;
+            }
+            *countLines = (word[1] == 'n');
+        } else if (word.length() > 1 && word[0] == '-' && parseCount(word.substr(1), count)) {
+            *countLines = true;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+unique_ptr<TextFilter> createTextFilter(const vector<string>& words) {
+    const string& name = words[0];
+    if (name == "wc") {
+        bool lines = false;
+        bool wordCount = false;
+        bool bytes = false;
+        for (size_t i = 1; i < words.size(); i++) {
+            const string& word = words[i];
+            if (word.length() < 2 || word[0] != '-' || word.find_first_not_of("lwc", 1) != string::npos) {
+                return nullptr;
+            }
+            lines = lines || word.find('l') != string::npos;
+            wordCount = wordCount || word.find('w') != string::npos;
+            bytes = bytes || word.find('c') != string::npos;
+        }
+        if (!lines && !wordCount && !bytes) {
+            lines = wordCount = bytes = true;
+        }
+        return unique_ptr<TextFilter>(new WcFilter(lines, wordCount, bytes));
+    }
+
+    if (name == "grep") {
+        bool fixed = false;
+        bool countOnly = false;
+        bool invert = false;
+        vector<string> operands;
+        bool options = true;
+        for (size_t i = 1; i < words.size(); i++) {
+            const string& word = words[i];
+            if (options && word == "--") {
+                options = false;
+            } else if (options && word.length() > 1 && word[0] == '-') {
+                if (word.find_first_not_of("Fcv", 1) != string::npos) {
+                    return nullptr;
+                }
+                fixed = fixed || word.find('F') != string::npos;
+                countOnly = countOnly || word.find('c') != string::npos;
+                invert = invert || word.find('v') != string::npos;
+            } else {
+                operands.push_back(word);
+            }
+        }
+        // A pattern with a newline is a list of patterns, and file operands are left to grep
+        if (!fixed || operands.size() != 1 || operands[0].empty() || operands[0].find('\n') != string::npos) {
+            return nullptr;
+        }
+        return unique_ptr<TextFilter>(new GrepFilter(operands[0], countOnly, invert));
+    }
+
+    if (name == "head" || name == "tail") {
+        size_t count;
+        bool countLines;
+        if (!parseHeadTail(words, &count, &countLines)) {
+            return nullptr;
+        }
+        if (name == "head") {
+            return unique_ptr<TextFilter>(new HeadFilter(count, countLines));
+        }
+        return unique_ptr<TextFilter>(new TailFilter(count, countLines));
+    }
+    return nullptr;
+}
@@ -0,0 +1,37 @@
+#ifndef SMASH_FILTERS_H_
+#define SMASH_FILTERS_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Builtin versions of wc, grep -F, head and tail for the stages of a pipeline. They scan their
+// input with SSE2 or AVX2 kernels picked at runtime from the CPU's features, with a scalar fallback
+// (SMASH_SIMD=scalar|sse2|avx2 overrides the choice). Only options that behave exactly like coreutils
+// are handled; for anything else createTextFilter returns nullptr and the real program runs.
+class TextFilter {
+public:
+    virtual ~TextFilter();
+
+    // Processes the next chunk of input, returns false once the filter does not need more of it
+    virtual bool consume(const char* data, size_t length) = 0;
+
+    // Called at the end of the input, flushes the output and returns the exit status
+    virtual int finish() = 0;
+
+protected:
+    // Output goes to stdout through a buffer
+    void write(const char* data, size_t length);
+    void flush();
+
+private:
+    std::string output;
+};
+
+// words is the whole command, wc, grep, head or tail followed by its arguments
+std::unique_ptr<TextFilter> createTextFilter(const std::vector<std::string>& words);
+
+// The instruction set the kernels use: "avx2", "sse2" or "scalar"
+const char* simdLevel();
+
+#endif //SMASH_FILTERS_H_
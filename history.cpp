@@ -0,0 +1,456 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <iterator>
+#include "history.h"
+
+using namespace std;
+
+// Prefix lookups search for the entry start marker followed by the prefix
+static const char ENTRY_START = '\n';
+
+static uint32_t trigramKey(const unsigned char* s) {
+    return ((uint32_t)s[0] << 16) | ((uint32_t)s[1] << 8) | s[2];
+}
+
+static uint64_t fnv1a(const char* data, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)data[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+HistoryLog::HistoryLog() : fd(-1), mapped(nullptr), mappedSize(0), offsetsReady(false), indexedEntries(0),
+                           indexMapped(nullptr), indexSize(0), indexChecked(false), savedOffsets(nullptr),
+                           savedTrigrams(nullptr),
+                           numSavedTrigrams(0), savedGaps(nullptr), savedGapsSize(0), savedEntries(0),
+                           indexSaved(false)
+{}
+
+HistoryLog::~HistoryLog() {
+    unmapIndex();
+    if (mapped != nullptr) {
+        munmap((void*)mapped, mappedSize);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+bool HistoryLog::open(const string& path) {
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat log_stat;
+    if (fstat(fd, &log_stat) == -1) {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+
+    if (log_stat.st_size > 0) {
+        void* addr = mmap(nullptr, log_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            mapped = (const char*)addr;
+            mappedSize = log_stat.st_size;
+        }
+    }
+    indexPath = path + HISTORY_INDEX_SUFFIX;
+    mapIndex();
+    return true;
+}
+
+void HistoryLog::mapIndex() {
+    if (mapped == nullptr) {
+        return;
+    }
+    int indexFd = ::open(indexPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (indexFd == -1) {
+        return;
+    }
+    struct stat index_stat;
+    if (fstat(indexFd, &index_stat) == 0 && (size_t)index_stat.st_size >= sizeof(HistoryIndexHeader)) {
+        void* addr = mmap(nullptr, index_stat.st_size, PROT_READ, MAP_PRIVATE, indexFd, 0);
+        if (addr != MAP_FAILED) {
+            indexMapped = (const char*)addr;
+            indexSize = index_stat.st_size;
+        }
+    }
+    close(indexFd);
+}
+
+void HistoryLog::unmapIndex() {
+    if (indexMapped != nullptr) {
+        munmap((void*)indexMapped, indexSize);
+    }
+    indexMapped = nullptr;
+    savedOffsets = nullptr;
+    savedTrigrams = nullptr;
+    numSavedTrigrams = 0;
+    savedEntries = 0;
+}
+
+size_t HistoryLog::mappedEntries() {
+    buildOffsets();
+    return savedEntries + offsets.size();
+}
+
+uint64_t HistoryLog::entryStart(size_t idx) {
+    return (idx < savedEntries) ? savedOffsets[idx] : offsets[idx - savedEntries];
+}
+
+size_t HistoryLog::completeEntries() {
+    size_t entries = mappedEntries();
+    // The last mapped entry may still be written by another smash
+    bool lastComplete = mappedSize == 0 || mapped[mappedSize - 1] == '\n';
+    return (lastComplete || entries == 0) ? entries : entries - 1;
+}
+
+size_t HistoryLog::entriesEnd(size_t entries) {
+    return (entries < mappedEntries()) ? entryStart(entries) : mappedSize;
+}
+
+void HistoryLog::checkIndex() {
+    if (indexChecked) {
+        return;
+    }
+    indexChecked = true;
+    if (indexMapped == nullptr) {
+        return;
+    }
+    // An index that does not end at an entry of this log, with the same bytes before it, is left alone
+    const HistoryIndexHeader* header = (const HistoryIndexHeader*)indexMapped;
+    size_t rest = indexSize - sizeof(HistoryIndexHeader);
+    bool valid = header->magic == HISTORY_INDEX_MAGIC && header->version == HISTORY_INDEX_VERSION &&
+                 header->entries > 0 && header->entries <= rest / sizeof(uint64_t) &&
+                 header->numTrigrams <= (rest - header->entries * sizeof(uint64_t)) / sizeof(HistoryIndexTrigram) &&
+                 header->logSize > 0 && header->logSize <= mappedSize && mapped[header->logSize - 1] == '\n';
+    if (valid) {
+        size_t checked = min((size_t)header->logSize, (size_t)HISTORY_INDEX_CHECK_BYTES);
+        valid = fnv1a(mapped + header->logSize - checked, checked) == header->checksum;
+    }
+    const uint64_t* entryOffsets = (const uint64_t*)(indexMapped + sizeof(HistoryIndexHeader));
+    if (!valid || entryOffsets[0] != 0 || entryOffsets[header->entries - 1] >= header->logSize) {
+        unmapIndex();
+        return;
+    }
+    savedOffsets = entryOffsets;
+    savedTrigrams = (const HistoryIndexTrigram*)(savedOffsets + header->entries);
+    numSavedTrigrams = header->numTrigrams;
+    savedGaps = (const uint8_t*)(savedTrigrams + numSavedTrigrams);
+    savedGapsSize = indexSize - ((const char*)savedGaps - indexMapped);
+    savedEntries = header->entries;
+    indexedEntries = savedEntries;
+}
+
+const HistoryIndexTrigram* HistoryLog::findSaved(uint32_t key) {
+    const HistoryIndexTrigram* end = savedTrigrams + numSavedTrigrams;
+    const HistoryIndexTrigram* it = lower_bound(savedTrigrams, end, key,
+                                                [](const HistoryIndexTrigram& trigram, uint32_t key) {
+        return trigram.key < key;
+    });
+    if (it == end || it->key != key || it->offset > savedGapsSize || it->length > savedGapsSize - it->offset) {
+        return nullptr;
+    }
+    return it;
+}
+
+void HistoryLog::saveIndex() {
+    // Only complete entries of the mapped log are saved, the ones appended since have indices of this
+    // session only, other shells may have written lines before them
+    size_t entries = min(indexedEntries, completeEntries());
+    if (indexSaved || entries < savedEntries + HISTORY_INDEX_MIN_NEW) {
+        return;
+    }
+    indexSaved = true;
+    vector<uint32_t> keys;
+    keys.reserve(trigrams.size());
+    for (const auto& trigram : trigrams) {
+        keys.push_back(trigram.first);
+    }
+    sort(keys.begin(), keys.end());
+
+    // The lists of the file go on with the entries indexed in memory
+    vector<HistoryIndexTrigram> table;
+    vector<uint8_t> gaps;
+    vector<size_t> added;
+    size_t i = 0, j = 0;
+    while (i < numSavedTrigrams || j < keys.size()) {
+        uint32_t key = (j == keys.size() || (i < numSavedTrigrams && savedTrigrams[i].key <= keys[j]))
+                       ? savedTrigrams[i].key : keys[j];
+        HistoryIndexTrigram trigram = {key, 0, gaps.size(), 0, 0, 0};
+        if (i < numSavedTrigrams && savedTrigrams[i].key == key) {
+            const HistoryIndexTrigram& saved = savedTrigrams[i++];
+            if (saved.offset <= savedGapsSize && saved.length <= savedGapsSize - saved.offset) {
+                gaps.insert(gaps.end(), savedGaps + saved.offset, savedGaps + saved.offset + saved.length);
+                trigram.count = saved.count;
+                trigram.last = saved.last;
+            }
+        }
+        if (j < keys.size() && keys[j] == key) {
+            const PostingList& list = trigrams[keys[j++]];
+            added.clear();
+            decodeGaps(list.gaps.data(), list.gaps.size(), added);
+            for (size_t entry : added) {
+                if (entry >= entries) {
+                    break;
+                }
+                encodeGap(gaps, entry - (trigram.count > 0 ? trigram.last : 0));
+                trigram.last = entry;
+                trigram.count++;
+            }
+        }
+        trigram.length = gaps.size() - trigram.offset;
+        if (trigram.count > 0) {
+            table.push_back(trigram);
+        }
+    }
+
+    HistoryIndexHeader header;
+    header.magic = HISTORY_INDEX_MAGIC;
+    header.version = HISTORY_INDEX_VERSION;
+    header.logSize = entriesEnd(entries);
+    header.entries = entries;
+    size_t checked = min((size_t)header.logSize, (size_t)HISTORY_INDEX_CHECK_BYTES);
+    header.checksum = fnv1a(mapped + header.logSize - checked, checked);
+    header.numTrigrams = table.size();
+
+    // Written aside and renamed over the index, so no smash maps half of one
+    string temp = indexPath + ".tmp." + to_string(getpid());
+    int indexFd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (indexFd == -1) {
+        return;
+    }
+    size_t fromFile = min(entries, savedEntries);
+    const pair<const void*, size_t> parts[] = {
+            {&header, sizeof(header)},
+            {savedOffsets, fromFile * sizeof(uint64_t)},
+            {offsets.data(), (entries - fromFile) * sizeof(uint64_t)},
+            {table.data(), table.size() * sizeof(HistoryIndexTrigram)},
+            {gaps.data(), gaps.size()}
+    };
+    bool written = true;
+    for (const auto& part : parts) {
+        size_t done = 0;
+        while (written && done < part.second) {
+            ssize_t length = write(indexFd, (const char*)part.first + done, part.second - done);
+            written = length > 0;
+            done += written ? length : 0;
+        }
+    }
+    if (close(indexFd) == -1 || !written || rename(temp.c_str(), indexPath.c_str()) == -1) {
+        unlink(temp.c_str());
+    }
+}
+
+bool HistoryLog::isOpen() const {
+    return fd != -1;
+}
+
+void HistoryLog::append(const string& line) {
+    if (fd == -1) {
+        return;
+    }
+
+    string record = line + '\n';
+    if (write(fd, record.data(), record.length()) == -1) {
+        perror("smash error: write failed");
+    }
+    appended.push_back(line);
+}
+
+void HistoryLog::buildOffsets() {
+    if (offsetsReady) {
+        return;
+    }
+    offsetsReady = true;
+
+    // Only the entries after the index file are looked for
+    checkIndex();
+    size_t pos = (savedEntries > 0) ? ((const HistoryIndexHeader*)indexMapped)->logSize : 0;
+    while (pos < mappedSize) {
+        offsets.push_back(pos);
+        const void* end = memchr(mapped + pos, '\n', mappedSize - pos);
+        if (end == nullptr) {
+            break;
+        }
+        pos = (const char*)end - mapped + 1;
+    }
+}
+
+size_t HistoryLog::size() {
+    buildOffsets();
+    return mappedEntries() + appended.size();
+}
+
+void HistoryLog::getView(size_t idx, const char** data, size_t* length) {
+    size_t entries = mappedEntries();
+    if (idx >= entries) {
+        const string& entry = appended[idx - entries];
+        *data = entry.data();
+        *length = entry.length();
+        return;
+    }
+
+    size_t start = entryStart(idx);
+    size_t end = (idx + 1 < entries) ? entryStart(idx + 1) - 1 : mappedSize;
+    if (start > mappedSize || end > mappedSize || end < start) {
+        // Offsets of a damaged index file
+        start = end = 0;
+    }
+    if (end > start && mapped[end - 1] == '\n') {
+        // The last mapped entry still has its newline
+        end--;
+    }
+    *data = mapped + start;
+    *length = end - start;
+}
+
+string HistoryLog::getEntry(size_t idx) {
+    buildOffsets();
+    const char* data;
+    size_t length;
+    getView(idx, &data, &length);
+    return string(data, length);
+}
+
+void HistoryLog::encodeGap(vector<uint8_t>& gaps, size_t gap) {
+    while (gap >= 0x80) {
+        gaps.push_back((uint8_t)(gap | 0x80));
+        gap >>= 7;
+    }
+    gaps.push_back((uint8_t)gap);
+}
+
+void HistoryLog::updateIndex() {
+    size_t total = size();
+    string entry;
+    for (; indexedEntries < total; indexedEntries++) {
+        const char* data;
+        size_t length;
+        getView(indexedEntries, &data, &length);
+
+        entry.assign(1, ENTRY_START);
+        entry.append(data, length);
+        const unsigned char* s = (const unsigned char*)entry.data();
+        for (size_t i = 0; i + 3 <= entry.length(); i++) {
+            PostingList& list = trigrams[trigramKey(s + i)];
+            if (list.count > 0 && list.last == indexedEntries) {
+                // The trigram appears more than once in this entry
+                continue;
+            }
+            encodeGap(list.gaps, indexedEntries - (list.count > 0 ? list.last : 0));
+            list.last = indexedEntries;
+            list.count++;
+        }
+    }
+}
+
+void HistoryLog::decodeGaps(const uint8_t* gaps, size_t length, vector<size_t>& entries) {
+    size_t current = 0;
+    size_t i = 0;
+    while (i < length) {
+        size_t gap = 0;
+        int shift = 0;
+        while (i < length && (gaps[i] & 0x80)) {
+            gap |= (size_t)(gaps[i++] & 0x7f) << shift;
+            shift += 7;
+        }
+        if (i == length) {
+            break;
+        }
+        gap |= (size_t)gaps[i++] << shift;
+        current += gap;
+        entries.push_back(current);
+    }
+}
+
+vector<size_t> HistoryLog::decode(const Postings& postings) {
+    // The entries of the file all come before the ones indexed in memory
+    vector<size_t> entries;
+    entries.reserve(postings.count);
+    if (postings.saved != nullptr) {
+        decodeGaps(savedGaps + postings.saved->offset, postings.saved->length, entries);
+    }
+    if (postings.added != nullptr) {
+        decodeGaps(postings.added->gaps.data(), postings.added->gaps.size(), entries);
+    }
+    return entries;
+}
+
+bool HistoryLog::matches(size_t idx, const string& pattern, bool prefix) {
+    const char* data;
+    size_t length;
+    getView(idx, &data, &length);
+    if (prefix) {
+        return length >= pattern.length() && memcmp(data, pattern.data(), pattern.length()) == 0;
+    }
+    return pattern.empty() || memmem(data, length, pattern.data(), pattern.length()) != nullptr;
+}
+
+vector<size_t> HistoryLog::search(const string& pattern, bool prefix) {
+    vector<size_t> result;
+    size_t total = size();
+    string needle = prefix ? ENTRY_START + pattern : pattern;
+
+    if (needle.length() < 3) {
+        // Too short for the index, scan every entry
+        for (size_t idx = 0; idx < total; idx++) {
+            if (matches(idx, pattern, prefix)) {
+                result.push_back(idx);
+            }
+        }
+        return result;
+    }
+
+    updateIndex();
+    saveIndex();
+    vector<uint32_t> keys;
+    const unsigned char* s = (const unsigned char*)needle.data();
+    for (size_t i = 0; i + 3 <= needle.length(); i++) {
+        keys.push_back(trigramKey(s + i));
+    }
+    sort(keys.begin(), keys.end());
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+    vector<Postings> lists;
+    for (uint32_t key : keys) {
+        Postings postings = {findSaved(key), nullptr, 0};
+        auto it = trigrams.find(key);
+        if (it != trigrams.end()) {
+            postings.added = &it->second;
+        }
+        if (postings.saved == nullptr && postings.added == nullptr) {
+            // Some trigram of the pattern never appears in the history
+            return result;
+        }
+        postings.count = ((postings.saved != nullptr) ? postings.saved->count : 0) +
+                         ((postings.added != nullptr) ? postings.added->count : 0);
+        lists.push_back(postings);
+    }
+
+    // Intersect the shortest lists only, the remaining candidates are verified against the entry anyway
+    sort(lists.begin(), lists.end(), [](const Postings& a, const Postings& b) {
+        return a.count < b.count;
+    });
+    vector<size_t> candidates = decode(lists[0]);
+    for (size_t i = 1; i < lists.size() && i < 4 && !candidates.empty(); i++) {
+        vector<size_t> other = decode(lists[i]);
+        vector<size_t> common;
+        set_intersection(candidates.begin(), candidates.end(), other.begin(), other.end(), back_inserter(common));
+        candidates.swap(common);
+    }
+
+    for (size_t idx : candidates) {
+        if (matches(idx, pattern, prefix)) {
+            result.push_back(idx);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,114 @@
+#ifndef SMASH_HISTORY_H_
+#define SMASH_HISTORY_H_
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define HISTORY_INDEX_MAGIC (0x49484d53) // "SMHI"
+#define HISTORY_INDEX_VERSION (1)
+#define HISTORY_INDEX_SUFFIX ".idx"
+#define HISTORY_INDEX_MIN_NEW (4096)      // entries indexed in memory before a search rewrites the index file
+#define HISTORY_INDEX_CHECK_BYTES (256)   // of the log before the end of the index, checksummed
+
+// The trigram index of a log, saved as <log>.idx and mapped as it is: the header, the offset of every
+// entry covered, the table of the trigrams sorted by key, then the posting lists the table points into.
+struct HistoryIndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t logSize;  // bytes of the log the index covers, up to the end of an entry
+    uint64_t entries;  // entries covered
+    uint64_t checksum; // FNV-1a of the last covered bytes, to tell a log that was replaced
+    uint64_t numTrigrams;
+};
+
+struct HistoryIndexTrigram {
+    uint32_t key;
+    uint32_t reserved;
+    uint64_t offset; // of the posting list, from the end of the table
+    uint64_t length;
+    uint64_t count;
+    uint64_t last;   // the last entry of the list
+};
+
+// Persistent command history: an append-only log file with one command per line.
+// The log is memory-mapped when opened, so opening a history of millions of entries costs a
+// single mmap. Its entry offsets and trigram index are mapped from <log>.idx as well; only the
+// entries after the index are scanned and indexed in memory, and a search saves them to the
+// file once there are HISTORY_INDEX_MIN_NEW of them, so no session scans the whole log again.
+class HistoryLog {
+public:
+    HistoryLog();
+    ~HistoryLog();
+
+    HistoryLog(HistoryLog const &) = delete; // disable copy ctor
+    void operator=(HistoryLog const &) = delete; // disable = operator
+
+    bool open(const std::string& path);
+    bool isOpen() const;
+
+    // Writes the line to the end of the log with a single O_APPEND write
+    void append(const std::string& line);
+
+    size_t size();
+    std::string getEntry(size_t idx);
+
+    // Returns the indices of the entries containing pattern (or starting with it if prefix is set),
+    // in ascending order. Patterns of 3 or more characters are answered from a trigram index.
+    std::vector<size_t> search(const std::string& pattern, bool prefix);
+
+private:
+    // Entry indices of one trigram, stored as varint-encoded gaps
+    struct PostingList {
+        std::vector<uint8_t> gaps;
+        size_t last;
+        size_t count;
+    };
+
+    // The trigrams of one entry of a search, from the index file and from memory
+    struct Postings {
+        const HistoryIndexTrigram* saved;
+        const PostingList* added;
+        size_t count;
+    };
+
+    int fd;
+    const char* mapped;
+    size_t mappedSize;
+    std::vector<uint64_t> offsets; // start of every mapped entry after the index file, filled on first use
+    bool offsetsReady;
+    std::vector<std::string> appended; // entries added since the log was mapped
+    std::unordered_map<uint32_t, PostingList> trigrams;
+    size_t indexedEntries; // entries [0, indexedEntries) are in the trigram index
+    std::string indexPath;
+    const char* indexMapped; // the index file, nullptr if there is none or it does not fit the log
+    size_t indexSize;
+    bool indexChecked;
+    const uint64_t* savedOffsets;
+    const HistoryIndexTrigram* savedTrigrams;
+    size_t numSavedTrigrams;
+    const uint8_t* savedGaps;
+    size_t savedGapsSize;
+    size_t savedEntries; // entries [0, savedEntries) are in the index file, the rest in trigrams
+    bool indexSaved; // the mapped log only grows in other sessions, so it is saved once at most
+
+    void buildOffsets();
+    size_t mappedEntries();
+    uint64_t entryStart(size_t idx);
+    size_t completeEntries();
+    size_t entriesEnd(size_t entries);
+    void mapIndex();
+    void unmapIndex();
+    void checkIndex();
+    void saveIndex();
+    const HistoryIndexTrigram* findSaved(uint32_t key);
+    void updateIndex();
+    void getView(size_t idx, const char** data, size_t* length);
+    bool matches(size_t idx, const std::string& pattern, bool prefix);
+    std::vector<size_t> decode(const Postings& postings);
+    static void decodeGaps(const uint8_t* gaps, size_t length, std::vector<size_t>& entries);
+    static void encodeGap(std::vector<uint8_t>& gaps, size_t gap);
+};
+
+#endif //SMASH_HISTORY_H_
@@ -0,0 +1,115 @@
+#include <functional>
+#include <utility>
+#include "intern.h"
+
+using namespace std;
+
+InternedString::InternedString(const InternedString& other) : entry(other.entry)
+{
+    if (entry != nullptr) {
+        entry->refs++;
+    }
+}
+
+InternedString::InternedString(InternedString&& other) noexcept : entry(other.entry)
+{
+    other.entry = nullptr;
+}
+
+InternedString& InternedString::operator=(InternedString other) noexcept {
+    swap(entry, other.entry);
+    return *this;
+}
+
+InternedString::~InternedString() {
+    if (entry == nullptr || --entry->refs > 0) {
+        return;
+    }
+    if (entry->pool != nullptr) {
+        entry->pool->release(entry);
+    }
+    delete entry;
+}
+
+const string& InternedString::str() const {
+    static const string empty;
+    return (entry != nullptr) ? entry->text : empty;
+}
+
+StringPool::StringPool() : slots(INTERN_MIN_CAPACITY, nullptr), count(0)
+{}
+
+StringPool::~StringPool() {
+    // A string still referenced is freed by its last reference
+    for (Entry* entry : slots) {
+        if (entry != nullptr) {
+            entry->pool = nullptr;
+        }
+    }
+}
+
+InternedString StringPool::intern(const string& text) {
+    size_t hash = std::hash<string>()(text);
+    size_t mask = slots.size() - 1;
+    size_t i = hash & mask;
+    for (; slots[i] != nullptr; i = (i + 1) & mask) {
+        if (slots[i]->hash == hash && slots[i]->text == text) {
+            slots[i]->refs++;
+            return InternedString(slots[i]);
+        }
+    }
+    Entry* entry = new Entry{text, hash, 1, this};
+    // At most half full, so a probe ends soon at a free slot
+    if (2 * (count + 1) > slots.size()) {
+        grow();
+        mask = slots.size() - 1;
+        for (i = hash & mask; slots[i] != nullptr; i = (i + 1) & mask) {
+        }
+    }
+    slots[i] = entry;
+    count++;
+    return InternedString(entry);
+}
+
+size_t StringPool::size() const {
+    return count;
+}
+
+void StringPool::release(Entry* entry) {
+    size_t mask = slots.size() - 1;
+    size_t i = entry->hash & mask;
+    while (slots[i] != entry) {
+        i = (i + 1) & mask;
+    }
+    // Backward shift: the entries after the hole that probed past it move up, so no probe stops early
+    size_t j = i;
+    while (true) {
+        j = (j + 1) & mask;
+        if (slots[j] == nullptr) {
+            break;
+        }
+        size_t home = slots[j]->hash & mask;
+        bool movable = (i <= j) ? (home <= i || home > j) : (home <= i && home > j);
+        if (movable) {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+    slots[i] = nullptr;
+    count--;
+}
+
+void StringPool::grow() {
+    vector<Entry*> old(2 * slots.size(), nullptr);
+    old.swap(slots);
+    size_t mask = slots.size() - 1;
+    for (Entry* entry : old) {
+        if (entry != nullptr) {
+            size_t i = entry->hash & mask;
+            while (slots[i] != nullptr) {
+                i = (i + 1) & mask;
+            }
+            slots[i] = entry;
+        }
+    }
+}
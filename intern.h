@@ -0,0 +1,66 @@
+#ifndef SMASH_INTERN_H_
+#define SMASH_INTERN_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#define INTERN_MIN_CAPACITY (64) // slots of an empty pool, always a power of 2
+
+class StringPool;
+
+// A counted reference to a string of a StringPool, a single pointer. Copies share the string.
+class InternedString {
+public:
+    InternedString() : entry(nullptr) {}
+    InternedString(const InternedString& other);
+    InternedString(InternedString&& other) noexcept;
+    InternedString& operator=(InternedString other) noexcept;
+    ~InternedString();
+
+    // The empty string for a default constructed one
+    const std::string& str() const;
+
+private:
+    friend class StringPool;
+    struct Entry {
+        std::string text;
+        size_t hash;
+        size_t refs;
+        StringPool* pool; // nullptr once the pool is gone
+    };
+
+    explicit InternedString(Entry* entry) : entry(entry) {}
+
+    Entry* entry;
+};
+
+// Strings stored once however many holders they have, for the command lines and directories of the
+// jobs: farms launch thousands of jobs with the same line. Every string lives in one entry with its
+// hash and reference count, found through an open-addressing table with linear probing, and leaves
+// the table with its last reference. Not thread safe, the jobs list is only used by the shell itself.
+class StringPool {
+public:
+    StringPool();
+    ~StringPool();
+
+    StringPool(StringPool const &) = delete; // disable copy ctor
+    void operator=(StringPool const &) = delete; // disable = operator
+
+    InternedString intern(const std::string& text);
+
+    // The distinct strings held
+    size_t size() const;
+
+private:
+    friend class InternedString;
+    typedef InternedString::Entry Entry;
+
+    void release(Entry* entry);
+    void grow();
+
+    std::vector<Entry*> slots; // nullptr for a free slot
+    size_t count;
+};
+
+#endif //SMASH_INTERN_H_
@@ -0,0 +1,161 @@
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <new>
+#include "jobtable.h"
+
+using namespace std;
+
+JobTable::JobTable() : table(nullptr), owner(-1)
+{}
+
+JobTable::~JobTable() {
+    if (table != nullptr && owner == getpid()) {
+        shm_unlink(name.c_str());
+    }
+    reset();
+}
+
+bool JobTable::open() {
+    name = JOB_TABLE_NAME_PREFIX + to_string(getpid());
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        return false;
+    }
+    // Truncating first clears what a dead shell with the same pid may have left
+    if (ftruncate(fd, 0) == -1 || ftruncate(fd, sizeof(SharedJobTable)) == -1) {
+        close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+    void* memory = mmap(nullptr, sizeof(SharedJobTable), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        return false;
+    }
+    // The segment is zero-filled, which is also the initial state of the sequence
+    table = new (memory) SharedJobTable;
+    table->slots = JOB_TABLE_SLOTS;
+    table->recordSize = sizeof(SharedJob);
+    table->shellPid = getpid();
+    table->version = JOB_TABLE_VERSION;
+    for (int slot = JOB_TABLE_SLOTS - 1; slot >= 0; slot--) {
+        freeSlots.push_back(slot);
+    }
+    owner = getpid();
+    // Readers take the table for valid once the magic is there
+    atomic_thread_fence(memory_order_release);
+    table->magic = JOB_TABLE_MAGIC;
+    return true;
+}
+
+void JobTable::beginWrite() {
+    table->sequence.store(table->sequence.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+void JobTable::endWrite() {
+    table->sequence.store(table->sequence.load(memory_order_relaxed) + 1, memory_order_release);
+}
+
+void JobTable::clearSlot(int slot) {
+    SharedJob& job = table->jobs[slot];
+    auto it = slotOf.find(job.pid);
+    if (it != slotOf.end() && it->second == slot) {
+        slotOf.erase(it);
+    }
+    job.state = SHARED_JOB_EMPTY;
+    table->count--;
+}
+
+void JobTable::add(int jobId, pid_t pid, const string& command) {
+    if (table == nullptr) {
+        return;
+    }
+    beginWrite();
+    int slot = -1;
+    if (!freeSlots.empty()) {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    } else if (!doneSlots.empty()) {
+        // The oldest finished job makes room
+        slot = doneSlots.front();
+        doneSlots.pop_front();
+        clearSlot(slot);
+    }
+    if (slot == -1) {
+        unlistedPids.insert(pid);
+        table->unlisted = unlistedPids.size();
+    } else {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        SharedJob& job = table->jobs[slot];
+        job.jobId = jobId;
+        job.pid = pid;
+        job.exitCode = 0;
+        job.startTime = now.tv_sec * 1000000000LL + now.tv_nsec;
+        size_t length = min(command.size(), (size_t)JOB_TABLE_COMMAND_SIZE - 1);
+        memcpy(job.command, command.data(), length);
+        job.command[length] = '\0';
+        job.state = SHARED_JOB_RUNNING;
+        table->count++;
+        slotOf[pid] = slot;
+    }
+    endWrite();
+}
+
+void JobTable::finish(pid_t pid, int exitCode) {
+    if (table == nullptr) {
+        return;
+    }
+    auto it = slotOf.find(pid);
+    if (it == slotOf.end()) {
+        forgetUnlisted(pid);
+        return;
+    }
+    int slot = it->second;
+    // The pid may be reused by a later job, so a finished job is no longer found by it
+    slotOf.erase(it);
+    beginWrite();
+    table->jobs[slot].exitCode = exitCode;
+    table->jobs[slot].state = SHARED_JOB_DONE;
+    endWrite();
+    doneSlots.push_back(slot);
+}
+
+void JobTable::remove(pid_t pid) {
+    if (table == nullptr) {
+        return;
+    }
+    auto it = slotOf.find(pid);
+    if (it == slotOf.end()) {
+        forgetUnlisted(pid);
+        return;
+    }
+    int slot = it->second;
+    beginWrite();
+    clearSlot(slot);
+    endWrite();
+    freeSlots.push_back(slot);
+}
+
+void JobTable::forgetUnlisted(pid_t pid) {
+    if (unlistedPids.erase(pid) > 0) {
+        beginWrite();
+        table->unlisted = unlistedPids.size();
+        endWrite();
+    }
+}
+
+void JobTable::reset() {
+    if (table != nullptr) {
+        munmap(table, sizeof(SharedJobTable));
+        table = nullptr;
+    }
+    slotOf.clear();
+    unlistedPids.clear();
+    freeSlots.clear();
+    doneSlots.clear();
+}
@@ -0,0 +1,106 @@
+#ifndef SMASH_JOBTABLE_H_
+#define SMASH_JOBTABLE_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <atomic>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#define JOB_TABLE_MAGIC (0x544a4d53) // "SMJT"
+#define JOB_TABLE_VERSION (1)
+#define JOB_TABLE_SLOTS (1024)
+#define JOB_TABLE_COMMAND_SIZE (232)
+#define JOB_TABLE_NAME_PREFIX "/smash-jobs-"
+
+// The jobs of a smash published in the shared-memory segment /smash-jobs-<pid> for monitoring tools.
+// The layout is fixed and versioned, readers check magic, version and recordSize before anything else.
+// Finished jobs stay listed with their exit code until their slot is needed again.
+enum SharedJobState : int32_t {
+    SHARED_JOB_EMPTY = 0,
+    SHARED_JOB_RUNNING = 1,
+    SHARED_JOB_DONE = 2,
+};
+
+struct SharedJob {
+    int32_t jobId;
+    int32_t pid;
+    int32_t state;     // a SharedJobState
+    int32_t exitCode;  // for SHARED_JOB_DONE, 128 + the signal for a job killed by a signal
+    int64_t startTime; // CLOCK_REALTIME, ns
+    char command[JOB_TABLE_COMMAND_SIZE]; // truncated, always null-terminated
+};
+
+struct SharedJobTable {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t recordSize;
+    int32_t shellPid;
+    // Seqlock: odd while smash updates the table. A reader copies the table and keeps the copy if the
+    // sequence was even and unchanged around it.
+    std::atomic<uint32_t> sequence;
+    uint32_t count;    // slots that are not SHARED_JOB_EMPTY
+    uint32_t unlisted; // running jobs left out because every slot held a running job
+    SharedJob jobs[JOB_TABLE_SLOTS];
+};
+
+// Takes a consistent copy of the table without any syscall, retrying while smash is writing.
+// Returns the number of retries.
+inline unsigned readJobTable(const SharedJobTable* table, SharedJobTable* copy) {
+    unsigned retries = 0;
+    while (true) {
+        uint32_t before = table->sequence.load(std::memory_order_acquire);
+        if ((before & 1) == 0) {
+            copy->count = table->count;
+            copy->unlisted = table->unlisted;
+            memcpy(copy->jobs, table->jobs, sizeof(table->jobs));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (table->sequence.load(std::memory_order_relaxed) == before) {
+                return retries;
+            }
+        }
+        retries++;
+    }
+}
+
+// Publishing side, owned by the shell
+class JobTable {
+public:
+    JobTable();
+    ~JobTable();
+
+    JobTable(JobTable const &) = delete; // disable copy ctor
+    void operator=(JobTable const &) = delete; // disable = operator
+
+    // Creates the segment, returns false if shared memory is not available
+    bool open();
+
+    void add(int jobId, pid_t pid, const std::string& command);
+    void finish(pid_t pid, int exitCode);
+    // For a job that left the list without finishing, such as one brought to the foreground
+    void remove(pid_t pid);
+
+    // Drops the segment inherited by a forked child, it belongs to the shell
+    void reset();
+
+private:
+    SharedJobTable* table;
+    pid_t owner;
+    std::string name;
+    std::unordered_map<pid_t, int> slotOf; // listed jobs by pid
+    std::unordered_set<pid_t> unlistedPids;
+    std::vector<int> freeSlots;
+    std::deque<int> doneSlots; // finished jobs, oldest first, reused once no slot is free
+
+    void beginWrite();
+    void endWrite();
+    void clearSlot(int slot);
+    void forgetUnlisted(pid_t pid);
+};
+
+#endif //SMASH_JOBTABLE_H_
@@ -0,0 +1,406 @@
+#include <string.h>
+#include <set>
+#include "parser.h"
+
+using namespace std;
+
+namespace {
+
+enum TokenType {
+    WORD,
+    PIPE,         // |
+    PIPE_STDERR,  // |&
+    AND,          // &&
+    OR,           // ||
+    AMPERSAND,    // &
+    SEMICOLON,    // ;
+    REDIRECT_OUT, // >
+    APPEND_OUT,   // >>
+    END
+};
+
+struct Token {
+    TokenType type;
+    string literal;  // WORD: the word after quote removal
+    string pattern;  // WORD: the word with quoted wildcard characters escaped
+    bool quoted;     // WORD: some part of the word was quoted
+    size_t start;
+    size_t end;
+};
+
+const char* const WHITESPACE = " \n\r\t\f\v";
+
+bool isOperatorChar(char c) {
+    return c == '|' || c == '&' || c == ';' || c == '>';
+}
+
+// Appends a quoted character to the word, escaping it in the pattern if it is special to wildcard expansion
+void addQuoted(Token& token, char c) {
+    token.literal += c;
+    if (c == '*' || c == '?' || c == '[' || c == '\\') {
+        token.pattern += '\\';
+    }
+    token.pattern += c;
+}
+
+class Parser {
+public:
+    Parser(const string& src, const unordered_map<string, string>& aliases, set<string>& expanding)
+            : src(src), aliases(aliases), expanding(expanding), pos(0), hasPeeked(false) {}
+
+    shared_ptr<CommandNode> parseList();
+
+    const string& getError() const {
+        return error;
+    }
+
+private:
+    const string& src;
+    const unordered_map<string, string>& aliases;
+    set<string>& expanding; // aliases being expanded, an alias is not expanded again inside itself
+    size_t pos;
+    Token peeked;
+    bool hasPeeked;
+    string error;
+
+    bool lex(Token& token);
+    const Token* peek();
+    void consume();
+    bool fail(const string& message);
+    bool failUnexpected(const Token& token);
+
+    shared_ptr<CommandNode> parsePipeline();
+    shared_ptr<CommandNode> parseCommand();
+    shared_ptr<CommandNode> expandAlias(const string& value, const string& name, size_t restStart, size_t restEnd);
+};
+
+bool Parser::fail(const string& message) {
+    if (error.empty()) {
+        error = message;
+    }
+    return false;
+}
+
+bool Parser::failUnexpected(const Token& token) {
+    if (token.type == END) {
+        return fail("syntax error: unexpected end of line");
+    }
+    return fail("syntax error near unexpected token `" + src.substr(token.start, token.end - token.start) + "'");
+}
+
+bool Parser::lex(Token& token) {
+    pos = src.find_first_not_of(WHITESPACE, pos);
+    if (pos == string::npos) {
+        pos = src.length();
+    }
+
+    token.literal.clear();
+    token.pattern.clear();
+    token.quoted = false;
+    token.start = pos;
+
+    if (pos == src.length()) {
+        token.type = END;
+        token.end = pos;
+        return true;
+    }
+
+    char c = src[pos];
+    char next = (pos + 1 < src.length()) ? src[pos + 1] : '\0';
+    if (isOperatorChar(c)) {
+        size_t length = 1;
+        if (c == '|') {
+            token.type = (next == '|') ? OR : (next == '&') ? PIPE_STDERR : PIPE;
+            length = (token.type == PIPE) ? 1 : 2;
+        } else if (c == '&') {
+            token.type = (next == '&') ? AND : AMPERSAND;
+            length = (token.type == AND) ? 2 : 1;
+        } else if (c == '>') {
+            token.type = (next == '>') ? APPEND_OUT : REDIRECT_OUT;
+            length = (token.type == APPEND_OUT) ? 2 : 1;
+        } else {
+            token.type = SEMICOLON;
+        }
+        pos += length;
+        token.end = pos;
+        return true;
+    }
+
+    token.type = WORD;
+    while (pos < src.length() && !isOperatorChar(src[pos]) && !strchr(WHITESPACE, src[pos])) {
+        c = src[pos];
+        if (c == '\'') {
+            // Single quotes: everything up to the closing quote is literal
+            size_t close = src.find('\'', pos + 1);
+            if (close == string::npos) {
+                return fail("syntax error: unterminated quote");
+            }
+            for (size_t i = pos + 1; i < close; i++) {
+                addQuoted(token, src[i]);
+            }
+            token.quoted = true;
+            pos = close + 1;
+        } else if (c == '"') {
+            // Double quotes: a backslash only escapes ", \, $ and `
+            size_t i = pos + 1;
+            while (i < src.length() && src[i] != '"') {
+                if (src[i] == '\\' && i + 1 < src.length() && strchr("\"\\$`", src[i + 1])) {
+                    i++;
+                }
+                addQuoted(token, src[i]);
+                i++;
+            }
+            if (i == src.length()) {
+                return fail("syntax error: unterminated quote");
+            }
+            token.quoted = true;
+            pos = i + 1;
+        } else if (c == '\\') {
+            if (pos + 1 < src.length()) {
+                pos++;
+            }
+            addQuoted(token, src[pos]);
+            token.quoted = true;
+            pos++;
+        } else {
+            token.literal += c;
+            token.pattern += c;
+            pos++;
+        }
+    }
+    token.end = pos;
+    return true;
+}
+
+const Token* Parser::peek() {
+    if (!hasPeeked) {
+        if (!lex(peeked)) {
+            return nullptr;
+        }
+        hasPeeked = true;
+    }
+    return &peeked;
+}
+
+void Parser::consume() {
+    hasPeeked = false;
+}
+
+shared_ptr<CommandNode> Parser::parseList() {
+    shared_ptr<CommandNode> list = make_shared<CommandNode>(CommandNode::LIST);
+    const Token* token;
+    while ((token = peek()) != nullptr && token->type != END) {
+        if (token->type != WORD) {
+            failUnexpected(*token);
+            return nullptr;
+        }
+
+        size_t itemStart = token->start;
+        shared_ptr<CommandNode> item = parsePipeline();
+        if (!item || (token = peek()) == nullptr) {
+            return nullptr;
+        }
+
+        CommandNode::Connector connector;
+        switch (token->type) {
+            case SEMICOLON: connector = CommandNode::SEQUENCE; break;
+            case AMPERSAND: connector = CommandNode::BACKGROUND; break;
+            case AND: connector = CommandNode::AND; break;
+            case OR: connector = CommandNode::OR; break;
+            case END: connector = CommandNode::SEQUENCE; break;
+            default:
+                failUnexpected(*token);
+                return nullptr;
+        }
+        if (connector == CommandNode::BACKGROUND) {
+            // Jobs show the command together with its '&'
+            item->display = src.substr(itemStart, token->end - itemStart);
+        }
+        consume();
+
+        if (connector == CommandNode::AND || connector == CommandNode::OR) {
+            // '&&' and '||' must be followed by another command
+            if ((token = peek()) == nullptr) {
+                return nullptr;
+            }
+            if (token->type != WORD) {
+                failUnexpected(*token);
+                return nullptr;
+            }
+        }
+
+        list->children.push_back(item);
+        list->connectors.push_back(connector);
+    }
+    if (token == nullptr) {
+        return nullptr;
+    }
+
+    list->text = src;
+    list->display = src;
+    return list;
+}
+
+shared_ptr<CommandNode> Parser::parsePipeline() {
+    size_t start = peek()->start;
+    shared_ptr<CommandNode> first = parseCommand();
+    if (!first) {
+        return nullptr;
+    }
+
+    const Token* token = peek();
+    if (token == nullptr) {
+        return nullptr;
+    }
+    if (token->type != PIPE && token->type != PIPE_STDERR) {
+        return first;
+    }
+
+    shared_ptr<CommandNode> pipeline = make_shared<CommandNode>(CommandNode::PIPELINE);
+    pipeline->children.push_back(first);
+    size_t end = token->start;
+    while (token != nullptr && (token->type == PIPE || token->type == PIPE_STDERR)) {
+        pipeline->connectors.push_back(token->type == PIPE ? CommandNode::PIPE : CommandNode::PIPE_STDERR);
+        consume();
+        if ((token = peek()) == nullptr) {
+            return nullptr;
+        }
+        if (token->type != WORD) {
+            failUnexpected(*token);
+            return nullptr;
+        }
+        shared_ptr<CommandNode> stage = parseCommand();
+        if (!stage || (token = peek()) == nullptr) {
+            return nullptr;
+        }
+        pipeline->children.push_back(stage);
+        end = token->start;
+    }
+
+    pipeline->text = src.substr(start, src.find_last_not_of(WHITESPACE, end - 1) + 1 - start);
+    pipeline->display = pipeline->text;
+    return pipeline;
+}
+
+shared_ptr<CommandNode> Parser::parseCommand() {
+    shared_ptr<CommandNode> command = make_shared<CommandNode>(CommandNode::SIMPLE);
+    vector<pair<string, bool>> redirections;
+    bool firstWordQuoted = false;
+    size_t firstWordEnd = 0;
+    size_t start = peek()->start;
+    size_t end = start;
+
+    const Token* token;
+    while ((token = peek()) != nullptr) {
+        if (token->type == WORD) {
+            if (command->words.empty()) {
+                firstWordQuoted = token->quoted;
+                firstWordEnd = token->end;
+            } else {
+                command->text += ' ';
+            }
+            command->wordStarts.push_back(command->text.length());
+            command->text += src.substr(token->start, token->end - token->start);
+            command->words.push_back(token->literal);
+            command->patterns.push_back(token->pattern);
+            end = token->end;
+            consume();
+        } else if (token->type == REDIRECT_OUT || token->type == APPEND_OUT) {
+            bool append = (token->type == APPEND_OUT);
+            consume();
+            if ((token = peek()) == nullptr) {
+                return nullptr;
+            }
+            if (token->type != WORD) {
+                failUnexpected(*token);
+                return nullptr;
+            }
+            redirections.push_back(make_pair(token->literal, append));
+            end = token->end;
+            consume();
+        } else {
+            break;
+        }
+    }
+    if (token == nullptr) {
+        return nullptr;
+    }
+    if (command->words.empty()) {
+        fail("syntax error: missing command");
+        return nullptr;
+    }
+
+    string display = src.substr(start, end - start);
+    const string& name = command->words[0];
+    auto alias = aliases.find(name);
+    if (!firstWordQuoted && alias != aliases.end() && expanding.count(name) == 0) {
+        // The alias replaces the first word and the rest of the command (redirections included)
+        // is parsed again after it, so an alias may itself contain operators
+        shared_ptr<CommandNode> expanded = expandAlias(alias->second, name, firstWordEnd, token->start);
+        if (expanded) {
+            expanded->display = display;
+        }
+        return expanded;
+    }
+
+    command->display = display;
+    // Redirections are applied from left to right, so the last one ends up closest to the command
+    for (auto it = redirections.rbegin(); it != redirections.rend(); ++it) {
+        shared_ptr<CommandNode> redirect = make_shared<CommandNode>(CommandNode::REDIRECT);
+        redirect->file = it->first;
+        redirect->append = it->second;
+        redirect->text = display;
+        redirect->display = display;
+        redirect->children.push_back(command);
+        command = redirect;
+    }
+    return command;
+}
+
+shared_ptr<CommandNode> Parser::expandAlias(const string& value, const string& name, size_t restStart, size_t restEnd) {
+    string expandedLine = value + src.substr(restStart, restEnd - restStart);
+
+    expanding.insert(name);
+    Parser parser(expandedLine, aliases, expanding);
+    shared_ptr<CommandNode> list = parser.parseList();
+    expanding.erase(name);
+
+    if (!list) {
+        fail(parser.getError());
+        return nullptr;
+    }
+    if (list->children.empty()) {
+        fail("syntax error: alias " + name + " expands to nothing");
+        return nullptr;
+    }
+    if (list->children.size() == 1 && list->connectors[0] == CommandNode::SEQUENCE) {
+        return list->children[0];
+    }
+    return list;
+}
+
+} // namespace
+
+shared_ptr<CommandNode> subCommand(const CommandNode& node, size_t firstWord) {
+    shared_ptr<CommandNode> command = make_shared<CommandNode>(CommandNode::SIMPLE);
+    size_t offset = node.wordStarts[firstWord];
+    command->text = node.text.substr(offset);
+    command->display = node.display;
+    command->words.assign(node.words.begin() + firstWord, node.words.end());
+    command->patterns.assign(node.patterns.begin() + firstWord, node.patterns.end());
+    for (size_t i = firstWord; i < node.wordStarts.size(); i++) {
+        command->wordStarts.push_back(node.wordStarts[i] - offset);
+    }
+    return command;
+}
+
+shared_ptr<CommandNode> parseCommandLine(const string& line, const unordered_map<string, string>& aliases,
+                                         string& error) {
+    set<string> expanding;
+    Parser parser(line, aliases, expanding);
+    shared_ptr<CommandNode> list = parser.parseList();
+    if (!list) {
+        error = parser.getError();
+    }
+    return list;
+}
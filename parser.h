@@ -0,0 +1,66 @@
+#ifndef SMASH_PARSER_H_
+#define SMASH_PARSER_H_
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Syntax tree of a command line. parseCommandLine builds it in a single pass over the line:
+//   list      := pipeline ((';' | '&' | '&&' | '||') pipeline)* [';' | '&']
+//   pipeline  := command (('|' | '|&') command)*
+//   command   := word (word | ('>' | '>>') word)*
+// Single quotes, double quotes and backslashes quote characters, so operators and wildcards
+// inside quotes are plain text.
+struct CommandNode {
+    enum Kind {
+        SIMPLE,     // a command and its arguments
+        REDIRECT,   // children[0] with its stdout redirected to file
+        PIPELINE,   // children connected by pipes
+        LIST        // children run one after the other according to connectors
+    };
+
+    enum Connector {
+        SEQUENCE,    // ';' or the end of the line
+        BACKGROUND,  // '&'
+        AND,         // '&&'
+        OR,          // '||'
+        PIPE,        // '|'
+        PIPE_STDERR  // '|&'
+    };
+
+    Kind kind;
+    // The source of the command with single spaces between words, used as the cmd_line of Command objects
+    std::string text;
+    // The command as it was typed (before alias expansion, including a trailing '&'), shown by jobs and fg
+    std::string display;
+
+    // SIMPLE: the words after quote removal, and the same words as wildcard patterns in which
+    // quoted wildcard characters are escaped with a backslash
+    std::vector<std::string> words;
+    std::vector<std::string> patterns;
+    std::vector<size_t> wordStarts; // offset of every word in text
+
+    // REDIRECT
+    std::string file;
+    bool append;
+
+    // REDIRECT, PIPELINE and LIST; in a PIPELINE connectors[i] joins children[i] and children[i + 1],
+    // in a LIST connectors[i] follows children[i]
+    std::vector<std::shared_ptr<CommandNode>> children;
+    std::vector<Connector> connectors;
+
+    explicit CommandNode(Kind kind) : kind(kind), append(false) {}
+};
+
+// Returns a SIMPLE node made of the words of a SIMPLE node starting at firstWord, for commands such as
+// timeout that run the rest of their line as another command. The display text is kept.
+std::shared_ptr<CommandNode> subCommand(const CommandNode& node, size_t firstWord);
+
+// Parses a full command line into a LIST node. Aliases are expanded on the first word of every
+// simple command. Returns nullptr and sets error on a syntax error.
+std::shared_ptr<CommandNode> parseCommandLine(const std::string& line,
+                                              const std::unordered_map<std::string, std::string>& aliases,
+                                              std::string& error);
+
+#endif //SMASH_PARSER_H_
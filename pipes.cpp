@@ -0,0 +1,197 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <algorithm>
+#include <iostream>
+#include "pipes.h"
+#include "Commands.h"
+
+using namespace std;
+
+// Parses a size such as 65536, 256k or 1m
+static bool parseSize(const string& str, long* size) {
+    char* end;
+    errno = 0;
+    long value = strtol(str.c_str(), &end, 10);
+    if (end == str.c_str() || errno != 0 || value <= 0) {
+        return false;
+    }
+    string suffix(end);
+    if (suffix == "k" || suffix == "K") {
+        value *= 1024;
+    } else if (suffix == "m" || suffix == "M") {
+        value *= 1024 * 1024;
+    } else if (!suffix.empty()) {
+        return false;
+    }
+    *size = value;
+    return true;
+}
+
+bool parsePipeOptions(const vector<string>& words, PipeConfig& config, size_t& next) {
+    next = 1;
+    while (next < words.size() && words[next][0] == '-') {
+        if (next + 1 >= words.size()) {
+            return false;
+        }
+        const string& value = words[next + 1];
+        if (words[next] == "-s") {
+            if (!parseSize(value, &config.size)) {
+                return false;
+            }
+        } else if (words[next] == "-m" && (value == "on" || value == "off")) {
+            config.metering = (value == "on");
+        } else {
+            return false;
+        }
+        next += 2;
+    }
+    return true;
+}
+
+long maxPipeSize() {
+    static long maxSize = 0;
+    if (maxSize == 0) {
+        FILE* file = fopen("/proc/sys/fs/pipe-max-size", "r");
+        if (file == nullptr || fscanf(file, "%ld", &maxSize) != 1) {
+            maxSize = 1024 * 1024; // the kernel's default limit
+        }
+        if (file != nullptr) {
+            fclose(file);
+        }
+    }
+    return maxSize;
+}
+
+bool createPipe(int fds[2], const PipeConfig& config) {
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("smash error: pipe failed");
+        return false;
+    }
+    // The kernel rounds the capacity up to a power of two number of pages
+    if (config.size > 0 && fcntl(fds[1], F_SETPIPE_SZ, min(config.size, maxPipeSize())) == -1) {
+        perror("smash error: fcntl failed");
+    }
+    return true;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void PipeMeter::addPipe(int fromFd, int toFd) {
+    Relay relay;
+    relay.fromFd = fromFd;
+    relay.toFd = toFd;
+    relay.capacity = fcntl(fromFd, F_GETPIPE_SZ);
+    relay.bytes = 0;
+    relay.fullSeconds = 0;
+    relay.emptySeconds = 0;
+    relay.seconds = 0;
+    relay.wasFull = false;
+    relay.wasEmpty = false;
+    fcntl(fromFd, F_SETFL, fcntl(fromFd, F_GETFL) | O_NONBLOCK);
+    fcntl(toFd, F_SETFL, fcntl(toFd, F_GETFL) | O_NONBLOCK);
+    relays.push_back(relay);
+}
+
+vector<int> PipeMeter::getFds() const {
+    vector<int> fds;
+    for (const Relay& relay : relays) {
+        fds.push_back(relay.fromFd);
+        fds.push_back(relay.toFd);
+    }
+    return fds;
+}
+
+void PipeMeter::closeRelay(Relay& relay) {
+    close(relay.fromFd);
+    close(relay.toFd);
+    relay.fromFd = -1;
+    relay.toFd = -1;
+}
+
+void PipeMeter::run() {
+    // A reader that exits early makes splice fail with EPIPE, the SIGPIPE raised with it is blocked and dropped
+    sigset_t pipeMask, oldMask;
+    sigemptyset(&pipeMask);
+    sigaddset(&pipeMask, SIGPIPE);
+    sigprocmask(SIG_BLOCK, &pipeMask, &oldMask);
+
+    SmallShell& smash = SmallShell::getInstance();
+    vector<struct pollfd> fds(relays.size());
+    size_t numOpen = relays.size();
+    double start = now();
+    double last = start;
+    while (numOpen > 0) {
+        // Whatever state a pipe was left in after the last round lasted until now
+        double current = now();
+        for (Relay& relay : relays) {
+            relay.fullSeconds += relay.wasFull ? current - last : 0;
+            relay.emptySeconds += relay.wasEmpty ? current - last : 0;
+        }
+        last = current;
+
+        for (size_t i = 0; i < relays.size(); i++) {
+            Relay& relay = relays[i];
+            fds[i].fd = -1;
+            fds[i].revents = 0;
+            if (relay.fromFd == -1) {
+                continue;
+            }
+
+            ssize_t moved;
+            while ((moved = splice(relay.fromFd, nullptr, relay.toFd, nullptr, relay.capacity,
+                                   SPLICE_F_NONBLOCK | SPLICE_F_MOVE)) > 0) {
+                relay.bytes += moved;
+            }
+            if (moved == 0 || (errno != EAGAIN && errno != EINTR)) {
+                // The writer closed its end, or the reader is gone
+                relay.seconds = current - start;
+                relay.wasFull = false;
+                relay.wasEmpty = false;
+                closeRelay(relay);
+                numOpen--;
+                continue;
+            }
+
+            // splice stopped because there is nothing to read or no room to write
+            int queuedIn = 0;
+            int queuedOut = 0;
+            ioctl(relay.fromFd, FIONREAD, &queuedIn);
+            ioctl(relay.toFd, FIONREAD, &queuedOut);
+            relay.wasFull = (queuedIn >= relay.capacity);
+            relay.wasEmpty = (queuedOut == 0);
+            fds[i].fd = (queuedIn == 0) ? relay.fromFd : relay.toFd;
+            fds[i].events = (queuedIn == 0) ? POLLIN : POLLOUT;
+        }
+        if (numOpen > 0) {
+            smash.waitForEvents(fds.data(), fds.size(), -1);
+        }
+    }
+
+    struct timespec noWait = {0, 0};
+    while (sigtimedwait(&pipeMask, nullptr, &noWait) > 0) {
+    }
+    sigprocmask(SIG_SETMASK, &oldMask, nullptr);
+}
+
+void PipeMeter::report(const vector<string>& stageNames) const {
+    for (size_t i = 0; i < relays.size(); i++) {
+        const Relay& relay = relays[i];
+        char line[256];
+        double rate = (relay.seconds > 0) ? relay.bytes / relay.seconds / 1e6 : 0;
+        snprintf(line, sizeof(line), "%llu bytes in %.3fs (%.1f MB/s), writer blocked %.3fs, reader blocked %.3fs",
+                 (unsigned long long)relay.bytes, relay.seconds, rate, relay.fullSeconds, relay.emptySeconds);
+        cerr << "smash: pipe " << (i + 1) << " (" << stageNames[i] << " | " << stageNames[i + 1] << "): "
+             << line << endl;
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef SMASH_PIPES_H_
+#define SMASH_PIPES_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// How the pipes of a pipeline are set up. The shell keeps one, and a pipeline that starts with
+// pipeconf gets a copy changed by the options given there.
+struct PipeConfig {
+    long size;     // capacity requested with F_SETPIPE_SZ, 0 keeps the kernel default
+    bool metering; // relay every pipe through the shell and report its throughput
+
+    PipeConfig() : size(0), metering(false) {}
+};
+
+// Parses "-s SIZE" and "-m on|off" options from words[1] on into config. SIZE takes a k or m suffix.
+// next is set to the first word that is not an option. Returns false on an invalid option.
+bool parsePipeOptions(const std::vector<std::string>& words, PipeConfig& config, size_t& next);
+
+// The largest capacity an unprivileged process can ask for, from /proc/sys/fs/pipe-max-size
+long maxPipeSize();
+
+// Creates a pipe with the configured capacity, capped to maxPipeSize
+bool createPipe(int fds[2], const PipeConfig& config);
+
+// Copies the pipes of a metered pipeline: stage i writes into fromFds[i] and stage i + 1 reads
+// from toFds[i], while the shell moves the data across with splice. Besides counting the bytes,
+// the meter keeps how long each pipe sat full (its writer blocked) or empty (its reader blocked).
+class PipeMeter {
+public:
+    // Takes ownership of the fds
+    void addPipe(int fromFd, int toFd);
+
+    // Relays until every writer closed its end, keeping the shell's event loop going meanwhile
+    void run();
+
+    // Prints a line per pipe to stderr
+    void report(const std::vector<std::string>& stageNames) const;
+
+    // The shell's end of every pipe, so forked stages can close them
+    std::vector<int> getFds() const;
+
+private:
+    struct Relay {
+        int fromFd;
+        int toFd;
+        long capacity;
+        uint64_t bytes;
+        double fullSeconds;
+        double emptySeconds;
+        double seconds; // from the start until the writer closed the pipe
+        bool wasFull;
+        bool wasEmpty;
+    };
+
+    std::vector<Relay> relays;
+
+    static void closeRelay(Relay& relay);
+};
+
+#endif //SMASH_PIPES_H_
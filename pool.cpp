@@ -0,0 +1,50 @@
+#include <new>
+#include "pool.h"
+
+using namespace std;
+
+ObjectPool::ObjectPool() : slabNext(nullptr), slabEnd(nullptr)
+{
+    for (FreeBlock*& list : freeLists) {
+        list = nullptr;
+    }
+}
+
+ObjectPool::~ObjectPool() {
+    for (char* slab : slabs) {
+        ::operator delete(slab);
+    }
+}
+
+void* ObjectPool::allocate(size_t size) {
+    if (size == 0 || size > POOL_MAX_BLOCK) {
+        return ::operator new(size);
+    }
+    size_t index = (size - 1) / POOL_GRANULARITY;
+    FreeBlock* block = freeLists[index];
+    if (block != nullptr) {
+        freeLists[index] = block->next;
+        return block;
+    }
+    size_t blockSize = (index + 1) * POOL_GRANULARITY;
+    if ((size_t)(slabEnd - slabNext) < blockSize) {
+        // What is left of the old slab is too small for this size and stays unused
+        slabs.push_back(static_cast<char*>(::operator new(POOL_SLAB_SIZE)));
+        slabNext = slabs.back();
+        slabEnd = slabNext + POOL_SLAB_SIZE;
+    }
+    void* result = slabNext;
+    slabNext += blockSize;
+    return result;
+}
+
+void ObjectPool::deallocate(void* block, size_t size) {
+    if (size == 0 || size > POOL_MAX_BLOCK) {
+        ::operator delete(block);
+        return;
+    }
+    size_t index = (size - 1) / POOL_GRANULARITY;
+    FreeBlock* free = static_cast<FreeBlock*>(block);
+    free->next = freeLists[index];
+    freeLists[index] = free;
+}
@@ -0,0 +1,69 @@
+#ifndef SMASH_POOL_H_
+#define SMASH_POOL_H_
+
+#include <stddef.h>
+#include <vector>
+
+#define POOL_GRANULARITY (16)
+#define POOL_MAX_BLOCK (512)   // larger objects come from operator new
+#define POOL_SLAB_SIZE (16384) // blocks are carved out of slabs of this size
+
+// Free lists of fixed-size blocks for the objects smash makes for every command line, such as the
+// commands with their shared_ptr control blocks. A block goes back to the list of its size when the
+// object is destroyed, so once the first lines ran a command costs no malloc. Only the shell's main
+// thread uses it.
+class ObjectPool {
+public:
+    ObjectPool();
+    ~ObjectPool();
+
+    ObjectPool(ObjectPool const &) = delete; // disable copy ctor
+    void operator=(ObjectPool const &) = delete; // disable = operator
+
+    void* allocate(size_t size);
+    void deallocate(void* block, size_t size);
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    FreeBlock* freeLists[POOL_MAX_BLOCK / POOL_GRANULARITY];
+    std::vector<char*> slabs;
+    char* slabNext; // the part of the newest slab not handed out yet
+    char* slabEnd;
+};
+
+// Allocator for std::allocate_shared that takes its memory from an ObjectPool
+template <typename T>
+class PoolAllocator {
+public:
+    typedef T value_type;
+
+    explicit PoolAllocator(ObjectPool* pool) : pool(pool) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other) : pool(other.pool) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(pool->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* block, size_t n) {
+        pool->deallocate(block, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& other) const {
+        return pool == other.pool;
+    }
+
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>& other) const {
+        return pool != other.pool;
+    }
+
+    ObjectPool* pool;
+};
+
+#endif //SMASH_POOL_H_
@@ -0,0 +1,185 @@
+#include <errno.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "rlimits.h"
+
+using namespace std;
+
+struct LimitInfo {
+    const char* flag;
+    decltype(RLIMIT_AS) resource; // an enum in glibc, which prlimit takes
+    rlim_t unit; // bytes per unit of the flag
+    const char* name;
+    const char* unitName;
+};
+
+static const LimitInfo LIMITS[LIMIT_COUNT] = {
+    {"-v", RLIMIT_AS, 1024, "address space", "kbytes"},
+    {"-t", RLIMIT_CPU, 1, "cpu time", "seconds"},
+    {"-n", RLIMIT_NOFILE, 1, "open files", ""},
+    {"-f", RLIMIT_FSIZE, 1024, "file size", "kbytes"},
+};
+
+ResourceLimits::ResourceLimits()
+{
+    for (rlim_t& value : values) {
+        value = LIMIT_UNSET;
+    }
+}
+
+bool ResourceLimits::empty() const {
+    for (rlim_t value : values) {
+        if (value != LIMIT_UNSET) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ResourceLimits::merge(const ResourceLimits& other) {
+    for (int i = 0; i < LIMIT_COUNT; i++) {
+        if (other.values[i] != LIMIT_UNSET) {
+            values[i] = other.values[i];
+        }
+    }
+}
+
+int limitIndex(const string& flag) {
+    for (int i = 0; i < LIMIT_COUNT; i++) {
+        if (flag == LIMITS[i].flag) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// A value that still fits in an rlim_t once converted to bytes, and is not one of the special ones
+static bool parseLimitValue(const string& str, rlim_t unit, rlim_t* value) {
+    if (str == "unlimited") {
+        *value = RLIM_INFINITY;
+        return true;
+    }
+    if (str.empty() || str.size() > 19) {
+        return false;
+    }
+    rlim_t result = 0;
+    for (char c : str) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        result = result * 10 + (c - '0');
+    }
+    if (result > (LIMIT_UNSET - 1) / unit) {
+        return false;
+    }
+    *value = result;
+    return true;
+}
+
+bool parseLimits(const vector<string>& words, size_t start, ResourceLimits* limits, size_t* next) {
+    size_t i = start;
+    while (i < words.size() && words[i].size() > 1 && words[i][0] == '-') {
+        int index = limitIndex(words[i]);
+        if (index == -1 || i + 1 == words.size() ||
+            !parseLimitValue(words[i + 1], LIMITS[index].unit, &limits->values[index])) {
+            *next = i;
+            return false;
+        }
+        i += 2;
+    }
+    *next = i;
+    return true;
+}
+
+static struct rlimit toRlimit(int index, rlim_t value) {
+    struct rlimit limit;
+    limit.rlim_cur = (value == RLIM_INFINITY) ? RLIM_INFINITY : value * LIMITS[index].unit;
+    limit.rlim_max = limit.rlim_cur;
+    if (LIMITS[index].resource == RLIMIT_CPU && limit.rlim_cur != RLIM_INFINITY) {
+        limit.rlim_max = limit.rlim_cur + 1;
+    }
+    return limit;
+}
+
+bool applyLimits(const ResourceLimits& limits) {
+    return applyLimits(0, limits);
+}
+
+bool applyLimits(pid_t pid, const ResourceLimits& limits) {
+    for (int i = 0; i < LIMIT_COUNT; i++) {
+        if (limits.values[i] == LIMIT_UNSET) {
+            continue;
+        }
+        struct rlimit limit = toRlimit(i, limits.values[i]);
+        if (prlimit(pid, LIMITS[i].resource, &limit, nullptr) == -1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static rlim_t fromRlimit(int index, rlim_t value) {
+    return (value == RLIM_INFINITY) ? RLIM_INFINITY : value / LIMITS[index].unit;
+}
+
+bool readLimits(pid_t pid, ResourceLimits* limits) {
+    for (int i = 0; i < LIMIT_COUNT; i++) {
+        struct rlimit limit;
+        if (prlimit(pid, LIMITS[i].resource, nullptr, &limit) == -1) {
+            return false;
+        }
+        limits->values[i] = fromRlimit(i, limit.rlim_cur);
+    }
+    return true;
+}
+
+rlim_t currentLimit(int index) {
+    struct rlimit limit;
+    getrlimit(LIMITS[index].resource, &limit);
+    return fromRlimit(index, limit.rlim_cur);
+}
+
+rlim_t hardLimit(int index) {
+    struct rlimit limit;
+    getrlimit(LIMITS[index].resource, &limit);
+    return fromRlimit(index, limit.rlim_max);
+}
+
+string formatLimit(rlim_t value) {
+    return (value == RLIM_INFINITY) ? "unlimited" : to_string((unsigned long long)value);
+}
+
+string formatLimits(const ResourceLimits& limits) {
+    string out;
+    for (int i = 0; i < LIMIT_COUNT; i++) {
+        string label = string(LIMITS[i].name) + " ";
+        if (*LIMITS[i].unitName != '\0') {
+            label += string("(") + LIMITS[i].unitName + ", " + LIMITS[i].flag + ")";
+        } else {
+            label += string("(") + LIMITS[i].flag + ")";
+        }
+        label.resize(30, ' ');
+        rlim_t value = (limits.values[i] != LIMIT_UNSET) ? limits.values[i] : currentLimit(i);
+        out += label + formatLimit(value) + "\n";
+    }
+    return out;
+}
+
+const char* limitKillReason(int status, const ResourceLimits& limits) {
+    if (!WIFSIGNALED(status)) {
+        return nullptr;
+    }
+    int signum = WTERMSIG(status);
+    if (signum == SIGXCPU) {
+        return "cpu time limit";
+    }
+    if (signum == SIGXFSZ) {
+        return "file size limit";
+    }
+    rlim_t addressSpace = limits.values[limitIndex("-v")];
+    if ((signum == SIGSEGV || signum == SIGABRT || signum == SIGBUS) &&
+        addressSpace != LIMIT_UNSET && addressSpace != RLIM_INFINITY) {
+        return "address space limit";
+    }
+    return nullptr;
+}
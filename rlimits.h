@@ -0,0 +1,62 @@
+#ifndef SMASH_RLIMITS_H_
+#define SMASH_RLIMITS_H_
+
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+#define LIMIT_COUNT (4)
+#define LIMIT_UNSET ((rlim_t)-2) // RLIM_INFINITY is -1, for "unlimited"
+
+// The resource limits of the limit prefix, the ulimit builtin and prlimit, one slot for each of
+// -v (address space, KiB), -t (cpu time, seconds), -n (open files) and -f (file size, KiB).
+// The values are kept in those units, a slot nobody set is LIMIT_UNSET.
+struct ResourceLimits {
+    rlim_t values[LIMIT_COUNT];
+
+    ResourceLimits();
+
+    bool empty() const;
+
+    // The slots set in other replace the ones here
+    void merge(const ResourceLimits& other);
+};
+
+// Parses flag and value pairs from words[start], such as -t 10 -v unlimited, up to the first word
+// that is not a flag. Sets next to that word and returns false if a flag or a value is invalid.
+bool parseLimits(const std::vector<std::string>& words, size_t start, ResourceLimits* limits, size_t* next);
+
+// The slot of a flag such as "-v", or -1
+int limitIndex(const std::string& flag);
+
+// Sets the soft and the hard limit of the calling process, so a job cannot raise them again. The hard
+// cpu limit is a second above the soft one: SIGXCPU says why the job died, SIGKILL follows if it is caught.
+// Returns false with errno set.
+bool applyLimits(const ResourceLimits& limits);
+
+// The same for a running process through prlimit(2), only that process and not its children
+bool applyLimits(pid_t pid, const ResourceLimits& limits);
+
+// Fills every slot with the soft limit a running process has, read through prlimit(2).
+// Returns false with errno set.
+bool readLimits(pid_t pid, ResourceLimits* limits);
+
+// The limit a slot has in the calling process, in the units of its flag
+rlim_t currentLimit(int index);
+
+// The hard limit of the calling process for a slot, in the units of its flag
+rlim_t hardLimit(int index);
+
+// "unlimited" or the number
+std::string formatLimit(rlim_t value);
+
+// One line per slot as ulimit -a prints them, taking the slots that are unset from the calling process
+std::string formatLimits(const ResourceLimits& limits);
+
+// What a job that ended with the wait status got killed by, or nullptr if it was not a limit. A job
+// is only known to have hit its limit when it died of the signal the kernel sends for it, or, under an
+// address space limit, of the signals a failed allocation ends in.
+const char* limitKillReason(int status, const ResourceLimits& limits);
+
+#endif //SMASH_RLIMITS_H_
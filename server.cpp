@@ -0,0 +1,174 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <iostream>
+#include <set>
+#include "server.h"
+
+using namespace std;
+
+#define MAX_EVENTS (64)
+
+static int openListeningSocket(const char* socketPath) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+        cerr << "smash error: serve: socket path is too long" << endl;
+        return -1;
+    }
+    strcpy(addr.sun_path, socketPath);
+
+    // A socket file left behind by a server that is not running anymore is replaced
+    struct stat socket_stat;
+    if (lstat(socketPath, &socket_stat) == 0 && S_ISSOCK(socket_stat.st_mode)) {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (probe != -1) {
+            if (connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == -1 && errno == ECONNREFUSED) {
+                unlink(socketPath);
+            }
+            close(probe);
+        }
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd == -1) {
+        perror("smash error: socket failed");
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        perror("smash error: bind failed");
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, SOMAXCONN) == -1) {
+        perror("smash error: listen failed");
+        close(fd);
+        unlink(socketPath);
+        return -1;
+    }
+    return fd;
+}
+
+static bool addToEpoll(int epollFd, int fd) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        perror("smash error: epoll_ctl failed");
+        return false;
+    }
+    return true;
+}
+
+int runServer(const char* socketPath, int (*runSession)()) {
+    // SIGCHLD, SIGINT and SIGTERM are handled by the event loop through a signalfd
+    sigset_t mask, oldMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, &oldMask) == -1) {
+        perror("smash error: sigprocmask failed");
+        return 1;
+    }
+
+    int sigFd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (sigFd == -1) {
+        perror("smash error: signalfd failed");
+    }
+    int listenFd = (sigFd != -1) ? openListeningSocket(socketPath) : -1;
+    int epollFd = (listenFd != -1) ? epoll_create1(EPOLL_CLOEXEC) : -1;
+    if (listenFd != -1 && epollFd == -1) {
+        perror("smash error: epoll_create1 failed");
+    }
+    if (epollFd == -1 || !addToEpoll(epollFd, listenFd) || !addToEpoll(epollFd, sigFd)) {
+        // Whatever was set up is undone, the socket file included
+        for (int fd : {epollFd, listenFd, sigFd}) {
+            if (fd != -1) {
+                close(fd);
+            }
+        }
+        if (listenFd != -1) {
+            unlink(socketPath);
+        }
+        sigprocmask(SIG_SETMASK, &oldMask, nullptr);
+        return 1;
+    }
+
+    set<pid_t> sessions;
+    bool running = true;
+    while (running) {
+        struct epoll_event events[MAX_EVENTS];
+        int num_events = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+        if (num_events == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("smash error: epoll_wait failed");
+            break;
+        }
+
+        for (int i = 0; i < num_events; i++) {
+            if (events[i].data.fd == listenFd) {
+                int clientFd;
+                while ((clientFd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC)) != -1) {
+                    pid_t pid = fork();
+                    if (pid == 0) {
+                        // Session process: the connection becomes the terminal of a regular smash
+                        close(listenFd);
+                        close(epollFd);
+                        close(sigFd);
+                        sigprocmask(SIG_SETMASK, &oldMask, nullptr);
+                        for (int fd = STDIN_FILENO; fd <= STDERR_FILENO; fd++) {
+                            dup2(clientFd, fd);
+                        }
+                        close(clientFd);
+                        exit(runSession());
+                    }
+                    if (pid == -1) {
+                        perror("smash error: fork failed");
+                    } else {
+                        sessions.insert(pid);
+                    }
+                    close(clientFd);
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    perror("smash error: accept failed");
+                }
+            } else {
+                struct signalfd_siginfo info;
+                while (read(sigFd, &info, sizeof(info)) == sizeof(info)) {
+                    if (info.ssi_signo != SIGCHLD) {
+                        running = false;
+                    }
+                }
+                pid_t pid;
+                while ((pid = waitpid(-1, nullptr, WNOHANG)) > 0) {
+                    sessions.erase(pid);
+                }
+            }
+        }
+    }
+
+    // Hang up on the clients that are still connected
+    for (pid_t pid : sessions) {
+        kill(pid, SIGHUP);
+    }
+    close(epollFd);
+    close(listenFd);
+    close(sigFd);
+    unlink(socketPath);
+    sigprocmask(SIG_SETMASK, &oldMask, nullptr);
+    return 0;
+}
@@ -0,0 +1,11 @@
+#ifndef SMASH_SERVER_H_
+#define SMASH_SERVER_H_
+
+// Command-server mode: listens on a Unix domain socket and gives every client its own session.
+// Each accepted connection is served by a forked session process whose stdin, stdout and stderr
+// are the connection, so it gets a fresh SmallShell (prompt, aliases, cwd and jobs) and streams
+// all command output back to the client. runSession is the interactive loop run by that process.
+// Returns the exit status of the server once it gets SIGINT or SIGTERM.
+int runServer(const char* socketPath, int (*runSession)());
+
+#endif //SMASH_SERVER_H_
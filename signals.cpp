@@ -1,10 +1,41 @@
 #include <iostream>
 #include <signal.h>
+#include <stdio.h>
+#include <sys/signalfd.h>
 #include "signals.h"
 #include "Commands.h"
 
 using namespace std;
 
+static sigset_t shellSignals() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGALRM);
+    return mask;
+}
+
+int openSignalFd() {
+    sigset_t mask = shellSignals();
+    if (sigprocmask(SIG_BLOCK, &mask, nullptr) == -1) {
+        perror("smash error: sigprocmask failed");
+        return -1;
+    }
+    int fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (fd == -1) {
+        perror("smash error: signalfd failed");
+    }
+    return fd;
+}
+
+void restoreChildSignals() {
+    // The signal mask survives exec, a command must not start with SIGINT blocked
+    sigset_t mask = shellSignals();
+    sigprocmask(SIG_UNBLOCK, &mask, nullptr);
+}
+
+// Called by the event loop when smash gets SIGINT
 void ctrlCHandler(int sig_num) {
     // Print the message
     cout << "smash: got ctrl-C" << endl;
@@ -12,6 +43,9 @@ void ctrlCHandler(int sig_num) {
     // Get the instance of SmallShell
     SmallShell& shell = SmallShell::getInstance();
 
+    // Interrupt whatever the shell itself is waiting for
+    shell.interrupt();
+
     // Get the PID of the foreground process
     pid_t fgPid = shell.getFgPid();
 
@@ -1,6 +1,13 @@
 #ifndef SMASH__SIGNALS_H_
 #define SMASH__SIGNALS_H_
 
+// Blocks SIGINT, SIGCHLD and SIGALRM and returns a signalfd that receives them instead, so the
+// shell's event loop handles them in normal context rather than in a signal handler
+int openSignalFd();
+
+// Unblocks the signals again in a forked child, before it runs a command
+void restoreChildSignals();
+
 void ctrlCHandler(int sig_num);
 
 #endif //SMASH__SIGNALS_H_
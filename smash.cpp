@@ -1,28 +1,70 @@
 #include <iostream>
-//#include <unistd.h>
+#include <errno.h>
+#include <unistd.h>
 //#include <sys/wait.h>
 #include <signal.h>
+#include <string.h>
 #include <algorithm>
 #include "Commands.h"
-#include "signals.h"
+#include "server.h"
+#include "snapshot.h"
+#include "trace.h"
 
 
-int main(int argc, char *argv[]) {
-    if (signal(SIGINT, ctrlCHandler) == SIG_ERR) {
-        perror("smash error: failed to set ctrl-C handler");
+// Reads the next line of stdin. While smash waits for input its event loop keeps handling signals,
+// timers and captured output, and reports background jobs as they finish.
+static bool readLine(SmallShell &smash, std::string &line) {
+    static std::string pending;
+    while (true) {
+        size_t end = pending.find('\n');
+        if (end != std::string::npos) {
+            line = pending.substr(0, end);
+            pending.erase(0, end + 1);
+            return true;
+        }
+
+        if (!smash.waitForEvents(STDIN_FILENO, -1)) {
+            if (smash.reportFinishedJobs()) {
+                std::cout << smash.getPrompt() << "> " << std::flush;
+            }
+            continue;
+        }
+        char buffer[4096];
+        ssize_t length = read(STDIN_FILENO, buffer, sizeof(buffer));
+        if (length == -1 && errno == EINTR) {
+            continue;
+        }
+        if (length <= 0) {
+            // The last line may not end with a newline
+            line = pending;
+            pending.clear();
+            return !line.empty();
+        }
+        pending.append(buffer, length);
     }
+}
 
-    //TODO: setup sig alarm handler
+// Given by --snapshot, applied by every shell, each session of a server its own
+static SnapshotState snapshot;
+static bool hasSnapshot = false;
 
+// Reads command lines from stdin and executes them until quit or the end of the input
+static int runShell() {
     SmallShell &smash = SmallShell::getInstance();
+    if (hasSnapshot) {
+        applySnapshot(smash, snapshot);
+    }
     while (true) {
         try {
-            std::cout << smash.getPrompt() << "> ";
+            std::cout << smash.getPrompt() << "> " << std::flush;
             std::string cmd_line;
-            std::getline(std::cin, cmd_line);
+            if (!readLine(smash, cmd_line)) {
+                break;
+            }
 
             // Check if cmd_line is empty or contains only whitespace
             if (!cmd_line.empty() && !std::all_of(cmd_line.begin(), cmd_line.end(), ::isspace)) {
+                smash.getHistory().append(cmd_line);
                 smash.executeCommand(cmd_line);
             }
         } catch (const QuitException &e) {
@@ -30,5 +72,32 @@ int main(int argc, char *argv[]) {
         }
 
     }
+    // A trace still running when the shell ends is written out as well
+    uint64_t dropped;
+    if (traceEnabled() && !traceStop(&dropped)) {
+        perror("smash error: trace failed");
+    }
     return 0;
 }
+
+int main(int argc, char *argv[]) {
+    // SIGINT, SIGCHLD and SIGALRM are handled by the event loop of SmallShell, see openSignalFd
+    // smash --snapshot FILE starts with the state snapshot save wrote to FILE
+    if (argc >= 3 && strcmp(argv[1], "--snapshot") == 0) {
+        // Only read here: the shell is made in runShell, so a server never makes one that its sessions
+        // would inherit, along with its audit thread, job table and timers
+        std::string error;
+        hasSnapshot = readSnapshot(argv[2], snapshot, error);
+        if (!hasSnapshot) {
+            std::cerr << "smash error: snapshot: " << error << std::endl;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    // smash --serve SOCKET_PATH: every client connecting to the socket gets its own session
+    if (argc == 3 && strcmp(argv[1], "--serve") == 0) {
+        return runServer(argv[2], runShell);
+    }
+
+    return runShell();
+}
@@ -0,0 +1,85 @@
+// Minimal client for "smash --serve": sends its stdin to the server and prints whatever the session
+// sends back, until the server closes the connection.
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <iostream>
+
+using namespace std;
+
+static bool writeAll(int fd, const char* data, ssize_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written == -1) {
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        cerr << "usage: smash_client SOCKET_PATH" << endl;
+        return 1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(argv[1]) >= sizeof(addr.sun_path)) {
+        cerr << "smash_client error: socket path is too long" << endl;
+        return 1;
+    }
+    strcpy(addr.sun_path, argv[1]);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1 || connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        perror("smash_client error: connect failed");
+        return 1;
+    }
+
+    struct pollfd fds[2];
+    fds[0].fd = STDIN_FILENO;
+    fds[0].events = POLLIN;
+    fds[1].fd = sock;
+    fds[1].events = POLLIN;
+
+    char buffer[65536];
+    while (true) {
+        if (poll(fds, 2, -1) == -1) {
+            perror("smash_client error: poll failed");
+            return 1;
+        }
+
+        if (fds[1].revents) {
+            ssize_t bytes_read = read(sock, buffer, sizeof(buffer));
+            if (bytes_read <= 0) {
+                // The session ended
+                break;
+            }
+            if (!writeAll(STDOUT_FILENO, buffer, bytes_read)) {
+                return 1;
+            }
+        }
+
+        if (fds[0].revents) {
+            ssize_t bytes_read = read(STDIN_FILENO, buffer, sizeof(buffer));
+            if (bytes_read <= 0) {
+                // No more input: let the session see end of input, keep reading its output
+                shutdown(sock, SHUT_WR);
+                fds[0].fd = -1;
+            } else if (!writeAll(sock, buffer, bytes_read)) {
+                perror("smash_client error: write failed");
+                return 1;
+            }
+        }
+    }
+
+    close(sock);
+    return 0;
+}
@@ -0,0 +1,128 @@
+// Reads the jobs a smash publishes in shared memory, without going through the shell at all.
+//   smash_jobs PID            prints the jobs of the smash with this pid
+//   smash_jobs -c COUNT PID   takes COUNT snapshots as fast as possible and checks that each of them
+//                             is consistent, to test the table while the shell is busy
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+#include "jobtable.h"
+
+using namespace std;
+
+static const SharedJobTable* openTable(pid_t pid) {
+    string name = JOB_TABLE_NAME_PREFIX + to_string(pid);
+    int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("smash_jobs error: shm_open failed");
+        return nullptr;
+    }
+    void* memory = mmap(nullptr, sizeof(SharedJobTable), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        perror("smash_jobs error: mmap failed");
+        return nullptr;
+    }
+    const SharedJobTable* table = (const SharedJobTable*)memory;
+    if (table->magic != JOB_TABLE_MAGIC || table->version != JOB_TABLE_VERSION ||
+        table->slots != JOB_TABLE_SLOTS || table->recordSize != sizeof(SharedJob)) {
+        cerr << "smash_jobs error: " << name << " is not a job table of this version" << endl;
+        return nullptr;
+    }
+    // A shell killed before it could remove its table leaves it behind
+    if (kill(table->shellPid, 0) == -1 && errno == ESRCH) {
+        cerr << "smash_jobs error: smash " << table->shellPid << " is gone, the table is stale" << endl;
+        return nullptr;
+    }
+    return table;
+}
+
+static void printTable(const SharedJobTable& table) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t nowNs = now.tv_sec * 1000000000LL + now.tv_nsec;
+    // Running jobs first, like the jobs builtin lists them, then the finished ones
+    vector<const SharedJob*> jobs;
+    for (const SharedJob& job : table.jobs) {
+        if (job.state != SHARED_JOB_EMPTY) {
+            jobs.push_back(&job);
+        }
+    }
+    sort(jobs.begin(), jobs.end(), [](const SharedJob* a, const SharedJob* b) {
+        return a->state != b->state ? a->state < b->state : a->jobId < b->jobId;
+    });
+    for (const SharedJob* entry : jobs) {
+        const SharedJob& job = *entry;
+        cout << "[" << job.jobId << "] " << job.pid << " ";
+        if (job.state == SHARED_JOB_RUNNING) {
+            cout << "running " << (nowNs - job.startTime) / 1000000000LL << "s";
+        } else {
+            cout << "done " << job.exitCode;
+        }
+        cout << " " << job.command << endl;
+    }
+    if (table.unlisted > 0) {
+        cout << table.unlisted << " more running jobs did not fit in the table" << endl;
+    }
+}
+
+// Everything a torn read would break
+static bool isConsistent(const SharedJobTable& table) {
+    uint32_t count = 0;
+    set<int32_t> pids, jobIds;
+    for (const SharedJob& job : table.jobs) {
+        if (job.state == SHARED_JOB_EMPTY) {
+            continue;
+        }
+        count++;
+        if (job.state != SHARED_JOB_RUNNING && job.state != SHARED_JOB_DONE) {
+            return false;
+        }
+        if (memchr(job.command, '\0', sizeof(job.command)) == nullptr) {
+            return false;
+        }
+        if (job.state == SHARED_JOB_RUNNING && (!pids.insert(job.pid).second || !jobIds.insert(job.jobId).second)) {
+            return false;
+        }
+    }
+    return count == table.count;
+}
+
+int main(int argc, char *argv[]) {
+    long checks = 0;
+    if (argc == 4 && strcmp(argv[1], "-c") == 0) {
+        checks = atol(argv[2]);
+    } else if (argc != 2) {
+        cerr << "usage: smash_jobs [-c COUNT] PID" << endl;
+        return 1;
+    }
+    const SharedJobTable* table = openTable(atoi(argv[argc - 1]));
+    if (table == nullptr) {
+        return 1;
+    }
+    // The jobs array alone is over 200KB
+    SharedJobTable* copy = new SharedJobTable;
+
+    if (checks == 0) {
+        readJobTable(table, copy);
+        printTable(*copy);
+        return 0;
+    }
+
+    unsigned long long retries = 0, inconsistent = 0;
+    for (long i = 0; i < checks; i++) {
+        retries += readJobTable(table, copy);
+        inconsistent += isConsistent(*copy) ? 0 : 1;
+    }
+    cout << checks << " snapshots, " << retries << " retries, " << inconsistent << " inconsistent" << endl;
+    return inconsistent == 0 ? 0 : 1;
+}
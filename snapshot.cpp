@@ -0,0 +1,168 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Commands.h"
+#include "snapshot.h"
+
+using namespace std;
+
+static void appendString(string& buffer, const string& value) {
+    uint32_t length = value.size();
+    buffer.append((const char*)&length, sizeof(length));
+    buffer.append(value);
+}
+
+bool saveSnapshot(SmallShell& smash, const string& path) {
+    char* cwd = getcwd(nullptr, 0);
+    if (cwd == nullptr) {
+        return false;
+    }
+    vector<string> variables = smash.getEnvironment().getExported();
+    SnapshotHeader header = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION, 0, (uint32_t)smash.getAliasOrder().size(),
+                             (uint32_t)variables.size()};
+    string buffer((const char*)&header, sizeof(header));
+    appendString(buffer, smash.getPrompt());
+    appendString(buffer, cwd);
+    free(cwd);
+    for (const string& name : smash.getAliasOrder()) {
+        appendString(buffer, name);
+        appendString(buffer, smash.getAlias(name));
+    }
+    for (const string& variable : variables) {
+        appendString(buffer, variable);
+    }
+    ((SnapshotHeader*)&buffer[0])->size = buffer.size();
+
+    // A smash starting meanwhile sees the old snapshot or the new one, never a part of it
+    string temporary = path + ".tmp";
+    int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return false;
+    }
+    size_t written = 0;
+    while (written < buffer.size()) {
+        ssize_t result = write(fd, buffer.data() + written, buffer.size() - written);
+        if (result == -1 && errno != EINTR) {
+            break;
+        }
+        written += (result > 0) ? result : 0;
+    }
+    if (written < buffer.size() || close(fd) == -1 || rename(temporary.c_str(), path.c_str()) == -1) {
+        int savedErrno = errno;
+        if (written < buffer.size()) {
+            close(fd);
+        }
+        unlink(temporary.c_str());
+        errno = savedErrno;
+        return false;
+    }
+    return true;
+}
+
+// Reads the strings of a mapped snapshot, every read checked against the end of the file
+class SnapshotReader {
+    const char* next;
+    const char* end;
+public:
+    SnapshotReader(const char* begin, const char* end) : next(begin), end(end) {}
+
+    bool read(string& value) {
+        uint32_t length;
+        if ((size_t)(end - next) < sizeof(length)) {
+            return false;
+        }
+        memcpy(&length, next, sizeof(length));
+        next += sizeof(length);
+        if ((size_t)(end - next) < length) {
+            return false;
+        }
+        value.assign(next, length);
+        next += length;
+        return true;
+    }
+};
+
+bool readSnapshot(const string& path, SnapshotState& state, string& error) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        error = path + ": " + strerror(errno);
+        if (fd != -1) {
+            close(fd);
+        }
+        return false;
+    }
+    if ((size_t)st.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        error = path + ": not a snapshot";
+        return false;
+    }
+    void* memory = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        error = path + ": " + strerror(errno);
+        return false;
+    }
+    const SnapshotHeader* header = (const SnapshotHeader*)memory;
+    const char* begin = (const char*)memory;
+    if (header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION ||
+        header->size != (uint64_t)st.st_size) {
+        munmap(memory, st.st_size);
+        error = path + ": not a snapshot of this version, or cut off";
+        return false;
+    }
+
+    // Every string takes at least its length, so no count can be larger than that. Checked before
+    // anything is allocated for them.
+    size_t maxStrings = (st.st_size - sizeof(SnapshotHeader)) / sizeof(uint32_t);
+    if (header->numAliases > maxStrings / 2 || header->numVariables > maxStrings) {
+        munmap(memory, st.st_size);
+        error = path + ": damaged snapshot";
+        return false;
+    }
+
+    // Everything is read before any of it is applied, so a damaged file changes nothing
+    SnapshotReader reader(begin + sizeof(SnapshotHeader), begin + st.st_size);
+    string prompt, cwd;
+    vector<pair<string, string>> aliases(header->numAliases);
+    vector<string> variables(header->numVariables);
+    bool valid = reader.read(prompt) && reader.read(cwd);
+    for (size_t i = 0; valid && i < aliases.size(); i++) {
+        valid = reader.read(aliases[i].first) && reader.read(aliases[i].second);
+    }
+    for (size_t i = 0; valid && i < variables.size(); i++) {
+        valid = reader.read(variables[i]) && Environment::isAssignment(variables[i]);
+    }
+    munmap(memory, st.st_size);
+    if (!valid) {
+        error = path + ": damaged snapshot";
+        return false;
+    }
+
+    state.prompt = move(prompt);
+    state.cwd = move(cwd);
+    state.aliases = move(aliases);
+    state.variables = move(variables);
+    return true;
+}
+
+void applySnapshot(SmallShell& smash, const SnapshotState& state) {
+    smash.setPrompt(state.prompt);
+    if (chdir(state.cwd.c_str()) == -1) {
+        perror("smash error: chdir failed");
+    }
+    for (const auto& alias : state.aliases) {
+        // The aliases were checked when they were defined, only names that became builtins since are left out
+        if (!smash.isAlias(alias.first) &&
+            SmallShell::RESERVED_KEYWORDS.find(alias.first) == SmallShell::RESERVED_KEYWORDS.end()) {
+            smash.addAlias(alias.first, alias.second);
+        }
+    }
+    for (const string& variable : state.variables) {
+        smash.getEnvironment().assign(variable);
+    }
+}
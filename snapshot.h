@@ -0,0 +1,45 @@
+#ifndef SMASH_SNAPSHOT_H_
+#define SMASH_SNAPSHOT_H_
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define SNAPSHOT_MAGIC (0x4e534d53) // "SMSN"
+#define SNAPSHOT_VERSION (1)
+
+class SmallShell;
+
+// Binary snapshot of the state of a smash, written by snapshot save and loaded by smash --snapshot FILE
+// instead of replaying an rc file line by line. The header is followed by strings, each a uint32_t
+// length and the bytes: the prompt, the cwd, the name and command of every alias in the order they were
+// defined, and NAME=value of every variable set in smash. Loading maps the file and copies the strings
+// out of it, none of them is parsed.
+struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size; // of the whole file, to tell a file that was cut off
+    uint32_t numAliases;
+    uint32_t numVariables;
+};
+
+// Returns false with errno set if the file could not be written. The file is replaced atomically.
+bool saveSnapshot(SmallShell& smash, const std::string& path);
+
+// What a snapshot holds, read without touching any shell, so smash --serve can read it once and every
+// session applies it to its own
+struct SnapshotState {
+    std::string prompt;
+    std::string cwd;
+    std::vector<std::pair<std::string, std::string>> aliases; // name and command, in definition order
+    std::vector<std::string> variables; // NAME=value
+};
+
+// Returns false with error set if the file is not a snapshot of this version
+bool readSnapshot(const std::string& path, SnapshotState& state, std::string& error);
+
+// A cwd that no longer exists is reported and skipped
+void applySnapshot(SmallShell& smash, const SnapshotState& state);
+
+#endif //SMASH_SNAPSHOT_H_
@@ -0,0 +1,241 @@
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "spawner.h"
+
+using namespace std;
+
+Spawner::Spawner() : submitted(0), eventFd(-1), started(false), stopped(false), disabled(false)
+{}
+
+Spawner::~Spawner() {
+    if (started && !disabled) {
+        flush();
+        {
+            lock_guard<mutex> guard(lock);
+            stopped = true;
+        }
+        requestsReady.notify_one();
+        thread.join();
+    }
+    if (eventFd != -1) {
+        close(eventFd);
+    }
+}
+
+bool Spawner::submit(SpawnRequest request) {
+    if (disabled) {
+        return false;
+    }
+    if (!started) {
+        eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (eventFd == -1) {
+            return false;
+        }
+        // The thread inherits the mask, so no signal is ever delivered to it instead of the signalfd
+        sigset_t all, old;
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, &old);
+        try {
+            thread = std::thread(&Spawner::run, this);
+            started = true;
+        } catch (const system_error&) {
+        }
+        pthread_sigmask(SIG_SETMASK, &old, nullptr);
+        if (!started) {
+            close(eventFd);
+            eventFd = -1;
+            return false;
+        }
+    }
+    queued.push_back(move(request));
+    submitted++;
+    return true;
+}
+
+void Spawner::flush() {
+    if (queued.empty() || disabled) {
+        return;
+    }
+    {
+        lock_guard<mutex> guard(lock);
+        for (SpawnRequest& request : queued) {
+            requests.push_back(move(request));
+        }
+    }
+    queued.clear();
+    requestsReady.notify_one();
+}
+
+int Spawner::getFd() const {
+    return disabled ? -1 : eventFd;
+}
+
+vector<SpawnResult> Spawner::takeResults(bool wait) {
+    vector<SpawnResult> taken;
+    if (!started || disabled) {
+        return taken;
+    }
+    // Cleared before taking, a result that comes in between only makes the next poll return early
+    uint64_t count;
+    if (read(eventFd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        return taken;
+    }
+    if (wait) {
+        flush();
+    }
+    unique_lock<mutex> guard(lock);
+    if (wait) {
+        allDone.wait(guard, [this]() { return results.size() == submitted; });
+    }
+    taken.swap(results);
+    submitted -= taken.size();
+    return taken;
+}
+
+size_t Spawner::inFlight() const {
+    return submitted;
+}
+
+void Spawner::reset() {
+    // The thread was not forked along, and the child leaves with _exit, so it is never joined
+    disabled = true;
+    if (eventFd != -1) {
+        close(eventFd);
+        eventFd = -1;
+    }
+}
+
+void Spawner::run() {
+    unique_lock<mutex> guard(lock);
+    while (true) {
+        requestsReady.wait(guard, [this]() { return !requests.empty() || stopped; });
+        // The jobs queued before quit are still started
+        if (requests.empty()) {
+            return;
+        }
+        SpawnRequest request = move(requests.front());
+        requests.pop_front();
+        guard.unlock();
+
+        SpawnResult result = {request.jobId, -1, 0};
+        result.error = spawnProgram(request, &result.pid);
+        if (result.error != 0) {
+            result.pid = -1;
+        }
+        if (request.outputFd != -1) {
+            close(request.outputFd);
+        }
+        for (int fd : request.stdFds) {
+            if (fd != -1) {
+                close(fd);
+            }
+        }
+
+        guard.lock();
+        results.push_back(result);
+        uint64_t one = 1;
+        if (write(eventFd, &one, sizeof(one)) == -1) {
+            // Only fails when the counter would overflow, the shell is woken up anyway
+        }
+        allDone.notify_all();
+    }
+}
+
+int spawnProgram(const SpawnRequest& request, pid_t* pid) {
+    if (request.args.empty()) {
+        return ENOENT;
+    }
+    vector<char*> argv;
+    argv.reserve(request.args.size() + 1);
+    for (const string& arg : request.args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    vector<char*> envp;
+    envp.reserve(request.env.size() + 1);
+    for (const string& entry : request.env) {
+        envp.push_back(const_cast<char*>(entry.c_str()));
+    }
+    envp.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    for (int fd = 0; fd < 3; fd++) {
+        if (request.stdFds[fd] != -1) {
+            posix_spawn_file_actions_adddup2(&actions, request.stdFds[fd], fd);
+        }
+    }
+    if (request.outputFd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, request.outputFd, STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, request.outputFd, STDERR_FILENO);
+    }
+    // The shell may have changed its cwd since the job was submitted
+    if (!request.cwd.empty()) {
+        posix_spawn_file_actions_addchdir_np(&actions, request.cwd.c_str());
+    }
+    // The job leads a process group of its own, and does not start with the signals of smash blocked
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setpgroup(&attr, 0);
+    sigset_t none;
+    sigemptyset(&none);
+    posix_spawnattr_setsigmask(&attr, &none);
+
+    auto spawnAt = [&](const string& file) {
+        int error = posix_spawn(pid, file.c_str(), &actions, &attr, argv.data(), envp.data());
+        if (error != ENOEXEC) {
+            return error;
+        }
+        // Like execvp, a file the kernel cannot run, a script without #!, is run by the shell
+        vector<char*> shellArgv;
+        shellArgv.reserve(argv.size() + 1);
+        shellArgv.push_back(const_cast<char*>(SPAWN_SHELL));
+        shellArgv.push_back(const_cast<char*>(file.c_str()));
+        shellArgv.insert(shellArgv.end(), argv.begin() + 1, argv.end());
+        return posix_spawn(pid, SPAWN_SHELL, &actions, &attr, shellArgv.data(), envp.data());
+    };
+    const string& name = request.args[0];
+    int error = ENOENT;
+    if (!request.path.empty()) {
+        error = spawnAt(request.path);
+    }
+    if (error != 0 && name.find('/') != string::npos) {
+        error = spawnAt(name);
+    } else if (error != 0) {
+        // A failed spawn costs a whole clone, so the directories are checked with access first, like
+        // execvp goes on past a file it may not run and reports EACCES if nothing else was found
+        const string& dirs = request.searchPath;
+        bool denied = false;
+        size_t start = 0;
+        while (start <= dirs.size()) {
+            size_t end = dirs.find(':', start);
+            if (end == string::npos) {
+                end = dirs.size();
+            }
+            string file = ((end > start) ? dirs.substr(start, end - start) : ".") + "/" + name;
+            string checked = (file[0] == '/' || request.cwd.empty()) ? file : request.cwd + "/" + file;
+            start = end + 1;
+            if (access(checked.c_str(), X_OK) == -1) {
+                denied = denied || errno == EACCES;
+                continue;
+            }
+            error = spawnAt(file);
+            if (error != ENOENT && error != ENOTDIR && error != EACCES) {
+                break;
+            }
+            denied = denied || error == EACCES;
+        }
+        if (error == ENOENT && denied) {
+            error = EACCES;
+        }
+    }
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return error;
+}
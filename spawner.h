@@ -0,0 +1,90 @@
+#ifndef SMASH_SPAWNER_H_
+#define SMASH_SPAWNER_H_
+
+#include <sys/types.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define SPAWN_DEFAULT_PATH "/bin:/usr/bin" // what execvp searches without PATH
+#define SPAWN_SHELL "/bin/sh" // runs a file without #!, as execvp does
+
+// Everything a background program needs to start, copied out of the shell so the spawner thread never
+// touches its state
+struct SpawnRequest {
+    int jobId;
+    std::vector<std::string> args;
+    std::string path;       // found by the dir cache, empty to search searchPath
+    std::string searchPath; // the PATH of the job
+    std::vector<std::string> env; // NAME=value
+    std::string cwd;
+    int outputFd; // stdout and stderr of the job in capture mode, -1 otherwise, closed by the spawner
+    // Copies of the shell's stdin, stdout and stderr when the job was submitted, -1 for a closed one,
+    // closed by the spawner. By the time the thread spawns, a builtin of the next line may have
+    // redirected the shell's own.
+    int stdFds[3];
+};
+
+struct SpawnResult {
+    int jobId;
+    pid_t pid;  // -1 if the program could not be started
+    int error;  // errno of the failed spawn
+};
+
+// Starts background jobs off the prompt. The shell hands a request over a queue and the job is listed
+// with its id right away; a thread of its own runs posix_spawn, which in glibc is a vfork-style clone
+// that neither copies the page tables of smash nor waits for them, and every job is a new process group.
+// Requests are only handed to the thread by flush, which the shell calls once it is idle or starts the
+// next line, so waking the thread never delays the prompt of the line that launched the job, also on a
+// single CPU. The results are collected by the shell's event loop when the eventfd turns readable. The
+// thread is started by the first request and blocks every signal, they stay with the signalfd of the shell.
+class Spawner {
+public:
+    Spawner();
+    ~Spawner();
+
+    Spawner(Spawner const &) = delete; // disable copy ctor
+    void operator=(Spawner const &) = delete; // disable = operator
+
+    // Queues a request, returns false if the thread could not be started or this is a forked child
+    bool submit(SpawnRequest request);
+
+    // Hands the queued requests to the thread
+    void flush();
+
+    // Readable when results are waiting, -1 before the first request
+    int getFd() const;
+
+    // The results so far, without blocking. With wait, first flushes and waits until no request is left.
+    std::vector<SpawnResult> takeResults(bool wait);
+
+    // Requests submitted and not taken back as results yet
+    size_t inFlight() const;
+
+    // A forked child has no spawner thread, it starts its jobs itself
+    void reset();
+
+private:
+    void run();
+
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable requestsReady;
+    std::condition_variable allDone;
+    std::vector<SpawnRequest> queued; // not flushed yet, only used by the shell
+    std::deque<SpawnRequest> requests;
+    std::vector<SpawnResult> results;
+    size_t submitted; // not taken as results yet, only used by the shell
+    int eventFd;
+    bool started;
+    bool stopped;
+    bool disabled; // in a forked child
+};
+
+// posix_spawn for a request, searching searchPath like execvp. Returns 0 or an errno value.
+int spawnProgram(const SpawnRequest& request, pid_t* pid);
+
+#endif //SMASH_SPAWNER_H_
@@ -0,0 +1,58 @@
+#!/bin/sh
+# Feeds smash random background jobs and jobs calls while smash_jobs -c reads its shared job table
+# at the same time, and fails if smash_jobs found an inconsistent snapshot or could not run.
+#   ./stress_jobs.sh [JOBS [CHECKS [SEED]]]
+JOBS=${1:-6000}
+CHECKS=${2:-300000}
+SEED=${3:-$$}
+
+fifo=$(mktemp -u /tmp/smash_stress.XXXXXX)
+mkfifo "$fifo" || exit 1
+trap 'rm -f "$fifo"' EXIT
+
+SMASH_HISTFILE= ./smash < "$fifo" > /dev/null 2>&1 &
+smash=$!
+exec 3> "$fifo"
+
+# The table exists once smash is past its setup
+tries=0
+while [ ! -e /dev/shm/smash-jobs-$smash ]; do
+    tries=$((tries + 1))
+    if [ $tries -gt 100 ]; then
+        echo "stress_jobs: smash $smash published no job table" >&2
+        kill $smash 2> /dev/null
+        exit 1
+    fi
+    sleep 0.05
+done
+
+./smash_jobs -c "$CHECKS" $smash &
+checker=$!
+
+echo "stress_jobs: $JOBS jobs, $CHECKS snapshots, seed $SEED"
+awk -v jobs="$JOBS" -v seed="$SEED" 'BEGIN {
+    srand(seed);
+    for (i = 0; i < jobs; i++) {
+        r = int(rand() * 4);
+        if (r == 0) {
+            print "/bin/true &";
+        } else if (r == 1) {
+            printf "sleep 0.%02d &\n", int(rand() * 50);
+        } else {
+            printf "sh -c \"exit %d\" &\n", int(rand() * 4);
+        }
+        if (rand() < 0.05) {
+            print "jobs";
+        }
+    }
+}' >&3
+
+wait $checker
+status=$?
+echo "quit kill" >&3
+exec 3>&-
+wait $smash
+if [ $status -ne 0 ]; then
+    echo "stress_jobs: smash_jobs exited with $status" >&2
+fi
+exit $status
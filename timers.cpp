@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "timers.h"
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SIZE - 1)
+
+Timer::Timer() : prev(nullptr), next(nullptr), expires(0), armed(false), callback(nullptr), data(nullptr)
+{}
+
+TimerWheel::TimerWheel() : currentTick(now()), count(0) {
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < TIMER_WHEEL_SIZE; slot++) {
+            slots[level][slot].prev = &slots[level][slot];
+            slots[level][slot].next = &slots[level][slot];
+        }
+    }
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (timerFd == -1) {
+        perror("smash error: timerfd_create failed");
+    }
+}
+
+TimerWheel::~TimerWheel() {
+    if (timerFd != -1) {
+        close(timerFd);
+    }
+}
+
+int TimerWheel::getFd() const {
+    return timerFd;
+}
+
+bool TimerWheel::isEmpty() const {
+    return count == 0;
+}
+
+void TimerWheel::reset() {
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < TIMER_WHEEL_SIZE; slot++) {
+            Timer* head = &slots[level][slot];
+            while (head->next != head) {
+                Timer* timer = head->next;
+                unlink(timer);
+                timer->armed = false;
+            }
+        }
+    }
+    count = 0;
+
+    // The inherited timerfd is shared with the parent, arming it here would move the parent's deadline
+    if (timerFd != -1) {
+        close(timerFd);
+    }
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+}
+
+uint64_t TimerWheel::now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * (1000 / TIMER_TICK_MS) + ts.tv_nsec / (TIMER_TICK_MS * 1000000L);
+}
+
+void TimerWheel::link(Timer* timer) {
+    // A timer that is already due fires on the next tick
+    uint64_t tick = (timer->expires > currentTick) ? timer->expires : currentTick + 1;
+    uint64_t delta = tick - currentTick;
+
+    // Timers further away than the wheel covers wait in the last slot reached, and are re-linked from there
+    const uint64_t maxDelta = (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+    if (delta > maxDelta) {
+        tick = currentTick + maxDelta;
+        delta = maxDelta;
+    }
+
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    Timer* head = &slots[level][(tick >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK];
+
+    timer->next = head->next;
+    timer->prev = head;
+    head->next->prev = timer;
+    head->next = timer;
+}
+
+void TimerWheel::unlink(Timer* timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = nullptr;
+    timer->next = nullptr;
+}
+
+void TimerWheel::add(Timer* timer, long delayMs) {
+    if (timer->armed) {
+        unlink(timer);
+        count--;
+    }
+    if (count == 0) {
+        // Nothing was pending, so no tick had to be processed since the wheel was last used
+        currentTick = now();
+    }
+
+    timer->expires = now() + (delayMs + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    timer->armed = true;
+    link(timer);
+    count++;
+    rearm();
+}
+
+void TimerWheel::cancel(Timer* timer) {
+    if (!timer->armed) {
+        return;
+    }
+    unlink(timer);
+    timer->armed = false;
+    count--;
+    rearm();
+}
+
+void TimerWheel::processTick() {
+    currentTick++;
+
+    // When a level wraps around, the timers of the next slot of the level above move down
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        if ((currentTick & ((1ULL << (TIMER_WHEEL_BITS * level)) - 1)) != 0) {
+            break;
+        }
+        Timer* head = &slots[level][(currentTick >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK];
+        while (head->next != head) {
+            Timer* timer = head->next;
+            unlink(timer);
+            link(timer);
+        }
+    }
+
+    Timer* head = &slots[0][currentTick & TIMER_WHEEL_MASK];
+    Timer pending;
+    pending.prev = &pending;
+    pending.next = &pending;
+    while (head->next != head) {
+        Timer* timer = head->next;
+        unlink(timer);
+        if (timer->expires > currentTick) {
+            // Parked in this slot because it was too far away, put it back on the wheel
+            timer->next = pending.next;
+            timer->prev = &pending;
+            pending.next->prev = timer;
+            pending.next = timer;
+            continue;
+        }
+        timer->armed = false;
+        count--;
+        // The callback may add the timer again
+        timer->callback(timer);
+    }
+    while (pending.next != &pending) {
+        Timer* timer = pending.next;
+        unlink(timer);
+        link(timer);
+    }
+}
+
+void TimerWheel::advance() {
+    uint64_t expirations;
+    if (read(timerFd, &expirations, sizeof(expirations)) == -1) {
+        // Not expired yet, which is fine when advance is called for another reason
+    }
+    uint64_t target = now();
+    while (count > 0 && currentTick < target) {
+        processTick();
+    }
+    if (count == 0) {
+        currentTick = target;
+    }
+    rearm();
+}
+
+void TimerWheel::rearm() {
+    struct itimerspec timer;
+    memset(&timer, 0, sizeof(timer));
+    if (count > 0) {
+        // Wake up at the next non-empty slot of the first level, or when the first level wraps around
+        // and the level above has to be cascaded
+        uint64_t wakeTick = (currentTick | TIMER_WHEEL_MASK) + 1;
+        for (uint64_t tick = currentTick + 1; tick < wakeTick; tick++) {
+            Timer* head = &slots[0][tick & TIMER_WHEEL_MASK];
+            if (head->next != head) {
+                wakeTick = tick;
+                break;
+            }
+        }
+        uint64_t nowTick = now();
+        long delayMs = (wakeTick > nowTick) ? (long)(wakeTick - nowTick) * TIMER_TICK_MS : 1;
+        timer.it_value.tv_sec = delayMs / 1000;
+        timer.it_value.tv_nsec = (delayMs % 1000) * 1000000L;
+    }
+    timerfd_settime(timerFd, 0, &timer, nullptr);
+}
+
+long TimerWheel::remainingMs(const Timer* timer) const {
+    if (!timer->armed) {
+        return 0;
+    }
+    uint64_t nowTick = now();
+    return (timer->expires > nowTick) ? (long)(timer->expires - nowTick) * TIMER_TICK_MS : 0;
+}
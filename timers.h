@@ -0,0 +1,61 @@
+#ifndef SMASH_TIMERS_H_
+#define SMASH_TIMERS_H_
+
+#include <stdint.h>
+
+#define TIMER_TICK_MS (10)
+#define TIMER_WHEEL_LEVELS (4)
+#define TIMER_WHEEL_BITS (6)
+#define TIMER_WHEEL_SIZE (1 << TIMER_WHEEL_BITS)
+
+// A deadline registered in a TimerWheel. The timer is owned by the caller, the wheel only links it.
+struct Timer {
+    Timer* prev;
+    Timer* next;
+    uint64_t expires; // tick at which the timer fires
+    bool armed;
+    void (*callback)(Timer* timer); // called by advance once the deadline passes
+    void* data;
+
+    Timer();
+};
+
+// Hierarchical timer wheel: 4 levels of 64 slots with a 10ms tick, so adding, cancelling and
+// firing a timer is O(1) however many timers are pending. The whole wheel is driven by a single
+// one-shot timerfd that is re-armed for the next tick that has work to do.
+class TimerWheel {
+public:
+    TimerWheel();
+    ~TimerWheel();
+
+    TimerWheel(TimerWheel const &) = delete; // disable copy ctor
+    void operator=(TimerWheel const &) = delete; // disable = operator
+
+    void add(Timer* timer, long delayMs);
+    void cancel(Timer* timer);
+    bool isEmpty() const;
+
+    // Drops the timers inherited by a forked child and gives it a timerfd of its own
+    void reset();
+
+    // Readable when timers are due
+    int getFd() const;
+    // Fires the timers that are due and re-arms the timerfd, called by the event loop
+    void advance();
+
+    long remainingMs(const Timer* timer) const;
+
+private:
+    Timer slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE]; // list heads
+    uint64_t currentTick; // the last tick that was processed
+    long count;
+    int timerFd;
+
+    static uint64_t now();
+    void link(Timer* timer);
+    void unlink(Timer* timer);
+    void processTick();
+    void rearm();
+};
+
+#endif //SMASH_TIMERS_H_
@@ -0,0 +1,172 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <atomic>
+#include <new>
+#include <set>
+#include "trace.h"
+
+using namespace std;
+
+struct TraceSlot {
+    uint64_t timestamp; // ns
+    uint64_t duration;  // ns, for 'X' events
+    pid_t tid;
+    char phase;
+    std::atomic<bool> ready; // set last, a slot claimed by a process that died half-way is skipped
+    char name[TRACE_NAME_SIZE];
+};
+
+struct TraceBuffer {
+    std::atomic<uint64_t> next; // claimed slots, counting the dropped events past the end
+    pid_t owner;                // the shell that started the session
+    uint64_t start;             // timestamps are written relative to the start of the session
+    TraceSlot slots[TRACE_MAX_EVENTS];
+};
+
+TraceBuffer* traceBuffer = nullptr;
+static int traceFd = -1;
+
+uint64_t traceNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool traceStart(const string& path) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return false;
+    }
+    // Populated up front, so recording an event never takes a page fault
+    void* memory = mmap(nullptr, sizeof(TraceBuffer), PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (memory == MAP_FAILED) {
+        int savedErrno = errno;
+        close(fd);
+        errno = savedErrno;
+        return false;
+    }
+    // The mapping is zero-filled, which is also the initial state of the atomics
+    TraceBuffer* buffer = new (memory) TraceBuffer;
+    buffer->owner = getpid();
+    buffer->start = traceNow();
+    traceFd = fd;
+    traceBuffer = buffer;
+    return true;
+}
+
+void traceRecord(char phase, const char* name, pid_t tid, uint64_t startNs) {
+    // A span that began before the session, or that is not traced at all
+    if (phase == 'X' && startNs == 0) {
+        return;
+    }
+    uint64_t index = traceBuffer->next.fetch_add(1, memory_order_relaxed);
+    if (index >= TRACE_MAX_EVENTS) {
+        return;
+    }
+    TraceSlot& slot = traceBuffer->slots[index];
+    uint64_t now = traceNow();
+    slot.timestamp = (phase == 'X') ? startNs : now;
+    slot.duration = (phase == 'X') ? now - startNs : 0;
+    slot.tid = tid;
+    slot.phase = phase;
+    strncpy(slot.name, name, TRACE_NAME_SIZE - 1);
+    slot.name[TRACE_NAME_SIZE - 1] = '\0';
+    slot.ready.store(true, memory_order_release);
+}
+
+void appendJsonString(string& out, const char* text) {
+    out += '"';
+    for (const char* c = text; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            out += '\\';
+            out += *c;
+        } else if ((unsigned char)*c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", *c);
+            out += escaped;
+        } else {
+            out += *c;
+        }
+    }
+    out += '"';
+}
+
+// Microseconds with the nanoseconds kept as decimals, the unit of the trace-event format
+static void appendMicros(string& out, uint64_t ns) {
+    char number[32];
+    snprintf(number, sizeof(number), "%llu.%03llu", (unsigned long long)(ns / 1000), (unsigned long long)(ns % 1000));
+    out += number;
+}
+
+static bool writeAll(int fd, const string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t length = write(fd, data.data() + written, data.size() - written);
+        if (length == -1 && errno != EINTR) {
+            return false;
+        }
+        written += (length > 0) ? length : 0;
+    }
+    return true;
+}
+
+bool traceStop(uint64_t* dropped) {
+    TraceBuffer* buffer = traceBuffer;
+    traceBuffer = nullptr;
+    uint64_t count = buffer->next.load(memory_order_acquire);
+    *dropped = (count > TRACE_MAX_EVENTS) ? count - TRACE_MAX_EVENTS : 0;
+    count -= *dropped;
+
+    string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    char line[128];
+    snprintf(line, sizeof(line), "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"smash\"}}",
+             buffer->owner, buffer->owner);
+    out += line;
+    // Every process gets a track named after the first thing it ran
+    set<pid_t> named;
+    for (uint64_t i = 0; i < count; i++) {
+        const TraceSlot& slot = buffer->slots[i];
+        if (!slot.ready.load(memory_order_acquire)) {
+            continue;
+        }
+        if ((slot.phase == 'B' || slot.tid == buffer->owner) && named.insert(slot.tid).second) {
+            snprintf(line, sizeof(line), ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":",
+                     buffer->owner, slot.tid);
+            out += line;
+            if (slot.tid == buffer->owner) {
+                out += "\"smash\"";
+            } else {
+                appendJsonString(out, slot.name);
+            }
+            out += "}}";
+        }
+        snprintf(line, sizeof(line), ",\n{\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"ts\":", slot.phase, buffer->owner, slot.tid);
+        out += line;
+        appendMicros(out, slot.timestamp - buffer->start);
+        if (slot.phase == 'X') {
+            out += ",\"dur\":";
+            appendMicros(out, slot.duration);
+        } else if (slot.phase == 'i') {
+            out += ",\"s\":\"t\"";
+        }
+        out += ",\"name\":";
+        appendJsonString(out, slot.name);
+        out += "}";
+    }
+    out += "\n]}\n";
+
+    bool success = writeAll(traceFd, out);
+    int savedErrno = errno;
+    close(traceFd);
+    traceFd = -1;
+    // Children still running keep their own mapping of the buffer, recording into it is harmless
+    munmap(buffer, sizeof(TraceBuffer));
+    errno = savedErrno;
+    return success;
+}
@@ -0,0 +1,55 @@
+#ifndef SMASH_TRACE_H_
+#define SMASH_TRACE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+
+#define TRACE_MAX_EVENTS (64 * 1024)
+#define TRACE_NAME_SIZE (64)
+
+struct TraceBuffer;
+
+// Null while tracing is off, so a disabled trace point costs a single branch
+extern TraceBuffer* traceBuffer;
+
+// Recording for the trace builtin. The events of a session go to a buffer preallocated with
+// mmap(MAP_SHARED) before any fork, so the children of smash record their own events into the same
+// buffer: a slot is claimed with an atomic increment and nothing is allocated, locked or written out
+// while commands run. Once the buffer is full new events are counted as dropped. traceStop writes the
+// session in the Chrome trace-event JSON format, one track per process, for chrome://tracing or Perfetto.
+
+// Opens the output file and maps the buffer, returns false with errno set on failure
+bool traceStart(const std::string& path);
+
+// Writes the events recorded so far, returns false with errno set if the file could not be written.
+// dropped is set to the number of events that did not fit in the buffer.
+bool traceStop(uint64_t* dropped);
+
+// phase is one of the Chrome phases: 'B' and 'E' open and close a span on the track of process tid,
+// 'i' is an instant and 'X' a span that started at startNs (a traceNow value), dropped if startNs is 0
+void traceRecord(char phase, const char* name, pid_t tid, uint64_t startNs = 0);
+
+// CLOCK_MONOTONIC in nanoseconds
+uint64_t traceNow();
+
+// Appends text as a quoted JSON string, also used by the JSON report of bench
+void appendJsonString(std::string& out, const char* text);
+
+inline bool traceEnabled() {
+    return traceBuffer != nullptr;
+}
+
+inline void traceEvent(char phase, const char* name, pid_t tid, uint64_t startNs = 0) {
+    if (traceBuffer != nullptr) {
+        traceRecord(phase, name, tid, startNs);
+    }
+}
+
+inline void traceEvent(char phase, const std::string& name, pid_t tid, uint64_t startNs = 0) {
+    if (traceBuffer != nullptr) {
+        traceRecord(phase, name.c_str(), tid, startNs);
+    }
+}
+
+#endif //SMASH_TRACE_H_
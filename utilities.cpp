@@ -0,0 +1,660 @@
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <iostream>
+#include "utilities.h"
+#include "Commands.h"
+#include "walk.h"
+
+using namespace std;
+
+namespace {
+
+//----------------------------------- sleep -----------------------------------
+
+// Adds up the durations of sleep: numbers with an optional s, m, h or d suffix.
+// Hex numbers, infinity and such are left to coreutils.
+bool parseSleep(const vector<string>& args, double* seconds) {
+    *seconds = 0;
+    for (size_t i = 1; i < args.size(); i++) {
+        const string& arg = args[i];
+        if (arg.empty() || !(isdigit(arg[0]) || arg[0] == '.') || arg.find_first_of("xX") != string::npos) {
+            return false;
+        }
+        char* end;
+        errno = 0;
+        double value = strtod(arg.c_str(), &end);
+        string suffix(end);
+        if (errno != 0 || end == arg.c_str()) {
+            return false;
+        }
+        if (suffix == "m") {
+            value *= 60;
+        } else if (suffix == "h") {
+            value *= 60 * 60;
+        } else if (suffix == "d") {
+            value *= 24 * 60 * 60;
+        } else if (!suffix.empty() && suffix != "s") {
+            return false;
+        }
+        *seconds += value;
+    }
+    // Longer sleeps are left to coreutils, it can sleep until the end of time
+    return args.size() > 1 && *seconds < 1e9;
+}
+
+int runSleep(double seconds) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    double whole = floor(seconds);
+    deadline.tv_sec += (time_t)whole;
+    deadline.tv_nsec += (long)((seconds - whole) * 1e9);
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    SmallShell& smash = SmallShell::getInstance();
+    if (smash.isInChild()) {
+        // A forked job gets its signals the usual way, so it can simply sleep
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR) {
+        }
+        return 0;
+    }
+    while (true) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double remaining = (deadline.tv_sec - now.tv_sec) + (deadline.tv_nsec - now.tv_nsec) / 1e9;
+        if (remaining <= 0) {
+            return 0;
+        }
+        smash.waitForEvents(-1, (int)min(ceil(remaining * 1000), (double)INT_MAX));
+        if (smash.takeInterrupt()) {
+            return 128 + SIGINT;
+        }
+    }
+}
+
+//---------------------------------- escapes ----------------------------------
+
+int octalDigit(char c) {
+    return (c >= '0' && c <= '7') ? c - '0' : -1;
+}
+
+int hexDigit(char c) {
+    if (isdigit((unsigned char)c)) {
+        return c - '0';
+    }
+    c = tolower((unsigned char)c);
+    return (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+}
+
+// The escapes of echo -e. Returns false if the output ends at \c.
+bool echoEscapes(const string& str, string& out) {
+    for (size_t i = 0; i < str.length(); i++) {
+        if (str[i] != '\\' || i + 1 == str.length()) {
+            out += str[i];
+            continue;
+        }
+        char c = str[++i];
+        switch (c) {
+            case 'a': out += '\a'; break;
+            case 'b': out += '\b'; break;
+            case 'c': return false;
+            case 'e': out += '\x1B'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'v': out += '\v'; break;
+            case '\\': out += '\\'; break;
+            case 'x': {
+                int value = (i + 1 < str.length()) ? hexDigit(str[i + 1]) : -1;
+                if (value == -1) {
+                    out += "\\x";
+                    break;
+                }
+                i++;
+                if (i + 1 < str.length() && hexDigit(str[i + 1]) != -1) {
+                    value = value * 16 + hexDigit(str[++i]);
+                }
+                out += (char)value;
+                break;
+            }
+            default: {
+                if (octalDigit(c) == -1) {
+                    out += '\\';
+                    out += c;
+                    break;
+                }
+                // \0 takes up to three more digits, \1 to \7 up to two
+                int value = octalDigit(c);
+                int maxDigits = (c == '0') ? 3 : 2;
+                for (int digits = 0; digits < maxDigits && i + 1 < str.length() && octalDigit(str[i + 1]) != -1;
+                     digits++) {
+                    value = value * 8 + octalDigit(str[++i]);
+                }
+                out += (char)value;
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+// The escapes of a printf format, or of a %b argument if inArgument. Sets stop at \c.
+// Returns false for escapes left to coreutils, such as \u.
+bool printfEscapes(const string& str, bool inArgument, string& out, bool* stop) {
+    for (size_t i = 0; i < str.length(); i++) {
+        if (str[i] != '\\' || i + 1 == str.length()) {
+            out += str[i];
+            continue;
+        }
+        char c = str[++i];
+        if (c == 'x') {
+            int value = (i + 1 < str.length()) ? hexDigit(str[i + 1]) : -1;
+            if (value == -1) {
+                return false;
+            }
+            i++;
+            if (i + 1 < str.length() && hexDigit(str[i + 1]) != -1) {
+                value = value * 16 + hexDigit(str[++i]);
+            }
+            out += (char)value;
+        } else if (octalDigit(c) != -1) {
+            // \ooo in a format, \0ooo in an argument
+            size_t start = (inArgument && c == '0') ? i + 1 : i;
+            int value = 0;
+            size_t end = start;
+            while (end < str.length() && end < start + 3 && octalDigit(str[end]) != -1) {
+                value = value * 8 + octalDigit(str[end++]);
+            }
+            i = end - 1;
+            out += (char)value;
+        } else if (c == 'c') {
+            *stop = true;
+            return true;
+        } else if (strchr("\"\\abefnrtv", c) != nullptr) {
+            const char* from = "\"\\abefnrtv";
+            const char* to = "\"\\\a\b\x1B\f\n\r\t\v";
+            out += to[strchr(from, c) - from];
+        } else if (c == 'u' || c == 'U') {
+            return false;
+        } else {
+            out += '\\';
+            out += c;
+        }
+    }
+    return true;
+}
+
+//------------------------------------ echo -----------------------------------
+
+int runEcho(const vector<string>& args) {
+    // Leading words made only of n, e and E are options
+    bool newline = true;
+    bool escapes = false;
+    size_t i = 1;
+    for (; i < args.size(); i++) {
+        const string& arg = args[i];
+        if (arg.length() < 2 || arg[0] != '-' || arg.find_first_not_of("neE", 1) != string::npos) {
+            break;
+        }
+        for (size_t j = 1; j < arg.length(); j++) {
+            newline = newline && arg[j] != 'n';
+            escapes = (arg[j] == 'e') || (escapes && arg[j] != 'E');
+        }
+    }
+    string out;
+    for (size_t first = i; i < args.size(); i++) {
+        out += (i > first) ? " " : "";
+        if (!escapes) {
+            out += args[i];
+        } else if (!echoEscapes(args[i], out)) {
+            newline = false;
+            break;
+        }
+    }
+    if (newline) {
+        out += '\n';
+    }
+    cout.write(out.data(), out.length());
+    return 0;
+}
+
+//------------------------------------ test -----------------------------------
+
+// Splits an integer of test into its sign and digits without leading zeros, like coreutils it may
+// be surrounded by white space and have any number of digits
+bool parseInteger(const string& str, bool* negative, string* digits) {
+    size_t start = str.find_first_not_of(" \t\n\v\f\r");
+    if (start == string::npos) {
+        return false;
+    }
+    *negative = (str[start] == '-');
+    if (str[start] == '-' || str[start] == '+') {
+        start++;
+    }
+    size_t end = start;
+    while (end < str.length() && isdigit((unsigned char)str[end])) {
+        end++;
+    }
+    if (end == start || str.find_first_not_of(" \t\n\v\f\r", end) != string::npos) {
+        return false;
+    }
+    *digits = str.substr(start, end - start);
+    digits->erase(0, min(digits->find_first_not_of('0'), digits->length()));
+    *negative = *negative && !digits->empty();
+    return true;
+}
+
+int compareIntegers(bool negativeA, const string& a, bool negativeB, const string& b) {
+    if (negativeA != negativeB) {
+        return negativeA ? -1 : 1;
+    }
+    int magnitude = (a.length() != b.length()) ? (a.length() < b.length() ? -1 : 1) : a.compare(b);
+    magnitude = (magnitude > 0) - (magnitude < 0);
+    return negativeA ? -magnitude : magnitude;
+}
+
+bool isUnaryTest(const string& op) {
+    return op.length() == 2 && op[0] == '-' && strchr("bcdefgGhkLnNOprsStuwxz", op[1]) != nullptr;
+}
+
+bool isBinaryTest(const string& op) {
+    static const vector<string> OPS = {"=", "==", "!=", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+                                       "-nt", "-ot", "-ef", "-a", "-o"};
+    return find(OPS.begin(), OPS.end(), op) != OPS.end();
+}
+
+bool unaryTest(const string& op, const string& arg, bool* result) {
+    struct stat st;
+    char c = op[1];
+    if (c == 'n' || c == 'z') {
+        *result = (c == 'n') == !arg.empty();
+        return true;
+    }
+    if (c == 't') {
+        bool negative;
+        string digits;
+        if (!parseInteger(arg, &negative, &digits) || digits.length() > 9) {
+            return false;
+        }
+        *result = !negative && isatty(atoi(digits.c_str()));
+        return true;
+    }
+    if (c == 'r' || c == 'w' || c == 'x') {
+        *result = access(arg.c_str(), (c == 'r') ? R_OK : (c == 'w') ? W_OK : X_OK) == 0;
+        return true;
+    }
+    if (c == 'h' || c == 'L') {
+        *result = lstat(arg.c_str(), &st) == 0 && S_ISLNK(st.st_mode);
+        return true;
+    }
+    if (stat(arg.c_str(), &st) != 0) {
+        *result = false;
+        return true;
+    }
+    switch (c) {
+        case 'b': *result = S_ISBLK(st.st_mode); break;
+        case 'c': *result = S_ISCHR(st.st_mode); break;
+        case 'd': *result = S_ISDIR(st.st_mode); break;
+        case 'e': *result = true; break;
+        case 'f': *result = S_ISREG(st.st_mode); break;
+        case 'g': *result = (st.st_mode & S_ISGID) != 0; break;
+        case 'G': *result = st.st_gid == getegid(); break;
+        case 'k': *result = (st.st_mode & S_ISVTX) != 0; break;
+        case 'N': *result = st.st_atim.tv_sec < st.st_mtim.tv_sec ||
+                            (st.st_atim.tv_sec == st.st_mtim.tv_sec && st.st_atim.tv_nsec < st.st_mtim.tv_nsec);
+                  break;
+        case 'O': *result = st.st_uid == geteuid(); break;
+        case 'p': *result = S_ISFIFO(st.st_mode); break;
+        case 's': *result = st.st_size > 0; break;
+        case 'S': *result = S_ISSOCK(st.st_mode); break;
+        case 'u': *result = (st.st_mode & S_ISUID) != 0; break;
+    }
+    return true;
+}
+
+bool binaryTest(const string& a, const string& op, const string& b, bool* result) {
+    if (op == "=" || op == "==" || op == "!=") {
+        *result = (a == b) == (op != "!=");
+        return true;
+    }
+    if (op == "-a" || op == "-o") {
+        *result = (op == "-a") ? (!a.empty() && !b.empty()) : (!a.empty() || !b.empty());
+        return true;
+    }
+    if (op == "-nt" || op == "-ot" || op == "-ef") {
+        struct stat stA, stB;
+        bool hasA = stat(a.c_str(), &stA) == 0;
+        bool hasB = stat(b.c_str(), &stB) == 0;
+        if (op == "-ef") {
+            *result = hasA && hasB && stA.st_dev == stB.st_dev && stA.st_ino == stB.st_ino;
+            return true;
+        }
+        // A file that exists is newer than one that does not
+        int order;
+        if (!hasA || !hasB) {
+            order = hasA - hasB;
+        } else if (stA.st_mtim.tv_sec != stB.st_mtim.tv_sec) {
+            order = (stA.st_mtim.tv_sec < stB.st_mtim.tv_sec) ? -1 : 1;
+        } else {
+            order = (stA.st_mtim.tv_nsec > stB.st_mtim.tv_nsec) - (stA.st_mtim.tv_nsec < stB.st_mtim.tv_nsec);
+        }
+        *result = (op == "-nt") ? order > 0 : order < 0;
+        return true;
+    }
+    bool negativeA, negativeB;
+    string digitsA, digitsB;
+    if (!parseInteger(a, &negativeA, &digitsA) || !parseInteger(b, &negativeB, &digitsB)) {
+        return false;
+    }
+    int order = compareIntegers(negativeA, digitsA, negativeB, digitsB);
+    if (op == "-eq") *result = order == 0;
+    else if (op == "-ne") *result = order != 0;
+    else if (op == "-lt") *result = order < 0;
+    else if (op == "-le") *result = order <= 0;
+    else if (op == "-gt") *result = order > 0;
+    else *result = order >= 0;
+    return true;
+}
+
+// Evaluates up to four operands by the POSIX rules for their number. Longer expressions and
+// anything that would be an error are left to coreutils.
+bool evaluateTest(const vector<string>& operands, size_t first, size_t count, bool* result) {
+    const string* op = operands.data() + first;
+    switch (count) {
+        case 0:
+            *result = false;
+            return true;
+        case 1:
+            *result = !op[0].empty();
+            return true;
+        case 2:
+            if (op[0] == "!") {
+                *result = op[1].empty();
+                return true;
+            }
+            return isUnaryTest(op[0]) && unaryTest(op[0], op[1], result);
+        case 3:
+            if (isBinaryTest(op[1])) {
+                return binaryTest(op[0], op[1], op[2], result);
+            }
+            if (op[0] == "!" && evaluateTest(operands, first + 1, 2, result)) {
+                *result = !*result;
+                return true;
+            }
+            if (op[0] == "(" && op[2] == ")") {
+                return evaluateTest(operands, first + 1, 1, result);
+            }
+            return false;
+        case 4:
+            if (op[0] == "!" && evaluateTest(operands, first + 1, 3, result)) {
+                *result = !*result;
+                return true;
+            }
+            if (op[0] == "(" && op[3] == ")") {
+                return evaluateTest(operands, first + 1, 2, result);
+            }
+            return false;
+    }
+    return false;
+}
+
+// [ needs a closing ]
+bool testOperands(const vector<string>& args, size_t* count) {
+    *count = args.size() - 1;
+    if (args[0] == "[") {
+        if (args.size() < 2 || args.back() != "]") {
+            return false;
+        }
+        (*count)--;
+    }
+    return true;
+}
+
+//----------------------------------- printf ----------------------------------
+
+// A numeric argument of printf: a C integer constant (0x, leading 0 for octal) or a character
+// constant like 'a. Anything coreutils would complain about is refused.
+bool printfInteger(const string& arg, bool isSigned, long long* value) {
+    if (arg.empty()) {
+        *value = 0;
+        return true;
+    }
+    if ((arg[0] == '\'' || arg[0] == '"') && arg.length() == 2) {
+        *value = (unsigned char)arg[1];
+        return true;
+    }
+    char* end;
+    errno = 0;
+    *value = isSigned ? strtoll(arg.c_str(), &end, 0) : (long long)strtoull(arg.c_str(), &end, 0);
+    return errno == 0 && end != arg.c_str() && *end == '\0';
+}
+
+bool printfFloat(const string& arg, long double* value) {
+    if (arg.empty()) {
+        *value = 0;
+        return true;
+    }
+    if ((arg[0] == '\'' || arg[0] == '"') && arg.length() == 2) {
+        *value = (unsigned char)arg[1];
+        return true;
+    }
+    char* end;
+    errno = 0;
+    *value = strtold(arg.c_str(), &end);
+    return errno == 0 && end != arg.c_str() && *end == '\0';
+}
+
+// Formats like printf FORMAT ARGS..., reusing the format while arguments are left. Returns false
+// for whatever is left to coreutils.
+bool formatPrintf(const vector<string>& args, string& out) {
+    size_t formatIndex = (args.size() > 2 && args[1] == "--") ? 2 : 1;
+    if (formatIndex >= args.size()) {
+        return false;
+    }
+    const string& format = args[formatIndex];
+    size_t next = formatIndex + 1;
+    bool stop = false;
+    do {
+        size_t usedBefore = next;
+        string literal;
+        for (size_t i = 0; i < format.length() && !stop; i++) {
+            if (format[i] == '\\') {
+                // Escapes are handled with the rest of the literal text
+                size_t end = i + 1;
+                if (end < format.length()) {
+                    end++;
+                }
+                while (end < format.length() && format[end] != '\\' && format[end] != '%') {
+                    end++;
+                }
+                if (!printfEscapes(format.substr(i, end - i), false, out, &stop)) {
+                    return false;
+                }
+                i = end - 1;
+                continue;
+            }
+            if (format[i] != '%') {
+                out += format[i];
+                continue;
+            }
+            if (i + 1 < format.length() && format[i + 1] == '%') {
+                out += '%';
+                i++;
+                continue;
+            }
+
+            // %[flags][width][.precision]conversion
+            string spec = "%";
+            size_t j = i + 1;
+            while (j < format.length() && strchr("-+ #0", format[j]) != nullptr) {
+                spec += format[j++];
+            }
+            bool hasWidth = false;
+            for (int part = 0; part < 2; part++) {
+                if (part == 1) {
+                    if (j >= format.length() || format[j] != '.') {
+                        break;
+                    }
+                    spec += format[j++];
+                }
+                if (j < format.length() && format[j] == '*') {
+                    long long value = 0;
+                    if (next < args.size() && !printfInteger(args[next], true, &value)) {
+                        return false;
+                    }
+                    if (value < INT_MIN || value > INT_MAX) {
+                        return false;
+                    }
+                    next++;
+                    spec += to_string(value);
+                    j++;
+                    hasWidth = true;
+                } else {
+                    while (j < format.length() && isdigit((unsigned char)format[j])) {
+                        spec += format[j++];
+                        hasWidth = true;
+                    }
+                }
+            }
+            if (j >= format.length()) {
+                return false;
+            }
+            char conversion = format[j];
+            i = j;
+            string arg = (next < args.size()) ? args[next] : "";
+            next++;
+
+            char buffer[512];
+            int length;
+            if (conversion == 's') {
+                string full = spec + "s";
+                length = snprintf(nullptr, 0, full.c_str(), arg.c_str());
+                vector<char> text(length + 1);
+                snprintf(text.data(), text.size(), full.c_str(), arg.c_str());
+                out.append(text.data(), length);
+                continue;
+            } else if (conversion == 'b') {
+                if (spec != "%" || hasWidth) {
+                    return false;
+                }
+                if (!printfEscapes(arg, true, out, &stop)) {
+                    return false;
+                }
+                continue;
+            } else if (conversion == 'c') {
+                length = snprintf(buffer, sizeof(buffer), (spec + "c").c_str(), arg.empty() ? '\0' : arg[0]);
+            } else if (strchr("di", conversion) != nullptr) {
+                long long value;
+                if (!printfInteger(arg, true, &value)) {
+                    return false;
+                }
+                length = snprintf(buffer, sizeof(buffer), (spec + "lld").c_str(), value);
+            } else if (strchr("ouxX", conversion) != nullptr) {
+                long long value;
+                if (!printfInteger(arg, false, &value)) {
+                    return false;
+                }
+                length = snprintf(buffer, sizeof(buffer), (spec + "ll" + conversion).c_str(),
+                                  (unsigned long long)value);
+            } else if (strchr("feEgGF", conversion) != nullptr) {
+                long double value;
+                if (!printfFloat(arg, &value)) {
+                    return false;
+                }
+                length = snprintf(buffer, sizeof(buffer), (spec + "L" + conversion).c_str(), value);
+            } else {
+                return false;
+            }
+            if (length < 0 || length >= (int)sizeof(buffer)) {
+                return false;
+            }
+            out.append(buffer, length);
+        }
+        // coreutils warns about arguments that a format without directives leaves over
+        if (next == usedBefore && next < args.size()) {
+            return false;
+        }
+    } while (next < args.size() && !stop);
+    return true;
+}
+
+// true, false and echo only take --help or --version as their only argument
+bool isInfoOption(const vector<string>& args) {
+    return args.size() == 2 && (args[1] == "--help" || args[1] == "--version");
+}
+
+} // namespace
+
+bool isUtilityName(const string& name) {
+    return name == "sleep" || name == "echo" || name == "true" || name == "false" ||
+           name == "test" || name == "[" || name == "printf" || name == "du" || name == "find";
+}
+
+bool isUtility(const vector<string>& args) {
+    if (args.empty() || !isUtilityName(args[0])) {
+        return false;
+    }
+    const string& name = args[0];
+    if (name == "du" || name == "find") {
+        return isWalk(args);
+    }
+    if (name == "sleep") {
+        double seconds;
+        return parseSleep(args, &seconds);
+    }
+    if (name == "test" || name == "[") {
+        size_t count;
+        bool result;
+        return !(name == "[" && isInfoOption(args)) && testOperands(args, &count) &&
+               evaluateTest(args, 1, count, &result);
+    }
+    if (name == "printf") {
+        string out;
+        return !isInfoOption(args) && formatPrintf(args, out);
+    }
+    return !isInfoOption(args);
+}
+
+int runUtility(const vector<string>& args) {
+    const string& name = args[0];
+    if (name == "true") {
+        return 0;
+    }
+    if (name == "false") {
+        return 1;
+    }
+    if (name == "echo") {
+        return runEcho(args);
+    }
+    if (name == "sleep") {
+        double seconds = 0;
+        parseSleep(args, &seconds);
+        return runSleep(seconds);
+    }
+    if (name == "du" || name == "find") {
+        return runWalk(args);
+    }
+    if (name == "printf") {
+        string out;
+        formatPrintf(args, out);
+        cout.write(out.data(), out.length());
+        return 0;
+    }
+    size_t count;
+    bool result = false;
+    testOperands(args, &count);
+    evaluateTest(args, 1, count, &result);
+    return result ? 0 : 1;
+}
@@ -0,0 +1,21 @@
+#ifndef SMASH_UTILITIES_H_
+#define SMASH_UTILITIES_H_
+
+#include <string>
+#include <vector>
+
+// Builtin versions of sleep, echo, true, false, test, [ and printf, so these common commands need
+// neither a fork nor an exec. Like the text filters they only take arguments they handle exactly
+// like coreutils; for anything else (--help, a malformed number, an unsupported printf directive...)
+// isUtility returns false and the real program runs, error messages included. du and find are
+// handled by the walker of walk.h.
+bool isUtilityName(const std::string& name);
+
+// args is the whole command after wildcard expansion
+bool isUtility(const std::vector<std::string>& args);
+
+// Runs the utility in the calling process with its output on cout and returns the exit status.
+// In the shell itself sleep keeps the event loop going and ends with status 130 on ctrl-C.
+int runUtility(const std::vector<std::string>& args);
+
+#endif //SMASH_UTILITIES_H_
@@ -0,0 +1,494 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include "dirents.h"
+#include "walk.h"
+#include "Commands.h"
+#include "signals.h"
+
+using namespace std;
+
+namespace {
+
+//---------------------------------- options ----------------------------------
+
+struct WalkOptions {
+    bool du = false;
+    bool apparentSize = false;       // du -b
+    vector<string> roots;
+    vector<string> names;            // find -name, all of them have to match
+    unsigned char type = DT_UNKNOWN; // find -type, DT_UNKNOWN for any
+};
+
+unsigned char typeOfLetter(char letter) {
+    switch (letter) {
+        case 'f': return DT_REG;
+        case 'd': return DT_DIR;
+        case 'l': return DT_LNK;
+        case 'b': return DT_BLK;
+        case 'c': return DT_CHR;
+        case 'p': return DT_FIFO;
+        case 's': return DT_SOCK;
+    }
+    return DT_UNKNOWN;
+}
+
+unsigned char typeOfMode(mode_t mode) {
+    return IFTODT(mode);
+}
+
+bool parseDu(const vector<string>& args, WalkOptions& options) {
+    options.du = true;
+    bool summarize = false;
+    size_t i = 1;
+    for (; i < args.size() && args[i].length() > 1 && args[i][0] == '-'; i++) {
+        if (args[i].find_first_not_of("sb", 1) != string::npos) {
+            return false;
+        }
+        summarize = summarize || args[i].find('s') != string::npos;
+        options.apparentSize = options.apparentSize || args[i].find('b') != string::npos;
+    }
+    for (; i < args.size(); i++) {
+        // Options after the paths are left to coreutils
+        if (args[i].empty() || args[i][0] == '-') {
+            return false;
+        }
+        options.roots.push_back(args[i]);
+    }
+    if (options.roots.empty()) {
+        options.roots.push_back(".");
+    }
+    return summarize;
+}
+
+bool parseFind(const vector<string>& args, WalkOptions& options) {
+    size_t i = 1;
+    for (; i < args.size() && args[i][0] != '-'; i++) {
+        // Operators and empty paths are left to findutils
+        if (args[i].empty() || args[i] == "!" || args[i] == "(" || args[i] == ")" || args[i] == ",") {
+            return false;
+        }
+        options.roots.push_back(args[i]);
+    }
+    if (options.roots.empty()) {
+        options.roots.push_back(".");
+    }
+    for (; i < args.size(); i += 2) {
+        if (args[i] == "-print" && i + 1 == args.size()) {
+            break;
+        }
+        if (i + 1 == args.size()) {
+            return false;
+        }
+        if (args[i] == "-name") {
+            options.names.push_back(args[i + 1]);
+        } else if (args[i] == "-type" && args[i + 1].length() == 1 && typeOfLetter(args[i + 1][0]) != DT_UNKNOWN &&
+                   options.type == DT_UNKNOWN) {
+            options.type = typeOfLetter(args[i + 1][0]);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool parseWalk(const vector<string>& args, WalkOptions& options) {
+    if (args.empty()) {
+        return false;
+    }
+    if (args[0] == "du") {
+        return parseDu(args, options);
+    }
+    return args[0] == "find" && parseFind(args, options);
+}
+
+//----------------------------------- walker ----------------------------------
+
+// An open directory, closed when the last of its subdirectories was opened
+struct Directory {
+    int fd;
+
+    explicit Directory(int fd) : fd(fd) {}
+    ~Directory() {
+        close(fd);
+    }
+};
+
+struct Task {
+    shared_ptr<Directory> parent; // nullptr for a path given on the command line
+    string path;                  // as it is printed
+    size_t nameStart;             // of the name within path, opened relative to parent
+    size_t root;                  // index of the path given on the command line it is under
+};
+
+struct FileId {
+    dev_t dev;
+    ino_t ino;
+
+    bool operator==(const FileId& other) const {
+        return dev == other.dev && ino == other.ino;
+    }
+};
+
+struct FileIdHash {
+    size_t operator()(const FileId& id) const {
+        return hash<uint64_t>()(id.ino) ^ (hash<uint64_t>()(id.dev) << 1);
+    }
+};
+
+class Walker {
+public:
+    Walker(const WalkOptions& options, unsigned numThreads);
+
+    int run();
+
+private:
+    struct Worker {
+        mutex lock; // of tasks, taken by the worker itself and by the ones stealing from it
+        deque<Task> tasks;
+        string output;
+        vector<uint64_t> sizes; // du, by root
+    };
+
+    const WalkOptions& options;
+    vector<unique_ptr<Worker>> workers;
+    vector<uint64_t> rootSizes;
+    vector<bool> rootFound; // du prints nothing for a path that does not exist
+
+    atomic<long> outstanding; // tasks queued or running, the walk is over when none are left
+    atomic<long> queued;
+    atomic<int> sleepers;
+    atomic<bool> stopped;
+    atomic<bool> failed;
+    mutex idleLock;
+    condition_variable idle;
+
+    mutex outputLock;
+    deque<string> chunks;
+    unsigned finishedWorkers;
+    condition_variable outputReady;
+    condition_variable outputSpace;
+
+    mutex errorLock;
+    mutex linksLock;
+    unordered_set<FileId, FileIdHash> links; // du counts a file with several hard links once
+
+    void error(const string& message);
+    bool matches(const char* name, unsigned char type) const;
+    uint64_t sizeOf(const struct stat& st);
+    void startRoot(size_t root);
+
+    void push(Worker& worker, Task&& task);
+    bool take(size_t self, Task& task);
+    void work(size_t self);
+    void walk(Worker& worker, const Task& task);
+    void flush(Worker& worker);
+};
+
+Walker::Walker(const WalkOptions& options, unsigned numThreads) : options(options), rootSizes(options.roots.size()),
+        rootFound(options.roots.size()),
+        outstanding(0), queued(0), sleepers(0), stopped(false), failed(false), finishedWorkers(0)
+{
+    for (unsigned i = 0; i < numThreads; i++) {
+        workers.emplace_back(new Worker());
+        workers.back()->sizes.resize(options.roots.size());
+    }
+}
+
+void Walker::error(const string& message) {
+    failed = true;
+    lock_guard<mutex> guard(errorLock);
+    cerr << message << endl;
+}
+
+bool Walker::matches(const char* name, unsigned char type) const {
+    if (options.type != DT_UNKNOWN && options.type != type) {
+        return false;
+    }
+    for (const string& pattern : options.names) {
+        if (fnmatch(pattern.c_str(), name, 0) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t Walker::sizeOf(const struct stat& st) {
+    if (!S_ISDIR(st.st_mode) && st.st_nlink > 1) {
+        lock_guard<mutex> guard(linksLock);
+        if (!links.insert({st.st_dev, st.st_ino}).second) {
+            return 0;
+        }
+    }
+    return options.apparentSize ? st.st_size : st.st_blocks * 512;
+}
+
+// The paths given on the command line are looked at before the threads start, like du and find
+// they are not followed if they are symbolic links
+void Walker::startRoot(size_t root) {
+    const string& path = options.roots[root];
+    struct stat st;
+    if (lstat(path.c_str(), &st) == -1) {
+        error(options.du ? "du: cannot access '" + path + "': " + strerror(errno)
+                         : "find: '" + path + "': " + strerror(errno));
+        return;
+    }
+    rootFound[root] = true;
+    if (options.du) {
+        rootSizes[root] += sizeOf(st);
+    } else {
+        size_t end = path.find_last_not_of('/');
+        string name = (end == string::npos) ? "/" : path.substr(0, end + 1);
+        name = name.substr((name == "/") ? 0 : name.rfind('/') + 1);
+        if (matches(name.c_str(), typeOfMode(st.st_mode))) {
+            cout << path << "\n";
+        }
+    }
+    if (S_ISDIR(st.st_mode)) {
+        push(*workers[root % workers.size()], {nullptr, path, 0, root});
+    }
+}
+
+void Walker::push(Worker& worker, Task&& task) {
+    outstanding++;
+    {
+        lock_guard<mutex> guard(worker.lock);
+        worker.tasks.push_back(move(task));
+    }
+    queued++;
+    if (sleepers > 0) {
+        lock_guard<mutex> guard(idleLock);
+        idle.notify_one();
+    }
+}
+
+// The newest task of its own, or the oldest one of another thread, which is the root of the largest
+// part of the tree still to walk
+bool Walker::take(size_t self, Task& task) {
+    for (size_t i = 0; i < workers.size(); i++) {
+        Worker& victim = *workers[(self + i) % workers.size()];
+        lock_guard<mutex> guard(victim.lock);
+        if (victim.tasks.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            task = move(victim.tasks.back());
+            victim.tasks.pop_back();
+        } else {
+            task = move(victim.tasks.front());
+            victim.tasks.pop_front();
+        }
+        queued--;
+        return true;
+    }
+    return false;
+}
+
+void Walker::work(size_t self) {
+    Worker& worker = *workers[self];
+    while (!stopped) {
+        Task task;
+        if (take(self, task)) {
+            walk(worker, task);
+            task.parent.reset();
+            if (--outstanding == 0) {
+                lock_guard<mutex> guard(idleLock);
+                idle.notify_all();
+            }
+            continue;
+        }
+        // Whatever was found goes out before the thread waits for more to do
+        flush(worker);
+        unique_lock<mutex> lock(idleLock);
+        sleepers++;
+        idle.wait(lock, [this]() { return queued > 0 || outstanding == 0 || stopped; });
+        sleepers--;
+        if (outstanding == 0) {
+            break;
+        }
+    }
+    flush(worker);
+    lock_guard<mutex> guard(outputLock);
+    finishedWorkers++;
+    outputReady.notify_all();
+}
+
+void Walker::walk(Worker& worker, const Task& task) {
+    const char* name = task.path.c_str() + task.nameStart;
+    int flags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+    int fd = (task.parent != nullptr) ? openat(task.parent->fd, name, flags) : open(task.path.c_str(), flags);
+    if (fd == -1) {
+        error(options.du ? "du: cannot read directory '" + task.path + "': " + strerror(errno)
+                         : "find: '" + task.path + "': " + strerror(errno));
+        return;
+    }
+    shared_ptr<Directory> directory = make_shared<Directory>(fd);
+    string prefix = task.path;
+    if (prefix.back() != '/') {
+        prefix += '/';
+    }
+
+    bool complete = forEachDirent(fd, [&](const char* entry, unsigned char type) {
+        if (stopped) {
+            return false;
+        }
+        // du needs the size of everything, find only the type when getdents64 does not tell it
+        if (options.du || type == DT_UNKNOWN) {
+            struct stat st;
+            if (fstatat(fd, entry, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+                error((options.du ? "du: cannot access '" : "find: '") + prefix + entry + "': " +
+                      strerror(errno));
+                return true;
+            }
+            type = typeOfMode(st.st_mode);
+            if (options.du) {
+                worker.sizes[task.root] += sizeOf(st);
+            }
+        }
+        if (!options.du && matches(entry, type)) {
+            worker.output += prefix;
+            worker.output += entry;
+            worker.output += '\n';
+            if (worker.output.size() >= WALK_CHUNK_SIZE) {
+                flush(worker);
+            }
+        }
+        if (type == DT_DIR) {
+            push(worker, {directory, prefix + entry, prefix.size(), task.root});
+        }
+        return true;
+    });
+    if (!complete) {
+        error(options.du ? "du: cannot read directory '" + task.path + "': " + strerror(errno)
+                         : "find: '" + task.path + "': " + strerror(errno));
+    }
+}
+
+void Walker::flush(Worker& worker) {
+    if (worker.output.empty()) {
+        return;
+    }
+    unique_lock<mutex> lock(outputLock);
+    outputSpace.wait(lock, [this]() { return chunks.size() < WALK_MAX_CHUNKS || stopped; });
+    chunks.push_back(move(worker.output));
+    worker.output.clear();
+    outputReady.notify_one();
+}
+
+// Takes a ctrl-C the shell got. The rest of the event loop waits until the threads are gone, so no
+// waiting job is started by a fork while they run.
+bool takeCtrlC() {
+    SmallShell& smash = SmallShell::getInstance();
+    if (smash.isInChild()) {
+        return false;
+    }
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    struct timespec zero = {0, 0};
+    if (sigtimedwait(&set, nullptr, &zero) == SIGINT) {
+        ctrlCHandler(SIGINT);
+    }
+    return smash.takeInterrupt();
+}
+
+// The calling thread writes the output while the workers walk
+int Walker::run() {
+    SmallShell::getInstance().takeInterrupt();
+    for (size_t root = 0; root < options.roots.size(); root++) {
+        startRoot(root);
+    }
+    cout.flush();
+    vector<thread> threads;
+    for (size_t i = 0; i < workers.size(); i++) {
+        threads.emplace_back(&Walker::work, this, i);
+    }
+
+    bool interrupted = false;
+    unique_lock<mutex> lock(outputLock);
+    while (true) {
+        outputReady.wait_for(lock, chrono::milliseconds(100), [this]() {
+            return !chunks.empty() || finishedWorkers == workers.size();
+        });
+        while (!chunks.empty() && !stopped) {
+            string chunk = move(chunks.front());
+            chunks.pop_front();
+            outputSpace.notify_one();
+            lock.unlock();
+            cout.write(chunk.data(), chunk.size());
+            lock.lock();
+        }
+        if (finishedWorkers == workers.size()) {
+            break;
+        }
+        lock.unlock();
+        if (!stopped && takeCtrlC()) {
+            interrupted = true;
+            stopped = true;
+            lock_guard<mutex> guard(idleLock);
+            idle.notify_all();
+        }
+        lock.lock();
+        if (stopped) {
+            outputSpace.notify_all();
+        }
+    }
+    lock.unlock();
+    for (thread& worker : threads) {
+        worker.join();
+    }
+    cout.flush();
+    if (interrupted) {
+        return 128 + SIGINT;
+    }
+
+    if (options.du) {
+        for (size_t root = 0; root < options.roots.size(); root++) {
+            if (!rootFound[root]) {
+                continue;
+            }
+            uint64_t size = rootSizes[root];
+            for (const auto& worker : workers) {
+                size += worker->sizes[root];
+            }
+            cout << (options.apparentSize ? size : (size + 1023) / 1024) << "\t" << options.roots[root] << "\n";
+        }
+        cout.flush();
+    }
+    return failed ? 1 : 0;
+}
+
+unsigned numWalkThreads() {
+    const char* forced = getenv("SMASH_WALK_THREADS");
+    long count = (forced != nullptr) ? atol(forced) : sysconf(_SC_NPROCESSORS_ONLN);
+    return (unsigned)max(1L, min(count, (long)WALK_MAX_THREADS));
+}
+
+} // namespace
+
+bool isWalk(const vector<string>& args) {
+    WalkOptions options;
+    return parseWalk(args, options);
+}
+
+int runWalk(const vector<string>& args) {
+    WalkOptions options;
+    parseWalk(args, options);
+    Walker walker(options, numWalkThreads());
+    return walker.run();
+}
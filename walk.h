@@ -0,0 +1,25 @@
+#ifndef SMASH_WALK_H_
+#define SMASH_WALK_H_
+
+#include <string>
+#include <vector>
+
+#define WALK_MAX_THREADS (16)
+#define WALK_CHUNK_SIZE (16384) // of the output a thread collects before handing it over
+#define WALK_MAX_CHUNKS (64)    // handed over and not written yet, a thread waits when there are more
+
+// Builtin versions of du -s and find -name, which walk the tree with a pool of threads, one per CPU
+// (SMASH_WALK_THREADS=N overrides the number). Every thread takes the directories it found itself
+// depth first and steals the oldest ones of the others when it runs out. Directories are opened with
+// openat relative to their parent and read with getdents64; find only stats an entry whose d_type the
+// file system left unknown. The results stream out as they are found, so find lists its paths in no
+// particular order. Only these forms are handled, anything else runs the real programs:
+//   du -s [-b] [PATH...]
+//   find [PATH...] [-name PATTERN] [-type f|d|l|b|c|p|s] [-print]
+// args is the whole command after wildcard expansion.
+bool isWalk(const std::vector<std::string>& args);
+
+// Returns the exit status, 130 if ctrl-C stopped the walk
+int runWalk(const std::vector<std::string>& args);
+
+#endif //SMASH_WALK_H_